@@ -3,6 +3,7 @@
 
 // std libraries
 #include <array>
+#include <functional>
 #include <limits>
 #include <memory>
 #include <utility>
@@ -77,7 +78,51 @@ namespace HashColon::Clustering
 	{
 	public:
 		using Ptr = std::shared_ptr<DistanceMeasureBase<DataType>>;
-		virtual HashColon::Real Measure(const DataType &a, const DataType &b) const = 0;
+
+		// upperBound: callers which only need results better than a threshold(e.g. neighbor search) pass it
+		// so that measures may abandon computation early.
+		// distance measures may return infinity for results not less than upperBound,
+		// similarity measures may return -infinity for results not greater than upperBound.
+		// infinity(default) means no bound.
+		virtual HashColon::Real Measure(
+			const DataType &a, const DataType &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const = 0;
+
+		// One-vs-many measurement: oResults[k] = Measure(query, *targets[k]).
+		// Measures override this to prepare the query once and stream targets.
+		virtual void MeasureBatch(
+			const DataType &query, const std::vector<const DataType *> &targets,
+			std::vector<HashColon::Real> &oResults) const
+		{
+			oResults.resize(targets.size());
+			for (size_t k = 0; k < targets.size(); k++)
+				oResults[k] = Measure(query, *targets[k]);
+		};
+
+		// Many-vs-many measurement: oResults(q, k) = Measure(*queries[q], *targets[k]).
+		virtual void MeasureBlock(
+			const std::vector<const DataType *> &queries, const std::vector<const DataType *> &targets,
+			Eigen::MatrixXR &oResults) const
+		{
+			oResults.resize(queries.size(), targets.size());
+			std::vector<HashColon::Real> row;
+			for (size_t q = 0; q < queries.size(); q++)
+			{
+				MeasureBatch(*queries[q], targets, row);
+				for (size_t k = 0; k < targets.size(); k++)
+					oResults(q, k) = row[k];
+			}
+		};
+
+		// All-pairs measurement: oMatrix(i, j) = Measure(data[i], data[j]).
+		// Measures which can compute the whole matrix at once(e.g. by a matrix product) override this.
+		// Paths approximating Measure must be opt-in of the measure, as callers rely on the equality above.
+		// Returns false if not available for the data, then callers fall back to pairwise measurement.
+		virtual bool MeasureMatrix(const std::vector<DataType> &, Eigen::MatrixXR &) const
+		{
+			return false;
+		};
+
 		const DistanceMeasureType _measureType;
 		const DistanceMeasureType GetMeasureType() const { return _measureType; };
 		virtual const std::string GetMethodName() const = 0;
@@ -366,6 +411,24 @@ namespace HashColon::Clustering
 			typename ClusteringBase<DataType>::ProbListPtr oProbabilities = nullptr)
 			override final;
 
+		// trains model with precomputed epsilon-neighbor lists.
+		// iNeighbors[i] holds every j != i where distance(i, j) < DbscanEpsilon.
+		// useful when neighbors are found without building full distance matrix.
+		// iWeights[i] is the number of samples represented by i-th item. (empty: every item counts as 1)
+		// An item is a core point if (iWeights[i] - 1) + sum of iWeights of its neighbors >= minPts.
+		void TrainModel_withNeighbors(
+			const std::vector<std::vector<size_t>> &iNeighbors,
+			typename ClusteringBase<DataType>::LabelsPtr oLabels,
+			const std::vector<size_t> &iWeights = {});
+
+		// trains model with weighted items, such as representatives of deduplicated data.
+		// samples represented by an item should be closer than DbscanEpsilon(strictly) to it,
+		// e.g. DuplicateEpsilon < DbscanEpsilon for TrajectoryDeduplication.
+		void TrainModel_withWeights(
+			const Eigen::MatrixXR &iRawDistanceMatrix, bool isDistance,
+			const std::vector<size_t> &iWeights,
+			typename ClusteringBase<DataType>::LabelsPtr oLabels);
+
 		// get cluster label for a given data sample.
 		// training most be done before using this function.
 		size_t GetClusterOf(
@@ -399,8 +462,11 @@ namespace HashColon::Clustering
 		Eigen::MatrixXR ConvertSimilarity2Distance(const Eigen::MatrixXR &S) const;
 
 		std::vector<std::vector<size_t>> GetNeighbors(const Eigen::MatrixXR &DistMatrix) const;
+		std::vector<std::vector<size_t>> GetNeighbors(const Eigen::MatrixXR &iRawDistMatrix, bool isDistance) const;
+		bool IsCorePoint(size_t p, const std::vector<std::vector<size_t>> &neighbors, const std::vector<size_t> &weights) const;
 		void DbscanBfs(size_t initP, size_t clusterIdx,
-					   std::vector<std::vector<size_t>> &neighbors, std::vector<size_t> &labels) const;
+					   const std::vector<std::vector<size_t>> &neighbors, const std::vector<size_t> &weights,
+					   std::vector<size_t> &labels) const;
 	};
 }
 
@@ -515,6 +581,41 @@ namespace HashColon::Clustering
 
 	// silhouette for all data
 	std::vector<HashColon::Real> Silhouette(const std::vector<size_t> &clusterResult, const Eigen::MatrixXR &DistanceMatrix);
+
+	/*
+	 * Sampling-based approximate evaluation.
+	 * Useful for ranking many candidate labelings without building the full distance matrix.
+	 * Items are sampled from each cluster(stratified sampling), and only distances needed
+	 * by the sampled items are requested from the distance oracle.
+	 * Each score is given as ValueInterval: repVal is the estimate, [minVal, maxVal] is the confidence interval.
+	 */
+
+	// returns distance between i-th and j-th item
+	using DistanceOracle = std::function<HashColon::Real(size_t, size_t)>;
+
+	template <typename DataType>
+	DistanceOracle GetDistanceOracle(
+		const typename DistanceMeasureBase<DataType>::Ptr measure, const std::vector<DataType> &data);
+
+	struct ApproximateEvaluationResults
+	{
+		std::vector<HashColon::ValueInterval<HashColon::Real>> ClusterResults;
+		HashColon::ValueInterval<HashColon::Real> TotalResults;
+		size_t MeasureCount; // number of distance oracle calls
+	};
+
+	// Mean silhouette of each cluster and of all data.
+	// Silhouette of each sampled item is exact, therefore costs O(samplesPerCluster * N) distance calls.
+	ApproximateEvaluationResults ApproximateSilhouette(
+		const std::vector<size_t> &clusterResult, const DistanceOracle &distFunc,
+		size_t samplesPerCluster, HashColon::Real confidenceLevel = 0.95, unsigned int seed = 0);
+
+	// ClusterResults: RMS distance to the sampled medoid of each cluster. (same as PseudoDaviesBouldin)
+	// TotalResults: Davies-Bouldin index using the cluster results and distances between sampled medoids.
+	// Medoid is chosen among sampled items, therefore costs O(samplesPerCluster^2 * clusterNo) distance calls.
+	ApproximateEvaluationResults ApproximateDaviesBouldin(
+		const std::vector<size_t> &clusterResult, const DistanceOracle &distFunc,
+		size_t samplesPerCluster, HashColon::Real confidenceLevel = 0.95, unsigned int seed = 0);
 	// HashColon::Real ClassificationError(const std::vector<size_t>& clusterResult, const std::vector<size_t>& givenLabel);
 	// HashColon::Real VariationOfInfomration(const std::vector<size_t>& clusterResult, const std::vector<size_t>& givenLabel);
 }
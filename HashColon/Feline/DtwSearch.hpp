@@ -0,0 +1,90 @@
+#ifndef HASHCOLON_FELINE_DTWSEARCH
+#define HASHCOLON_FELINE_DTWSEARCH
+
+// std libraries
+#include <memory>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// HashColon libraries
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * DtwSearch
+	 * Range and kNN queries under DynamicTimeWarping, pruned by cascaded lower bounds.
+	 * 1. LB_Kim: cost of the last cell and the cheapest second cell of the warping path. Exact geodesic distances.
+	 * 2. LB_Keogh: each row of the warping table costs at least the distance from a[i] to the bounding box
+	 *    of b over the band of the row. Envelopes are precomputed for queries of the same length in LocalProjection
+	 *    around the circular mean of longitudes, with longitude differences wrapped to [-180, 180).
+	 *    The bound is scaled by the smallest local-to-geodesic scale over the pair(cos(lat) / cos(lat0),
+	 *    lat including the poleward bulge of great circles over the longitude span), so that it stays
+	 *    a lower bound over wide latitude and longitude spans. Pairs spanning 180 degrees of longitude or more
+	 *    can not be bounded, and queries of other lengths skip LB_Keogh, both bounded by 0.
+	 * 3. Early-abandoning banded DTW with the current cutoff.
+	 * Keogh, E., & Ratanamahatana, C. A. (2005).
+	 * Exact indexing of dynamic time warping.
+	 * Knowledge and Information Systems, 7(3), 358–386.
+	 * https://doi.org/10.1007/s10115-004-0154-9
+	 */
+	class DtwSearch
+	{
+	public:
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(DtwSearch);
+
+	protected:
+		DynamicTimeWarping::Ptr _measure;
+		const std::vector<HashColon::Feline::XYList> *_data;
+		LocalProjection _proj;
+		std::vector<std::vector<Eigen::Vector2R>> _local;
+		std::vector<std::vector<Eigen::Vector2R>> _lower;
+		std::vector<std::vector<Eigen::Vector2R>> _upper;
+
+		// extent of local points in degree. longitudes relative to the base.
+		struct Extent
+		{
+			HashColon::Real MaxAbsLat;
+			HashColon::Real MinLon;
+			HashColon::Real MaxLon;
+		};
+		std::vector<Extent> _extents;
+
+		Extent GetExtent(const std::vector<Eigen::Vector2R> &local) const;
+
+		// factor not larger than (geodesic distance) / (local distance) for points within the extent
+		HashColon::Real LocalToGeodesicScale(const Extent &extent) const;
+
+		HashColon::Real LB_Kim_core(const HashColon::Feline::XYList &q, bool reversed, size_t idx) const;
+		HashColon::Real LB_Keogh_core(const std::vector<Eigen::Vector2R> &q, bool reversed, size_t idx) const;
+
+	public:
+		using Ptr = std::shared_ptr<DtwSearch>;
+
+		// data should outlive this object
+		DtwSearch(DynamicTimeWarping::Ptr measure, const std::vector<HashColon::Feline::XYList> &data);
+
+		// local coordinates of traj as LB_Keogh takes them
+		std::vector<Eigen::Vector2R> ToLocal(const HashColon::Feline::XYList &traj) const;
+
+		// lower bounds of measure->Measure(q, data[idx]) (normalized as DynamicTimeWarping)
+		HashColon::Real LB_Kim(const HashColon::Feline::XYList &q, size_t idx) const;
+		HashColon::Real LB_Keogh(const std::vector<Eigen::Vector2R> &qLocal, size_t idx) const;
+
+		// D(q, data[idx]) if it is smaller than cutoff, infinity otherwise.
+		HashColon::Real MeasureWithCutoff(
+			const HashColon::Feline::XYList &q, const std::vector<Eigen::Vector2R> &qLocal,
+			size_t idx, HashColon::Real cutoff) const;
+
+		// epsilon-neighbor lists(D < epsilon) of data, usable by DistanceBasedDBSCAN::TrainModel_withNeighbors
+		std::vector<std::vector<size_t>> GetRangeNeighbors(HashColon::Real epsilon) const;
+
+		// k nearest data of query, closest first
+		std::vector<size_t> GetKNearest(const HashColon::Feline::XYList &query, size_t k) const;
+	};
+}
+
+#endif
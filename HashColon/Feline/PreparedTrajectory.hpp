@@ -0,0 +1,130 @@
+#ifndef HASHCOLON_FELINE_PREPAREDTRAJECTORY
+#define HASHCOLON_FELINE_PREPAREDTRAJECTORY
+
+// std libraries
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+#include <HashColon/Feline/XtdTrajectoryClustering.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * PreparedTrajectory
+	 * Trajectory converted once into structure-of-arrays float buffers in a LocalProjection(metre).
+	 * Point distances become plain arithmetic instead of GeoDistance calls,
+	 * which is accurate as long as the LocalProjection is(see LocalProjection).
+	 * All trajectories measured together should be prepared with the same projection.
+	 */
+	struct PreparedTrajectory
+	{
+		std::vector<float> X;
+		std::vector<float> Y;
+		// CumLength[i]: length from the first point to i-th point
+		std::vector<float> CumLength;
+
+		size_t size() const { return X.size(); };
+		float Length() const { return CumLength.empty() ? 0 : CumLength.back(); };
+
+		static PreparedTrajectory Prepare(const HashColon::Feline::XYList &traj, const LocalProjection &proj);
+		static std::vector<PreparedTrajectory> Prepare(
+			const std::vector<HashColon::Feline::XYList> &trajlist, const LocalProjection &proj);
+
+		// waypoint positions only. XTD-aware measures build their own per-waypoint data(see DtwXtd_usingJSDivergence).
+		static PreparedTrajectory Prepare(const HashColon::Feline::XYXtdList &traj, const LocalProjection &proj);
+		static std::vector<PreparedTrajectory> Prepare(
+			const std::vector<HashColon::Feline::XYXtdList> &trajlist, const LocalProjection &proj);
+	};
+
+	/*
+	 * PreparedTrajectoryMeasure
+	 * Runs a trajectory measure on PreparedTrajectory with float kernels.
+	 * Parameters(reversed sequence option, LCSS epsilon/delta, DTW band) are taken from the given source measure.
+	 * Supported sources: Hausdorff, Euclidean, Merge, LCSS, DynamicTimeWarping.
+	 * Sources with Enable_PreparedKernel use this in their MeasureMatrix(see TrajectoryDistanceMeasureBase).
+	 */
+	class PreparedTrajectoryMeasure
+		: public HashColon::Clustering::DistanceMeasureBase<PreparedTrajectory>
+	{
+	public:
+		enum KernelType
+		{
+			Kernel_Hausdorff,
+			Kernel_Euclidean,
+			Kernel_Merge,
+			Kernel_LCSS,
+			Kernel_DynamicTimeWarping
+		};
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(PreparedTrajectoryMeasure);
+
+	protected:
+		TrajectoryDistanceMeasureBase::Ptr _source;
+		KernelType _kernel;
+		bool _enableReversedSequence;
+
+		// a is read backward if reversed is true. upperBound as Measure, used by DTW and Euclidean kernels.
+		HashColon::Real Measure_core(
+			const PreparedTrajectory &a, const PreparedTrajectory &b, bool reversed, HashColon::Real upperBound) const;
+
+	public:
+		using Ptr = std::shared_ptr<PreparedTrajectoryMeasure>;
+
+		PreparedTrajectoryMeasure(TrajectoryDistanceMeasureBase::Ptr source);
+
+		// true if a prepared kernel is available for the source measure
+		static bool IsAvailableFor(const TrajectoryDistanceMeasureBase &source);
+
+		KernelType GetKernelType() const { return _kernel; };
+		const std::string GetMethodName() const override final { return "Prepared" + _source->GetMethodName(); };
+
+		HashColon::Real Measure(
+			const PreparedTrajectory &a, const PreparedTrajectory &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const override final;
+
+		// all-pairs Measure(OpenMP dynamic scheduling over rows)
+		bool MeasureMatrix(const std::vector<PreparedTrajectory> &data, Eigen::MatrixXR &oMatrix) const override final;
+	};
+
+	/*
+	 * PreparedXtdTrajectoryMeasure
+	 * Runs DtwXtd on PreparedTrajectory of waypoint positions with float kernels.
+	 * DtwXtd with Enable_PreparedKernel uses this in its MeasureMatrix.
+	 */
+	class PreparedXtdTrajectoryMeasure
+		: public HashColon::Clustering::DistanceMeasureBase<PreparedTrajectory>
+	{
+	public:
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(PreparedXtdTrajectoryMeasure);
+
+	protected:
+		std::shared_ptr<HashColon::Feline::XtdTrajectoryClustering::DtwXtd> _source;
+		bool _enableReversedSequence;
+
+		HashColon::Real Measure_core(
+			const PreparedTrajectory &a, const PreparedTrajectory &b, bool reversed, HashColon::Real upperBound) const;
+
+	public:
+		using Ptr = std::shared_ptr<PreparedXtdTrajectoryMeasure>;
+
+		PreparedXtdTrajectoryMeasure(std::shared_ptr<HashColon::Feline::XtdTrajectoryClustering::DtwXtd> source);
+
+		const std::string GetMethodName() const override final { return "Prepared" + _source->GetMethodName(); };
+
+		HashColon::Real Measure(
+			const PreparedTrajectory &a, const PreparedTrajectory &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const override final;
+
+		// all-pairs Measure(OpenMP dynamic scheduling over rows)
+		bool MeasureMatrix(const std::vector<PreparedTrajectory> &data, Eigen::MatrixXR &oMatrix) const override final;
+	};
+}
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef HASHCOLON_FELINE_SEGMENTCLUSTERING
+#define HASHCOLON_FELINE_SEGMENTCLUSTERING
+
+// std libraries
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * TrajectorySegment
+	 * A line segment between two characteristic points of a trajectory.
+	 * S, E are the positions of the start/end points in the LocalProjection of the clustering.
+	 */
+	struct TrajectorySegment
+	{
+		size_t TrajectoryIdx;
+		size_t StartIdx;
+		size_t EndIdx;
+		Eigen::Vector2R S;
+		Eigen::Vector2R E;
+
+		HashColon::Real Length() const { return (E - S).norm(); };
+	};
+
+	/*
+	 * Segment distance of TRACLUS: weighted sum of perpendicular, parallel and angle distances.
+	 * Lee, J. G., Han, J., & Whang, K. Y. (2007).
+	 * Trajectory clustering: A partition-and-group framework.
+	 * Proceedings of the ACM SIGMOD International Conference on Management of Data, 593–604.
+	 * https://doi.org/10.1145/1247480.1247546
+	 */
+	class SegmentDistance : public HashColon::Clustering::DistanceMeasureBase<TrajectorySegment>
+	{
+	public:
+		struct _Params
+		{
+			HashColon::Real Weight_Perpendicular;
+			HashColon::Real Weight_Parallel;
+			HashColon::Real Weight_Angle;
+		};
+
+	protected:
+		static inline _Params _cDefault;
+		const _Params _c;
+
+	public:
+		using Ptr = std::shared_ptr<SegmentDistance>;
+
+		SegmentDistance(_Params params = _cDefault)
+			: HashColon::Clustering::DistanceMeasureBase<TrajectorySegment>(
+				  HashColon::Clustering::DistanceMeasureType::distance),
+			  _c(params){};
+
+		static void Initialize(const std::string configFilePath = "");
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		// closed form. upperBound is not used.
+		HashColon::Real Measure(
+			const TrajectorySegment &a, const TrajectorySegment &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const override final;
+		const std::string GetMethodName() const override final { return "SegmentDistance"; };
+
+		// If D(a, b) < epsilon, an end point of a is closer than this margin(metre) to an end point of b.
+		// Infinity if perpendicular or parallel weight is 0.
+		HashColon::Real SearchMargin(HashColon::Real epsilon) const;
+	};
+
+	/*
+	 * SegmentGridIndex
+	 * Uniform grid of segments. Each segment is registered to the cells of its two end points.
+	 * If D(a, b) < epsilon, an end point of a is within SegmentDistance::SearchMargin(epsilon)
+	 * from an end point of b, therefore end point cells are sufficient for range queries.
+	 */
+	class SegmentGridIndex
+	{
+	protected:
+		HashColon::Real _cellSize;
+		const std::vector<TrajectorySegment> *_segments;
+		std::unordered_map<long long, std::vector<size_t>> _cells;
+
+		long long CellKey(long long cx, long long cy) const { return (long long)(((std::uint64_t)cx << 32) ^ ((std::uint64_t)cy & 0xffffffffULL)); };
+		long long CellCoord(HashColon::Real v) const { return (long long)std::floor(v / _cellSize); };
+
+	public:
+		SegmentGridIndex(const std::vector<TrajectorySegment> &segments, HashColon::Real cellSize);
+
+		// indices of segments having an end point in cells within margin from the end points of given segment.
+		std::vector<size_t> Query(const TrajectorySegment &seg, HashColon::Real margin) const;
+	};
+
+	/*
+	 * SegmentClustering
+	 * Partition-and-group clustering of trajectories(TRACLUS).
+	 * 1. Each trajectory is partitioned into line segments by approximate MDL partitioning.
+	 * 2. Segments are indexed in a uniform grid. Epsilon-neighbors of each segment are found
+	 *    from grid candidates instead of all pairs, then clustered by DistanceBasedDBSCAN.
+	 * 3. Clusters whose segments come from less than MinTrajectoryCardinality trajectories are dismissed as noise.
+	 * 4. Optionally, a representative trajectory is built for each cluster by sweeping along the mean direction.
+	 * Reference: see SegmentDistance.
+	 */
+	class SegmentClustering
+	{
+	public:
+		struct _Params
+		{
+			HashColon::Real MdlCostAdvantage;
+			size_t MinLines;
+			HashColon::Real DbscanEpsilon;
+			size_t MinTrajectoryCardinality;
+			HashColon::Real GridCellSize;
+			bool Enable_Representative;
+			HashColon::Real RepresentativeSmoothing;
+		};
+
+		struct Results
+		{
+			LocalProjection Projection;
+			std::vector<TrajectorySegment> Segments;
+			// label of each segment. 0: noise, 1~: clusters
+			std::vector<size_t> Labels;
+			// number of clusters excluding noise
+			size_t NumOfClusters;
+			// Representatives[c] is the representative trajectory of cluster (c + 1)
+			std::vector<HashColon::Feline::XYList> Representatives;
+		};
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(SegmentClustering);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+		SegmentDistance::Ptr _measure;
+
+	public:
+		using Ptr = std::shared_ptr<SegmentClustering>;
+
+		SegmentClustering(SegmentDistance::Ptr measure = std::make_shared<SegmentDistance>(), _Params params = _cDefault)
+			: _c(params), _measure(measure){};
+
+		static void Initialize(const std::string configFilePath = "");
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		// approximate MDL partitioning. returns indices of characteristic points.
+		std::vector<size_t> GetCharacteristicPoints(const HashColon::Feline::XYList &traj, const LocalProjection &proj) const;
+
+		std::vector<TrajectorySegment> Partition(
+			const std::vector<HashColon::Feline::XYList> &trajlist, const LocalProjection &proj) const;
+
+		// epsilon-neighbor lists of segments using grid index
+		std::vector<std::vector<size_t>> GetNeighbors(const std::vector<TrajectorySegment> &segments) const;
+
+		HashColon::Feline::XYList GetRepresentative(
+			const std::vector<TrajectorySegment> &segments, const std::vector<size_t> &members,
+			const LocalProjection &proj) const;
+
+		Results Run(const std::vector<HashColon::Feline::XYList> &trajlist) const;
+	};
+}
+
+#endif
@@ -2,7 +2,10 @@
 #define HASHCOLON_FELINE_TRAJECTORYCLUSTERING
 
 // std libraries
+#include <limits>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 // dependant external libraries
 #include <Eigen/Eigen>
@@ -13,6 +16,62 @@
 
 namespace HashColon::Feline::TrajectoryClustering
 {
+	/*
+	 * LocalProjection
+	 * Equirectangular projection around a base position.
+	 * Converts positions to local metric coordinates(metre) for geometric computations.
+	 * Valid only for regions small enough to ignore the curvature of the earth.
+	 */
+	struct LocalProjection
+	{
+		HashColon::Feline::XY Base;
+		HashColon::Real LonUnit;
+		HashColon::Real LatUnit;
+
+		LocalProjection() : LocalProjection(HashColon::Feline::XY()){};
+		LocalProjection(const HashColon::Feline::XY base)
+			: Base(base),
+			  LonUnit(HashColon::GeoDistance::cartesian.lonUnit(base)),
+			  LatUnit(HashColon::GeoDistance::cartesian.latUnit(base)){};
+
+		// projection centered at the mean position of all points
+		static LocalProjection FromTrajectories(const std::vector<HashColon::Feline::XYList> &trajlist)
+		{
+			HashColon::Feline::XY base;
+			base.longitude = 0;
+			base.latitude = 0;
+			size_t cnt = 0;
+			for (const auto &traj : trajlist)
+				for (const auto &p : traj)
+				{
+					base.longitude += p.longitude;
+					base.latitude += p.latitude;
+					cnt++;
+				}
+			if (cnt > 0)
+			{
+				base.longitude /= (HashColon::Real)cnt;
+				base.latitude /= (HashColon::Real)cnt;
+			}
+			return LocalProjection(base);
+		};
+
+		Eigen::Vector2R ToLocal(const HashColon::Feline::XY &p) const
+		{
+			return Eigen::Vector2R(
+				(p.longitude - Base.longitude) * LonUnit,
+				(p.latitude - Base.latitude) * LatUnit);
+		};
+
+		HashColon::Feline::XY ToGeo(const Eigen::Vector2R &v) const
+		{
+			HashColon::Feline::XY re;
+			re.longitude = Base.longitude + v(0) / LonUnit;
+			re.latitude = Base.latitude + v(1) / LatUnit;
+			return re;
+		};
+	};
+
 	std::vector<HashColon::Feline::XYList> UniformSampling(
 		std::vector<HashColon::Feline::XYList> &trajlist,
 		size_t SampleNumber);
@@ -20,6 +79,12 @@ namespace HashColon::Feline::TrajectoryClustering
 	/*
 	 * TrajectoryDistanceMeasureBase
 	 * Base class for all trajectory distance/similarity measuring methods
+	 * Measures are single-threaded kernels, as they are called from parallel pair loops(e.g. ComputeDistanceMatrix).
+	 * Kernels supporting it may parallelize a single pair only if the pair is large(InnerParallelThreshold)
+	 * and the call is not already inside a parallel region.
+	 * If Enable_PreparedKernel is true, MeasureMatrix runs float kernels on trajectories prepared once
+	 * in a LocalProjection of the whole data(see PreparedTrajectoryMeasure for the supported measures).
+	 * The matrix is approximate as the projection is, therefore disabled by default.
 	 */
 	class TrajectoryDistanceMeasureBase
 		: public HashColon::Clustering::DistanceMeasureBase<HashColon::Feline::XYList>
@@ -28,6 +93,8 @@ namespace HashColon::Feline::TrajectoryClustering
 		struct _Params
 		{
 			bool Enable_ReversedSequence;
+			size_t InnerParallelThreshold; // min. n x m of a pair to parallelize in the kernel. 0: never
+			bool Enable_PreparedKernel;
 		};
 
 	protected:
@@ -35,18 +102,59 @@ namespace HashColon::Feline::TrajectoryClustering
 		const _Params _c;
 
 	public:
+		using Ptr = std::shared_ptr<TrajectoryDistanceMeasureBase>;
+
 		static _Params &GetDefaultParams() { return _cDefault; };
 		_Params GetParams() { return _c; };
 		static void Initialize(const std::string configFilePath = "");
 
 		HashColon::Real Measure(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override;
+			const HashColon::Feline::XYList &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const override;
+
+		// reversed query is built once for all targets
+		void MeasureBatch(
+			const HashColon::Feline::XYList &query,
+			const std::vector<const HashColon::Feline::XYList *> &targets,
+			std::vector<HashColon::Real> &oResults) const override;
+
+		// available only for Enable_PreparedKernel and measures having prepared kernels. approximate, see above.
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYList> &data,
+			Eigen::MatrixXR &oMatrix) const override;
+
+		// Returns D(a, b) < threshold. For distance type measures only.
+		// Measures having a decision procedure cheaper than their value(e.g. DiscreteFrechet) override this.
+		virtual bool IsWithin(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			HashColon::Real threshold) const;
+
+		// Upper bound of |D(a, b) - D(a', b')| where a', b' are coarse approximations of a, b
+		// and errA, errB are the discrete Frechet distances between each original and its approximation.
+		// Measures without a known bound return infinity, which makes coarse-to-fine computation fall back to exact values.
+		virtual HashColon::Real CoarseErrorBound(HashColon::Real, HashColon::Real) const
+		{
+			return std::numeric_limits<HashColon::Real>::infinity();
+		};
 
 	protected:
+		// a is read backward if reversed is true, so that no reversed copy is needed.
+		// upperBound as Measure. distance measures return infinity when abandoned, similarity measures -infinity.
 		virtual HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const = 0;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const = 0;
+
+		// best of forward and reversed a(min for distance, max for similarity) with upperBound as Measure.
+		// By default the reversed kernel runs bounded by the forward result.
+		// Kernels which can share work between two directions(e.g. distance rows of DP tables) override this.
+		virtual HashColon::Real MeasureBothDirections_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			HashColon::Real upperBound) const;
 
 		TrajectoryDistanceMeasureBase(HashColon::Clustering::DistanceMeasureType type, _Params params = _cDefault)
 			: HashColon::Clustering::DistanceMeasureBase<HashColon::Feline::XYList>(type), _c(params){};
@@ -54,6 +162,11 @@ namespace HashColon::Feline::TrajectoryClustering
 
 	/*
 	 * Hausdorff distance
+	 * Symmetric Hausdorff distance by early-breaking algorithm with randomized point order.
+	 * Taha, A. A., & Hanbury, A. (2015).
+	 * An efficient algorithm for calculating the exact Hausdorff distance.
+	 * IEEE Transactions on Pattern Analysis and Machine Intelligence, 37(11), 2153–2163.
+	 * https://doi.org/10.1109/TPAMI.2015.2408351
 	 */
 	class Hausdorff : public TrajectoryDistanceMeasureBase
 	{
@@ -63,33 +176,76 @@ namespace HashColon::Feline::TrajectoryClustering
 		Hausdorff(_Params params = _cDefault)
 			: TrajectoryDistanceMeasureBase(
 				  HashColon::Clustering::DistanceMeasureType::distance,
-				  {false}){};
+				  {false, params.InnerParallelThreshold, params.Enable_PreparedKernel}){};
 
 		const std::string GetMethodName() const override final { return "Hausdorff"; };
 
+		// Hausdorff distance is 1-Lipschitz w.r.t. Hausdorff perturbation of each set,
+		// which is bounded by the discrete Frechet distance.
+		HashColon::Real CoarseErrorBound(HashColon::Real errA, HashColon::Real errB) const override final
+		{
+			return errA + errB;
+		};
+
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
 	 * Euclidean distance
+	 * Mean of distances between points of the same index.
+	 * If Enable_RootMeanSquare is true, root mean square of the distances is used instead.
+	 * RMS is a norm of concatenated coordinates, therefore all-pairs distances of trajectories of the same size
+	 * can be computed by one matrix product in MeasureMatrix if Enable_ProjectedMatrix is true.
+	 * The matrix is approximate: points are projected by one LocalProjection of the whole data,
+	 * whose east-west error grows with the latitude difference from its base(~6% at 5 degrees off 35N),
+	 * while Measure uses geodesic point distances. Disabled by default, so that ComputeDistanceMatrix
+	 * gives the same values as Measure.
 	 */
 	class Euclidean : public TrajectoryDistanceMeasureBase
 	{
 	public:
-		Euclidean(_Params params = _cDefault)
+		struct _Params : public TrajectoryDistanceMeasureBase::_Params
+		{
+			bool Enable_RootMeanSquare;
+			bool Enable_ProjectedMatrix;
+		};
+
+	protected:
+		static inline _Params _cDefault;
+		const _Params _c;
+
+	public:
+		static void Initialize(const std::string configFilePath = "");
+
+		Euclidean() : TrajectoryDistanceMeasureBase(
+						  HashColon::Clustering::DistanceMeasureType::distance),
+					  _c({TrajectoryDistanceMeasureBase::_cDefault, _cDefault.Enable_RootMeanSquare, _cDefault.Enable_ProjectedMatrix}){};
+
+		Euclidean(_Params params)
 			: TrajectoryDistanceMeasureBase(
-				  HashColon::Clustering::DistanceMeasureType::distance,
-				  params){};
+				  HashColon::Clustering::DistanceMeasureType::distance, params),
+			  _c(params){};
 
+		_Params GetParams() const { return _c; };
 		const std::string GetMethodName() const override final { return "Euclidean"; };
 
+		// available only for RMS, trajectories of the same size and Enable_ProjectedMatrix. approximate, see above.
+		// otherwise as TrajectoryDistanceMeasureBase.
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -112,7 +268,61 @@ namespace HashColon::Feline::TrajectoryClustering
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
+	};
+
+	/*
+	 * Discrete Frechet distance
+	 * Min. over monotone couplings of the max. distance between coupled points.
+	 * Computed with a rolling row, and abandoned as soon as the first/last point pairs or a whole row reach upperBound.
+	 * IsWithin decides D(a, b) < threshold on the free space of the coupling table without computing the value,
+	 * visiting only cells reachable from the first point pair(about n + m cells for similar trajectories).
+	 *
+	 * Eiter, T., & Mannila, H. (1994).
+	 * Computing discrete Frechet distance.
+	 * Technical Report CD-TR 94/64, Christian Doppler Laboratory for Expert Systems, TU Vienna.
+	 */
+	class DiscreteFrechet : public TrajectoryDistanceMeasureBase
+	{
+	public:
+		DiscreteFrechet(_Params params = _cDefault)
+			: TrajectoryDistanceMeasureBase(
+				  HashColon::Clustering::DistanceMeasureType::distance,
+				  params){};
+
+		const std::string GetMethodName() const override final { return "DiscreteFrechet"; };
+
+		bool IsWithin(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			HashColon::Real threshold) const override final;
+
+		// discrete Frechet distance is a metric.
+		HashColon::Real CoarseErrorBound(HashColon::Real errA, HashColon::Real errB) const override final
+		{
+			return errA + errB;
+		};
+
+	protected:
+		HashColon::Real Measure_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
+
+		// forward and reversed tables in one pass, sharing distance rows
+		HashColon::Real MeasureBothDirections_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			HashColon::Real upperBound) const override final;
+
+		bool IsWithin_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real threshold) const;
 	};
 
 	/*
@@ -147,12 +357,15 @@ namespace HashColon::Feline::TrajectoryClustering
 				  HashColon::Clustering::DistanceMeasureType::similarity, params),
 			  _c(params){};
 
+		_Params GetParams() const { return _c; };
 		const std::string GetMethodName() const override final { return "LCSS"; };
 
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -194,10 +407,17 @@ namespace HashColon::Feline::TrajectoryClustering
 
 		const std::string GetMethodName() const override final { return "ProjectedPCA"; };
 
+		// all-pairs distances by one matrix product in the reduced space. RunPCA should be done before.
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -206,17 +426,58 @@ namespace HashColon::Feline::TrajectoryClustering
 	class DynamicTimeWarping : public TrajectoryDistanceMeasureBase
 	{
 	public:
-		DynamicTimeWarping(_Params params = _cDefault)
-			: TrajectoryDistanceMeasureBase(
-				  HashColon::Clustering::DistanceMeasureType::distance,
-				  params){};
+		enum DtwBandType
+		{
+			DtwBand_None,
+			DtwBand_SakoeChiba,
+			DtwBand_Itakura
+		};
 
-		const std::string GetMethodName() const override final { return "DynamicTimeWarping"; };
+		struct _Params : public TrajectoryDistanceMeasureBase::_Params
+		{
+			DtwBandType Band;
+			HashColon::Real BandRatio;	  // Sakoe-Chiba half width, ratio to the longer trajectory length
+			HashColon::Real ItakuraSlope; // max slope of Itakura parallelogram, > 1
+		};
 
 	protected:
+		static inline _Params _cDefault;
+		const _Params _c;
+
+		// returns infinity as soon as the result is known to exceed upperBound.
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
+
+		// forward and reversed tables in one pass, sharing distance rows
+		HashColon::Real MeasureBothDirections_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			HashColon::Real upperBound) const override final;
+
+	public:
+		using Ptr = std::shared_ptr<DynamicTimeWarping>;
+
+		static void Initialize(const std::string configFilePath = "");
+
+		DynamicTimeWarping() : TrajectoryDistanceMeasureBase(
+								   HashColon::Clustering::DistanceMeasureType::distance),
+							   _c({TrajectoryDistanceMeasureBase::_cDefault, _cDefault.Band, _cDefault.BandRatio, _cDefault.ItakuraSlope}){};
+
+		DynamicTimeWarping(_Params params)
+			: TrajectoryDistanceMeasureBase(
+				  HashColon::Clustering::DistanceMeasureType::distance, params),
+			  _c(params){};
+
+		_Params GetParams() const { return _c; };
+		const std::string GetMethodName() const override final { return "DynamicTimeWarping"; };
+
+		// Allowed column range [first, second] of each row of the warping table of n x m.
+		// Ranges are repaired to stay connected so that the end cell is always reachable.
+		std::vector<std::pair<size_t, size_t>> GetBand(size_t n, size_t m) const;
+		void GetBand(size_t n, size_t m, std::vector<std::pair<size_t, size_t>> &oBand) const;
 	};
 
 	/*
@@ -261,7 +522,86 @@ namespace HashColon::Feline::TrajectoryClustering
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYList &a,
-			const HashColon::Feline::XYList &b) const override final;
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
+	};
+
+	/*
+	 * Trajectory EMD
+	 * Earth-Mover's distance between trajectories as weighted point clouds(metre).
+	 * Order of waypoints is ignored, therefore the measure compares routes regardless of direction and sampling.
+	 * Waypoints are weighted uniformly(dwell time, for trajectories sampled at a constant time interval)
+	 * or by segment length(half of each adjacent segment), then merged along the trajectory
+	 * into at most MaxParticleNumber particles of equal weight, which bounds the cost of each pair.
+	 * Particles of a trajectory are built in its own LocalProjection, and each pair is compared
+	 * in the LocalProjection around the middle of their centroids, so that the value of a pair
+	 * does not depend on the other trajectories(Measure, MeasureBatch and MeasureMatrix agree).
+	 * MeasureMatrix prepares the particles of each trajectory once.
+	 */
+	class TrajectoryEMD : public TrajectoryDistanceMeasureBase
+	{
+	public:
+		enum ParticleWeightType
+		{
+			ParticleWeight_Uniform,
+			ParticleWeight_SegmentLength
+		};
+
+		struct _Params : public TrajectoryDistanceMeasureBase::_Params
+		{
+			ParticleWeightType ParticleWeight;
+			size_t MaxParticleNumber; // 0: no downsampling
+		};
+
+		// particles of a trajectory. Weight sums up to 1.
+		struct ParticleSet
+		{
+			Eigen::MatrixX2R Pos;
+			Eigen::VectorXR Weight;
+		};
+
+	protected:
+		static inline _Params _cDefault;
+		const _Params _c;
+
+	public:
+		static void Initialize(const std::string configFilePath = "");
+
+		// EMD is sequence-invariant, therefore turns off reverse option
+		TrajectoryEMD()
+			: TrajectoryDistanceMeasureBase(
+				  HashColon::Clustering::DistanceMeasureType::distance,
+				  {false, TrajectoryDistanceMeasureBase::_cDefault.InnerParallelThreshold, false}),
+			  _c({{false, TrajectoryDistanceMeasureBase::_cDefault.InnerParallelThreshold, false},
+				  _cDefault.ParticleWeight, _cDefault.MaxParticleNumber}){};
+
+		TrajectoryEMD(_Params params)
+			: TrajectoryDistanceMeasureBase(
+				  HashColon::Clustering::DistanceMeasureType::distance,
+				  {false, params.InnerParallelThreshold, false}),
+			  _c({{false, params.InnerParallelThreshold, false}, params.ParticleWeight, params.MaxParticleNumber}){};
+
+		_Params GetParams() const { return _c; };
+		const std::string GetMethodName() const override final { return "TrajectoryEMD"; };
+
+		ParticleSet GetParticles(const HashColon::Feline::XYList &traj, const LocalProjection &proj) const;
+
+		// particles in longitude/latitude, built in the LocalProjection of traj itself
+		ParticleSet GetGeoParticles(const HashColon::Feline::XYList &traj) const;
+
+		// all-pairs EMD(OpenMP dynamic scheduling over rows) with the particles of each trajectory built once
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
+	protected:
+		// EMD can not be abandoned early, therefore upperBound is not used.
+		HashColon::Real Measure_core(
+			const HashColon::Feline::XYList &a,
+			const HashColon::Feline::XYList &b,
+			bool reversed,
+			HashColon::Real upperBound) const override final;
 	};
 
 	void Initialize_All_TrajectoryDistanceMeasure();
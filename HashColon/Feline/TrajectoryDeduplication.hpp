@@ -0,0 +1,96 @@
+#ifndef HASHCOLON_FELINE_TRAJECTORYDEDUPLICATION
+#define HASHCOLON_FELINE_TRAJECTORYDEDUPLICATION
+
+// std libraries
+#include <memory>
+#include <string>
+#include <vector>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/GeoValues.hpp>
+
+namespace HashColon::Feline
+{
+	/*
+	 * Result of trajectory deduplication.
+	 * Representatives: indices(to the input list) of representative trajectories.
+	 * Weights[r]: number of input trajectories represented by Representatives[r], including itself.
+	 * MemberOf[i]: index(to Representatives) of the representative of i-th input trajectory.
+	 */
+	struct DeduplicationResult
+	{
+		std::vector<size_t> Representatives;
+		std::vector<size_t> Weights;
+		std::vector<size_t> MemberOf;
+	};
+
+	/*
+	 * TrajectoryDeduplication
+	 * Collapses near-duplicate trajectories(repeated voyages of ferries, liners, etc.) before clustering.
+	 * Each trajectory is resampled into ResampleNumber points and quantised into GridSize(metre) cells
+	 * in a local equirectangular projection. In input order, each trajectory is verified by the measure function
+	 * against representatives whose resampled points fall into the same or adjacent cells,
+	 * and collapsed into the first one within DuplicateEpsilon. Otherwise it becomes a representative.
+	 * Only representatives are clustered(with weights), then labels are expanded to all members.
+	 *
+	 * Pairs whose resampled points are less than GridSize apart(in each axis) are always verified,
+	 * even across cell boundaries. Near-duplicates farther than that are kept as separate representatives,
+	 * which costs compression but never correctness.
+	 *
+	 * DuplicateEpsilon should be below the epsilon of the clustering(e.g. DbscanEpsilon of DistanceBasedDBSCAN),
+	 * above it for similarity measures. Members are collapsed at D <= DuplicateEpsilon,
+	 * while DBSCAN neighbors need D < DbscanEpsilon: a member at exactly DbscanEpsilon
+	 * would be counted as a neighbor of its representative by the weights, but not by DBSCAN on the full data.
+	 * TrajectoryType should be convertible to XYList.
+	 */
+	template <typename TrajectoryType>
+	class TrajectoryDeduplication
+	{
+	public:
+		struct _Params
+		{
+			size_t ResampleNumber;
+			HashColon::Real GridSize;
+			HashColon::Real DuplicateEpsilon; // below DbscanEpsilon of the clustering, see above
+		};
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(TrajectoryDeduplication);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+		typename HashColon::Clustering::DistanceMeasureBase<TrajectoryType>::Ptr _measure;
+
+	public:
+		using Ptr = std::shared_ptr<TrajectoryDeduplication<TrajectoryType>>;
+
+		TrajectoryDeduplication(
+			typename HashColon::Clustering::DistanceMeasureBase<TrajectoryType>::Ptr measure,
+			_Params params = _cDefault);
+
+		static void Initialize(
+			const std::string identifierPostfix = "",
+			const std::string configFilePath = "",
+			const std::string configNamespace = "Feline.TrajectoryDeduplication");
+
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		// groups near-duplicate trajectories
+		DeduplicationResult Run(const std::vector<TrajectoryType> &trajlist) const;
+
+		// list of representative trajectories, in the order of result.Representatives
+		static std::vector<TrajectoryType> GetRepresentatives(
+			const std::vector<TrajectoryType> &trajlist, const DeduplicationResult &result);
+
+		// expands labels of representatives to every input trajectory
+		static std::vector<size_t> ExpandLabels(
+			const DeduplicationResult &result, const std::vector<size_t> &representativeLabels);
+	};
+}
+
+#endif
+
+#include <HashColon/Feline/impl/TrajectoryDeduplication_Impl.hpp>
@@ -0,0 +1,160 @@
+#ifndef HASHCOLON_FELINE_TRAJECTORYEMBEDDING
+#define HASHCOLON_FELINE_TRAJECTORYEMBEDDING
+
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Exception.hpp>
+#include <HashColon/HNSW.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * TrajectoryEmbedding
+	 * Fixed-length feature vector of a trajectory, so that Euclidean distance of vectors approximates trajectory distance.
+	 * [coordinates | heading histogram | XTD summary]
+	 * - coordinates: SampleNumber points sampled in uniform length, in a LocalProjection divided by the coordinate scale.
+	 *   Scaled by CoordinateWeight / sqrt(SampleNumber): vector distance is CoordinateWeight x RMS point distance / scale.
+	 * - heading histogram: length-weighted histogram of segment headings in HeadingBins circular bins, sums to HeadingWeight.
+	 * - XTD summary(XYXtdList only): mean and max of portside and starboard XTD divided by the scale, times XtdWeight.
+	 * Fit sets the projection and the scale from data. Embeddings are direction-sensitive.
+	 */
+	class TrajectoryEmbedding
+	{
+	public:
+		struct _Params
+		{
+			size_t SampleNumber;
+			size_t HeadingBins;
+			HashColon::Real CoordinateWeight;
+			HashColon::Real HeadingWeight;
+			HashColon::Real XtdWeight;
+		};
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(TrajectoryEmbedding);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+		LocalProjection _proj;
+		HashColon::Real _scale = 1; // metre
+
+		void EmbedShape(const HashColon::Feline::XYList &traj, Eigen::Ref<Eigen::VectorXR> oVec) const;
+
+	public:
+		TrajectoryEmbedding(_Params params = _cDefault);
+
+		static void Initialize(const std::string configFilePath = "");
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		// projection centered at the mean position, and RMS distance of points from the center as the scale
+		void Fit(const std::vector<HashColon::Feline::XYList> &trajlist);
+		void Fit(const std::vector<HashColon::Feline::XYXtdList> &trajlist);
+		void SetFrame(const HashColon::Feline::XY &base, HashColon::Real scale);
+		const LocalProjection &GetProjection() const { return _proj; };
+		HashColon::Real GetScale() const { return _scale; };
+
+		size_t GetDimension(bool withXtd = false) const { return 2 * _c.SampleNumber + _c.HeadingBins + (withXtd ? 4 : 0); };
+
+		Eigen::VectorXR Embed(const HashColon::Feline::XYList &traj) const;
+		Eigen::VectorXR Embed(const HashColon::Feline::XYXtdList &traj) const;
+		// embeddings of trajectories as rows. parallel.
+		Eigen::MatrixXR Embed(const std::vector<HashColon::Feline::XYList> &trajlist) const;
+		Eigen::MatrixXR Embed(const std::vector<HashColon::Feline::XYXtdList> &trajlist) const;
+	};
+
+	/*
+	 * TrajectoryEmbeddingIndex
+	 * HNSW index over TrajectoryEmbedding vectors for approximate similar trajectory search.
+	 * Candidates from the index can be re-ranked with an exact DistanceMeasureBase.
+	 * Built from XYXtdList, the index expects XYXtdList queries(embedding with XTD summary).
+	 */
+	class TrajectoryEmbeddingIndex
+	{
+	public:
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(TrajectoryEmbeddingIndex);
+
+	protected:
+		TrajectoryEmbedding _embedding;
+		std::shared_ptr<HashColon::HNSW> _index;
+		bool _withXtd = false;
+
+	public:
+		using Ptr = std::shared_ptr<TrajectoryEmbeddingIndex>;
+
+		TrajectoryEmbeddingIndex(
+			TrajectoryEmbedding::_Params embeddingParams = TrajectoryEmbedding::GetDefaultParams(),
+			HashColon::HNSW::_Params indexParams = HashColon::HNSW::GetDefaultParams());
+
+		const TrajectoryEmbedding &GetEmbedding() const { return _embedding; };
+		HashColon::HNSW &GetIndex() { return *_index; };
+		size_t size() const { return _index->size(); };
+
+		// fits the embedding to trajlist and indexes their embeddings in the given order
+		void BuildIndex(const std::vector<HashColon::Feline::XYList> &trajlist);
+		void BuildIndex(const std::vector<HashColon::Feline::XYXtdList> &trajlist);
+
+		// approximately k nearest indexed trajectories in the embedding space, closest first
+		HashColon::HNSW::ResultList GetCandidates(const HashColon::Feline::XYList &query, size_t k) const;
+		HashColon::HNSW::ResultList GetCandidates(const HashColon::Feline::XYXtdList &query, size_t k) const;
+
+		// k nearest among candidateNumber candidates of the index, re-ranked by measure. closest first.
+		// queryShape is embedded for the index, query is given to the measure.
+		// data should be in the same order as the trajectories given to BuildIndex.
+		template <typename ShapeType, typename DataType>
+		std::vector<size_t> GetKNearest(
+			const ShapeType &queryShape, const DataType &query,
+			const std::vector<DataType> &data,
+			const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+			size_t k, size_t candidateNumber) const;
+
+		// embedding frame and the HNSW graph in one binary file
+		void Save(const std::string filepath) const;
+		void Load(const std::string filepath);
+	};
+
+	template <typename ShapeType, typename DataType>
+	std::vector<size_t> TrajectoryEmbeddingIndex::GetKNearest(
+		const ShapeType &queryShape, const DataType &query,
+		const std::vector<DataType> &data,
+		const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+		size_t k, size_t candidateNumber) const
+	{
+		assert(data.size() == size());
+		const bool isDistance = measure->GetMeasureType() == HashColon::Clustering::DistanceMeasureType::distance;
+
+		const HashColon::HNSW::ResultList cand = GetCandidates(queryShape, std::max(k, candidateNumber));
+		std::vector<const DataType *> targets(cand.size());
+		for (size_t c = 0; c < cand.size(); c++)
+			targets[c] = &data[cand[c].first];
+
+		std::vector<HashColon::Real> d;
+		measure->MeasureBatch(query, targets, d);
+
+		std::vector<size_t> order(cand.size());
+		std::iota(order.begin(), order.end(), 0);
+		k = std::min(k, cand.size());
+		std::partial_sort(order.begin(), order.begin() + k, order.end(),
+						  [&d, isDistance](size_t l, size_t r)
+						  { return isDistance ? d[l] < d[r] : d[l] > d[r]; });
+
+		std::vector<size_t> re(k);
+		for (size_t i = 0; i < k; i++)
+			re[i] = cand[order[i]].first;
+		return re;
+	}
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef HASHCOLON_FELINE_TRAJECTORYLSH
+#define HASHCOLON_FELINE_TRAJECTORYLSH
+
+// std libraries
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * TrajectoryLSH
+	 * Locality-sensitive hashing for trajectory similarity search without all-pairs computation.
+	 * Each trajectory becomes a set of geohash cells it passes through(or a set of cell transitions),
+	 * and MinHash signatures of the sets are banded into hash tables.
+	 * Trajectories sharing any band bucket are candidates, and only candidates are given to the exact measure.
+	 * Probability of two trajectories with Jaccard similarity s to be candidates is 1 - (1 - s^RowsPerBand)^NumOfBands.
+	 * Cell transitions are direction-sensitive: reversed voyages do not share transition tokens.
+	 */
+	class TrajectoryLSH
+	{
+	public:
+		struct _Params
+		{
+			size_t GeohashPrecision;
+			bool Enable_CellTransitions;
+			size_t NumOfBands;
+			size_t RowsPerBand;
+			unsigned int Seed;
+		};
+
+		using Signature = std::vector<std::uint64_t>;
+		using PairList = std::vector<std::pair<size_t, size_t>>;
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(TrajectoryLSH);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+		std::vector<std::uint64_t> _hashSeeds;
+		std::vector<Signature> _signatures;
+		std::vector<std::unordered_map<std::uint64_t, std::vector<size_t>>> _bandTables;
+
+		std::uint64_t GetBandKey(const Signature &sig, size_t band) const;
+
+	public:
+		using Ptr = std::shared_ptr<TrajectoryLSH>;
+
+		TrajectoryLSH(_Params params = _cDefault);
+
+		static void Initialize(const std::string configFilePath = "");
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		// geohash of a position as an integer of (5 * precision) bits. precision should be in [1, 12].
+		static std::uint64_t GeohashEncode(const HashColon::Feline::XY &pos, size_t precision);
+		static std::string GeohashToString(std::uint64_t code, size_t precision);
+
+		// set of geohash cells(or cell transitions) the trajectory passes through
+		std::vector<std::uint64_t> GetTokens(const HashColon::Feline::XYList &traj) const;
+		Signature GetSignature(const HashColon::Feline::XYList &traj) const;
+		static HashColon::Real EstimateJaccard(const Signature &a, const Signature &b);
+
+		// computes signatures and band tables of given trajectories
+		void BuildIndex(const std::vector<HashColon::Feline::XYList> &trajlist);
+		size_t size() const { return _signatures.size(); };
+		const std::vector<Signature> &GetSignatures() const { return _signatures; };
+
+		// candidate pairs (i, j), i < j, among indexed trajectories. sorted and unique.
+		// throws if more than 2^32 - 1 trajectories are indexed.
+		PairList GetCandidatePairs() const;
+
+		// candidate indices for a query trajectory. sorted and unique.
+		std::vector<size_t> GetCandidates(const HashColon::Feline::XYList &query) const;
+
+		// Epsilon-neighbor lists from candidate pairs, usable by DistanceBasedDBSCAN::TrainModel_withNeighbors.
+		// Neighbors satisfy D < epsilon for distance measures, S > epsilon for similarity measures.
+		template <typename DataType>
+		static std::vector<std::vector<size_t>> GetRangeNeighbors(
+			const std::vector<DataType> &data,
+			const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+			const PairList &pairs, HashColon::Real epsilon);
+
+		// k nearest indexed items of query among LSH candidates, closest first.
+		// data should be in the same order as the trajectories given to BuildIndex.
+		template <typename DataType>
+		std::vector<size_t> GetKNearest(
+			const HashColon::Feline::XYList &queryShape, const DataType &query,
+			const std::vector<DataType> &data,
+			const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+			size_t k) const;
+	};
+
+	template <typename DataType>
+	std::vector<std::vector<size_t>> TrajectoryLSH::GetRangeNeighbors(
+		const std::vector<DataType> &data,
+		const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+		const PairList &pairs, HashColon::Real epsilon)
+	{
+		const bool isDistance = measure->GetMeasureType() == HashColon::Clustering::DistanceMeasureType::distance;
+
+		// pairs sharing the first item are measured in one batch
+		std::vector<size_t> groupBegin;
+		for (size_t p = 0; p < pairs.size(); p++)
+			if (p == 0 || pairs[p].first != pairs[p - 1].first)
+				groupBegin.push_back(p);
+		const size_t groupCnt = groupBegin.size();
+		groupBegin.push_back(pairs.size());
+
+		std::vector<char> isNeighbor(pairs.size(), 0);
+#pragma omp parallel for schedule(dynamic)
+		for (size_t g = 0; g < groupCnt; g++)
+		{
+			std::vector<const DataType *> targets;
+			for (size_t p = groupBegin[g]; p < groupBegin[g + 1]; p++)
+				targets.push_back(&data[pairs[p].second]);
+
+			std::vector<HashColon::Real> d;
+			measure->MeasureBatch(data[pairs[groupBegin[g]].first], targets, d);
+			for (size_t p = groupBegin[g]; p < groupBegin[g + 1]; p++)
+			{
+				const HashColon::Real &dp = d[p - groupBegin[g]];
+				isNeighbor[p] = isDistance ? (dp < epsilon) : (dp > epsilon);
+			}
+		}
+
+		std::vector<std::vector<size_t>> re(data.size());
+		for (size_t p = 0; p < pairs.size(); p++)
+		{
+			if (isNeighbor[p])
+			{
+				re[pairs[p].first].push_back(pairs[p].second);
+				re[pairs[p].second].push_back(pairs[p].first);
+			}
+		}
+		for (auto &r : re)
+			std::sort(r.begin(), r.end());
+		return re;
+	}
+
+	template <typename DataType>
+	std::vector<size_t> TrajectoryLSH::GetKNearest(
+		const HashColon::Feline::XYList &queryShape, const DataType &query,
+		const std::vector<DataType> &data,
+		const typename HashColon::Clustering::DistanceMeasureBase<DataType>::Ptr measure,
+		size_t k) const
+	{
+		assert(data.size() == size());
+		const bool isDistance = measure->GetMeasureType() == HashColon::Clustering::DistanceMeasureType::distance;
+
+		std::vector<size_t> cand = GetCandidates(queryShape);
+
+		// candidates are measured in batches of chunk size
+		const size_t chunk = 64;
+		std::vector<HashColon::Real> d(cand.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t c0 = 0; c0 < cand.size(); c0 += chunk)
+		{
+			const size_t c1 = std::min(c0 + chunk, cand.size());
+			std::vector<const DataType *> targets;
+			for (size_t c = c0; c < c1; c++)
+				targets.push_back(&data[cand[c]]);
+
+			std::vector<HashColon::Real> part;
+			measure->MeasureBatch(query, targets, part);
+			std::copy(part.begin(), part.end(), d.begin() + c0);
+		}
+
+		std::vector<size_t> order(cand.size());
+		std::iota(order.begin(), order.end(), 0);
+		k = std::min(k, cand.size());
+		std::partial_sort(order.begin(), order.begin() + k, order.end(),
+						  [&d, isDistance](size_t l, size_t r)
+						  { return isDistance ? d[l] < d[r] : d[l] > d[r]; });
+
+		std::vector<size_t> re(k);
+		for (size_t i = 0; i < k; i++)
+			re[i] = cand[order[i]];
+		return re;
+	}
+}
+
+#endif
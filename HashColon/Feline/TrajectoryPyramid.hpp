@@ -0,0 +1,87 @@
+#ifndef HASHCOLON_FELINE_TRAJECTORYPYRAMID
+#define HASHCOLON_FELINE_TRAJECTORYPYRAMID
+
+// std libraries
+#include <memory>
+#include <string>
+#include <vector>
+// HashColon libraries
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	/*
+	 * TrajectoryPyramid
+	 * Multi-resolution representation of a trajectory.
+	 * Levels[0] is the original trajectory. Each following level is a Douglas-Peucker simplification
+	 * of the original with doubled tolerance, therefore every level is a subsequence of the original.
+	 * Errors[l] is the discrete Frechet distance between Levels[0] and Levels[l]
+	 * computed over the optimal coupling that matches each removed point to one of its neighboring kept points.
+	 */
+	struct TrajectoryPyramid
+	{
+		std::vector<HashColon::Feline::XYList> Levels;
+		std::vector<HashColon::Real> Errors;
+
+		size_t size() const { return Levels.size(); };
+		const HashColon::Feline::XYList &Original() const { return Levels.front(); };
+	};
+
+	/*
+	 * CoarseToFineMeasure
+	 * Evaluates a trajectory measure on coarse pyramid levels first,
+	 * and refines to finer levels only if the resulting interval cannot decide the query.
+	 * Interval width is given by TrajectoryDistanceMeasureBase::CoarseErrorBound.
+	 * For measures without a bound, every query falls back to the exact full-resolution value.
+	 */
+	class CoarseToFineMeasure
+	{
+	public:
+		struct _Params
+		{
+			size_t PyramidLevels;			// number of levels including the original
+			HashColon::Real BaseTolerance; // Douglas-Peucker tolerance(metre) of level 1
+		};
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(CoarseToFineMeasure);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+		TrajectoryDistanceMeasureBase::Ptr _measure;
+
+	public:
+		using Ptr = std::shared_ptr<CoarseToFineMeasure>;
+
+		CoarseToFineMeasure(TrajectoryDistanceMeasureBase::Ptr measure, _Params params = _cDefault);
+
+		static void Initialize(const std::string configFilePath = "");
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+
+		TrajectoryPyramid BuildPyramid(const HashColon::Feline::XYList &traj) const;
+		std::vector<TrajectoryPyramid> BuildPyramids(const std::vector<HashColon::Feline::XYList> &trajlist) const;
+
+		// Interval containing the exact distance, computed at given level.
+		// level is clamped for each pyramid. At level 0, minVal == repVal == maxVal.
+		HashColon::ValueInterval<HashColon::Real> MeasureInterval(
+			const TrajectoryPyramid &a, const TrajectoryPyramid &b, size_t level) const;
+
+		// Returns D(a, b) < threshold, refining levels only as needed.
+		bool IsWithin(const TrajectoryPyramid &a, const TrajectoryPyramid &b, HashColon::Real threshold) const;
+
+		// Epsilon-neighbor lists usable by DistanceBasedDBSCAN::TrainModel_withNeighbors.
+		// re[i] holds every j != i with D(i, j) < epsilon.
+		std::vector<std::vector<size_t>> GetRangeNeighbors(
+			const std::vector<TrajectoryPyramid> &pyramids, HashColon::Real epsilon) const;
+
+		// Indices of k nearest items from query, sorted by ascending distance.
+		std::vector<size_t> GetKNearest(
+			const TrajectoryPyramid &query, const std::vector<TrajectoryPyramid> &pyramids, size_t k) const;
+	};
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define HASHCOLON_FELINE_XTDTRAJECTORYCLUSTERING
 
 // std libraries
+#include <array>
+#include <limits>
 #include <memory>
 #include <vector>
 #include <Eigen/Eigen>
@@ -13,6 +15,97 @@
 // XTD distance btwn waypoints
 namespace HashColon::Feline::XtdTrajectoryClustering
 {
+	namespace _hidden
+	{
+		struct BlendedWaypoints;
+	}
+
+	/*
+	 * XtdParticleCloud
+	 * Grid samples of the bivariate normal distribution of a waypoint spread by its XTD.
+	 * Sigma is xtd / domainSize in portside/starboard direction and their average in heading direction.
+	 * Building a cloud costs a geodesic move per sample, therefore clouds are built once per waypoint
+	 * and reused for every pair by JSDivergenceDistance and WassersteinDistance.
+	 * Local keeps the same samples as metric offsets from the waypoint, which WassersteinDistance
+	 * uses as its ground distance without geodesic calls.
+	 */
+	struct XtdParticleCloud
+	{
+		HashColon::Feline::XYXtd Point;
+		HashColon::Degree Direction;
+		HashColon::Real DomainSize;						 // size of the domain box in unit of sigma
+		std::vector<std::array<HashColon::Real, 2>> Pos; // [lon, lat] of samples
+		std::vector<HashColon::Real> ProbValue;			 // normalized so that the sum is one
+		HashColon::Real PdfTotal;						 // sum of pdf values before normalization
+		Eigen::Matrix<HashColon::Real, Eigen::Dynamic, 2> Local; // [east, north] offsets of samples from Point in metres
+
+		static XtdParticleCloud Build(
+			HashColon::Feline::XYXtd point, HashColon::Degree direction,
+			HashColon::Real stepSize, HashColon::Real domainSize);
+
+		// clouds of every waypoint.
+		// direction of a waypoint is toward the next waypoint, and from the previous one for the last waypoint.
+		static std::vector<XtdParticleCloud> Build(
+			const HashColon::Feline::XYXtdList &traj,
+			HashColon::Real stepSize, HashColon::Real domainSize);
+	};
+
+	/*
+	 * XtdGaussian
+	 * Moment-matched bivariate normal of the XTD distribution of a waypoint, the continuous counterpart of XtdParticleCloud.
+	 * Along starboard the distribution is two half normals of equal mass(sigmaP on portside, sigmaS on starboard).
+	 * Therefore its mean is shifted by (sigmaS - sigmaP) / sqrt(2 pi) and its variance is (sigmaP^2 + sigmaS^2) / 2 - shift^2.
+	 * Distances between XtdGaussians are closed forms of O(1), without particles.
+	 */
+	struct XtdGaussian
+	{
+		HashColon::Feline::XYXtd Point;
+		Eigen::Vector2R Mean; // [east, north] offset of the mean from Point in metres
+		Eigen::Matrix2R Cov;  // covariance in [east, north] metres^2
+
+		static XtdGaussian Build(
+			HashColon::Feline::XYXtd point, HashColon::Degree direction, HashColon::Real domainSize);
+
+		// gaussians of every waypoint. directions are the same as XtdParticleCloud::Build.
+		static std::vector<XtdGaussian> Build(
+			const HashColon::Feline::XYXtdList &traj, HashColon::Real domainSize);
+	};
+
+	// 2-Wasserstein(Bures) distance in metres. Upper bound of the 1-Wasserstein distance of WassersteinDistance.
+	HashColon::Real GaussianWassersteinDistance(const XtdGaussian &a, const XtdGaussian &b);
+
+	// JS divergence approximated by a moment-matched normal for the mixture (a + b) / 2. clamped to [0, ln 2].
+	HashColon::Real GaussianJSDivergenceDistance(const XtdGaussian &a, const XtdGaussian &b);
+
+	// Hellinger distance in [0, 1], exact for normals.
+	HashColon::Real GaussianHellingerDistance(const XtdGaussian &a, const XtdGaussian &b);
+
+	/*
+	 * Accuracy and speed of the analytic Gaussian distances against the sampled ones,
+	 * on waypoint pairs of neighbouring trajectories(i-th waypoints of trajlist[t] and trajlist[t + 1]).
+	 * Times include building clouds/gaussians once per waypoint, as the measures do. Single threaded.
+	 */
+	struct _AnalyticGaussianBenchmark
+	{
+		size_t PairCount;
+		HashColon::Real SampledSeconds_JS;
+		HashColon::Real AnalyticSeconds_JS;
+		HashColon::Real SampledSeconds_WS;
+		HashColon::Real AnalyticSeconds_WS;
+		HashColon::Real MeanAbsError_JS;
+		HashColon::Real MeanRelError_JS;
+		HashColon::Real MeanAbsError_WS;
+		HashColon::Real MeanRelError_WS;
+
+		HashColon::Real Speedup_JS() const { return SampledSeconds_JS / AnalyticSeconds_JS; };
+		HashColon::Real Speedup_WS() const { return SampledSeconds_WS / AnalyticSeconds_WS; };
+	};
+
+	_AnalyticGaussianBenchmark BenchmarkAnalyticGaussian(
+		const std::vector<HashColon::Feline::XYXtdList> &trajlist,
+		size_t maxPairCount = 10000,
+		HashColon::Real domainUnit = 1.0, HashColon::Real domainSize = 3.0);
+
 	/* JS-divergence distance */
 	struct _JSDivergenceOption
 	{
@@ -30,6 +123,11 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 		HashColon::Feline::XYXtd b, HashColon::Degree bDir,
 		_JSDivergenceOption options = _cDefault_JSDivergence);
 
+	// clouds should be built with options.domainUnit, options.domainSize
+	HashColon::Real JSDivergenceDistance(
+		const XtdParticleCloud &a, const XtdParticleCloud &b,
+		_JSDivergenceOption options = _cDefault_JSDivergence);
+
 	/* Wasserstein distance */
 	struct _WassersteinOption
 	{
@@ -46,6 +144,36 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 		HashColon::Feline::XYXtd b, HashColon::Degree bDir,
 		_WassersteinOption options = _cDefault_Wasserstein);
 
+	// warmStart: starts from the optimal basis of the previous call of the thread(see emd::NetworkSimplex::compute_warm).
+	// pays off when consecutive calls are close problems, e.g. cells of a DTW table along a row.
+	HashColon::Real WassersteinDistance(const XtdParticleCloud &a, const XtdParticleCloud &b, bool warmStart = false);
+
+	/*
+	 * Sinkhorn distance: entropic approximation of WassersteinDistance.
+	 * Regularization epsilon is relative to the mean ground distance of the pair, so that it does not depend on XTD scale.
+	 * Returns the transport cost <P, C> of the entropic plan, which is above the exact distance by O(epsilon).
+	 * Scaling vectors are absorbed into log-domain potentials when they grow, which keeps small epsilon stable.
+	 */
+	struct _SinkhornOption
+	{
+		HashColon::Real regularization; // epsilon / mean ground distance
+		size_t maxIteration;
+		HashColon::Real tolerance; // L1 error of the row marginal
+	};
+
+	const _SinkhornOption _cDefault_Sinkhorn = {
+		0.05, 100, 1e-2};
+
+	HashColon::Real SinkhornDistance(
+		const XtdParticleCloud &a, const XtdParticleCloud &b,
+		_SinkhornOption options = _cDefault_Sinkhorn);
+
+	// batched solves of pairs (a[k], b[k]), in parallel with a reused workspace per thread
+	void SinkhornDistance(
+		const std::vector<const XtdParticleCloud *> &a, const std::vector<const XtdParticleCloud *> &b,
+		std::vector<HashColon::Real> &oResults,
+		_SinkhornOption options = _cDefault_Sinkhorn);
+
 	/* PF distance */
 	struct _PFDistanceOption
 	{
@@ -79,6 +207,7 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 		struct _Params
 		{
 			bool Enable_ReversedSequence;
+			bool Enable_PreparedKernel; // DtwXtd only. see DtwXtd::MeasureMatrix
 		};
 
 	protected:
@@ -92,12 +221,21 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		HashColon::Real Measure(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const override;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound = std::numeric_limits<HashColon::Real>::infinity()) const override;
+
+		// reversed query is built once for all targets
+		void MeasureBatch(
+			const HashColon::Feline::XYXtdList &query,
+			const std::vector<const HashColon::Feline::XYXtdList *> &targets,
+			std::vector<HashColon::Real> &oResults) const override;
 
 	protected:
+		// upperBound as Measure. returns infinity when abandoned.
 		virtual HashColon::Real Measure_core(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const = 0;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound) const = 0;
 
 		XtdTrajectoryDistanceMeasureBase(
 			HashColon::Clustering::DistanceMeasureType type, _Params params = _cDefault)
@@ -109,14 +247,21 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 	{
 	public:
 		DtwXtd(_Params params = _cDefault) : XtdTrajectoryDistanceMeasureBase(
-												 HashColon::Clustering::DistanceMeasureType::distance){};
+												 HashColon::Clustering::DistanceMeasureType::distance, params){};
 
 		const std::string GetMethodName() const override final { return "DtwXtd"; };
 
+		// available only for Enable_PreparedKernel: float kernel on waypoint positions prepared once
+		// in a LocalProjection of the whole data(see PreparedXtdTrajectoryMeasure). approximate as the projection is.
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYXtdList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
 		HashColon::Real Measure_core(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const override final;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -130,6 +275,8 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			HashColon::Real MonteCarloDomainUnit;
 			HashColon::Real MonteCarloDomainSize;
 			HashColon::Real MonteCarloErrorEpsilon;
+			bool Enable_AnalyticGaussian; // closed form on XtdGaussian instead of particle clouds
+			bool Enable_Hellinger;		  // analytic mode only: Hellinger distance instead of moment-matched JS
 		};
 
 	protected:
@@ -145,7 +292,9 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			  _c({XtdTrajectoryDistanceMeasureBase::_cDefault,
 				  _cDefault.MonteCarloDomainUnit,
 				  _cDefault.MonteCarloDomainSize,
-				  _cDefault.MonteCarloErrorEpsilon}){};
+				  _cDefault.MonteCarloErrorEpsilon,
+				  _cDefault.Enable_AnalyticGaussian,
+				  _cDefault.Enable_Hellinger}){};
 
 		DtwXtd_usingJSDivergence(_Params params)
 			: XtdTrajectoryDistanceMeasureBase(
@@ -154,10 +303,28 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		const std::string GetMethodName() const override final { return "DtwXtd_JS"; };
 
+		// cost of a DTW cell: distance between particle clouds of two waypoints
+		HashColon::Real CloudDistance(const XtdParticleCloud &a, const XtdParticleCloud &b) const;
+
+		// cost of a DTW cell in analytic mode
+		HashColon::Real GaussianDistance(const XtdGaussian &a, const XtdGaussian &b) const;
+
+		// particle clouds(gaussians in analytic mode) of the query are built once for all targets
+		void MeasureBatch(
+			const HashColon::Feline::XYXtdList &query,
+			const std::vector<const HashColon::Feline::XYXtdList *> &targets,
+			std::vector<HashColon::Real> &oResults) const override final;
+
+		// particle clouds(gaussians in analytic mode) of every trajectory are built once for all pairs(kept in memory during computation)
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYXtdList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
 		virtual HashColon::Real Measure_core(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const override final;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -171,6 +338,10 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			HashColon::Real MonteCarloDomainUnit;
 			HashColon::Real MonteCarloDomainSize;
 			HashColon::Real MonteCarloErrorEpsilon;
+			bool Enable_AnalyticGaussian; // 2-Wasserstein on XtdGaussian instead of EMD on particle clouds
+			bool Enable_Sinkhorn;		  // Sinkhorn distance instead of EMD on particle clouds. ignored in analytic mode
+			HashColon::Real SinkhornRegularization;
+			bool Enable_WarmStart; // EMD of a DTW cell starts from the solution of the previous cell
 		};
 
 	protected:
@@ -186,7 +357,11 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			  _c({XtdTrajectoryDistanceMeasureBase::_cDefault,
 				  _cDefault.MonteCarloDomainUnit,
 				  _cDefault.MonteCarloDomainSize,
-				  _cDefault.MonteCarloErrorEpsilon}){};
+				  _cDefault.MonteCarloErrorEpsilon,
+				  _cDefault.Enable_AnalyticGaussian,
+				  _cDefault.Enable_Sinkhorn,
+				  _cDefault.SinkhornRegularization,
+				  _cDefault.Enable_WarmStart}){};
 
 		DtwXtd_usingWasserstein(_Params params)
 			: XtdTrajectoryDistanceMeasureBase(
@@ -195,10 +370,28 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		const std::string GetMethodName() const override final { return "DtwXtd_EMD"; };
 
+		// cost of a DTW cell: distance between particle clouds of two waypoints
+		HashColon::Real CloudDistance(const XtdParticleCloud &a, const XtdParticleCloud &b) const;
+
+		// cost of a DTW cell in analytic mode
+		HashColon::Real GaussianDistance(const XtdGaussian &a, const XtdGaussian &b) const;
+
+		// particle clouds(gaussians in analytic mode) of the query are built once for all targets
+		void MeasureBatch(
+			const HashColon::Feline::XYXtdList &query,
+			const std::vector<const HashColon::Feline::XYXtdList *> &targets,
+			std::vector<HashColon::Real> &oResults) const override final;
+
+		// particle clouds(gaussians in analytic mode) of every trajectory are built once for all pairs(kept in memory during computation)
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYXtdList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
 		virtual HashColon::Real Measure_core(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const override final;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound) const override final;
 	};
 
 	/*
@@ -243,10 +436,31 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		const std::string GetMethodName() const override final { return "DtwXtd_Blend"; };
 
+		// waypoint directions and clouds of the query are built once for all targets
+		void MeasureBatch(
+			const HashColon::Feline::XYXtdList &query,
+			const std::vector<const HashColon::Feline::XYXtdList *> &targets,
+			std::vector<HashColon::Real> &oResults) const override final;
+
+		// waypoint directions and clouds of every trajectory are built once for all pairs
+		bool MeasureMatrix(
+			const std::vector<HashColon::Feline::XYXtdList> &data,
+			Eigen::MatrixXR &oMatrix) const override final;
+
 	protected:
+		// clouds are built only if JS or WS coefficient is active, and shared between them
+		_hidden::BlendedWaypoints Prepare(const HashColon::Feline::XYXtdList &traj) const;
+
+		// DTW of the blended cost with inactive terms skipped.
+		// JS/WS terms are evaluated lazily, only for cells which can still be on the optimal path.
+		HashColon::Real PreparedDtw(
+			const _hidden::BlendedWaypoints &a, const _hidden::BlendedWaypoints &b,
+			HashColon::Real upperBound) const;
+
 		virtual HashColon::Real Measure_core(
 			const HashColon::Feline::XYXtdList &a,
-			const HashColon::Feline::XYXtdList &b) const override final;
+			const HashColon::Feline::XYXtdList &b,
+			HashColon::Real upperBound) const override final;
 	};
 
 	void Initialize_All_XtdTrajectoryDistanceMeasure();
@@ -0,0 +1,226 @@
+#ifndef HASHCOLON_FELINE_TRAJECTORYDEDUPLICATION_IMPL
+#define HASHCOLON_FELINE_TRAJECTORYDEDUPLICATION_IMPL
+
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// dependant external libraries
+#include <boost/type_index.hpp>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/Helper.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+#include <HashColon/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/TrajectoryDeduplication.hpp>
+
+namespace HashColon::Feline
+{
+	template <typename T>
+	TrajectoryDeduplication<T>::TrajectoryDeduplication(
+		typename HashColon::Clustering::DistanceMeasureBase<T>::Ptr measure,
+		_Params params)
+		: _c(params), _measure(measure)
+	{
+		if (!_measure)
+			throw Exception("Measure function is not given.");
+		if (_c.ResampleNumber < 2)
+			throw Exception("ResampleNumber should be at least 2.");
+		if (_c.GridSize <= 0)
+			throw Exception("GridSize should be positive.");
+	}
+
+	template <typename T>
+	void TrajectoryDeduplication<T>::Initialize(
+		const std::string identifierPostfix,
+		const std::string configFilePath,
+		const std::string configNamespace)
+	{
+		using namespace std;
+		using namespace HashColon;
+		using namespace HashColon::String;
+		using namespace boost::typeindex;
+
+		string identifier = configNamespace;
+		if (identifierPostfix.empty())
+		{
+			identifier += ("_" + Split(type_id<T>().pretty_name(), ":").back());
+		}
+		else
+		{
+			identifier = identifier + "_" + identifierPostfix;
+		}
+
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI(identifier);
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--ResampleNumber", _cDefault.ResampleNumber, "Number of uniformly resampled points used for hashing trajectory shapes.");
+		cli->add_option("--GridSize", _cDefault.GridSize, "Quantisation cell size(metre) for hashing resampled points.");
+		cli->add_option("--DuplicateEpsilon", _cDefault.DuplicateEpsilon, "Trajectories within this measured distance to a representative are collapsed into it. Should be below DbscanEpsilon.");
+	}
+
+	template <typename T>
+	DeduplicationResult TrajectoryDeduplication<T>::Run(const std::vector<T> &trajlist) const
+	{
+		using namespace std;
+		using namespace HashColon;
+
+		const size_t N = trajlist.size();
+		const bool isDistance = _measure->GetMeasureType() == HashColon::Clustering::DistanceMeasureType::distance;
+
+		// resample shapes
+		vector<XYList> shapes;
+		shapes.resize(N);
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++)
+		{
+			shapes[i] = XYList(trajlist[i]).GetUniformLengthSampled(_c.ResampleNumber);
+		}
+
+		// base latitude for local projection: mean of all resampled points
+		Real baseLat = 0;
+		for (const auto &s : shapes)
+			for (const auto &p : s)
+				baseLat += p.latitude;
+		baseLat /= (Real)(N * _c.ResampleNumber > 0 ? N * _c.ResampleNumber : 1);
+		XY base;
+		base.longitude = 0;
+		base.latitude = baseLat;
+		const Real lonCell = _c.GridSize / GeoDistance::cartesian.lonUnit(base);
+		const Real latCell = _c.GridSize / GeoDistance::cartesian.latUnit(base);
+
+		// quantised shapes: cells of resampled points
+		vector<vector<long long>> cells(N);
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++)
+		{
+			cells[i].reserve(2 * shapes[i].size());
+			for (const auto &p : shapes[i])
+			{
+				cells[i].push_back((long long)std::floor(p.longitude / lonCell));
+				cells[i].push_back((long long)std::floor(p.latitude / latCell));
+			}
+		}
+		auto cellKey = [](long long x, long long y)
+		{
+			size_t h = std::hash<long long>{}(x);
+			return h ^ (std::hash<long long>{}(y) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+		};
+		// every resampled point of a and b falls into the same or adjacent cells
+		auto isAdjacentShape = [&cells](size_t a, size_t b)
+		{
+			if (cells[a].size() != cells[b].size())
+				return false;
+			for (size_t k = 0; k < cells[a].size(); k++)
+				if (std::abs(cells[a][k] - cells[b][k]) > 1)
+					return false;
+			return true;
+		};
+
+		// leader clustering in input order: each trajectory is collapsed into the first representative
+		// within DuplicateEpsilon among those of adjacent shapes, or becomes a representative itself.
+		// representatives are indexed by the cell of their first point, which is probed with its 8 neighbors,
+		// so that near-duplicates across cell boundaries are verified as well.
+		unordered_map<size_t, vector<size_t>> leadersAt;
+		vector<size_t> leaderOf(N);
+		vector<size_t> candidates;
+		for (size_t i = 0; i < N; i++)
+		{
+			leaderOf[i] = i;
+			if (cells[i].empty())
+				continue;
+
+			candidates.clear();
+			for (long long dx : {-1LL, 0LL, 1LL})
+				for (long long dy : {-1LL, 0LL, 1LL})
+				{
+					auto it = leadersAt.find(cellKey(cells[i][0] + dx, cells[i][1] + dy));
+					if (it == leadersAt.end())
+						continue;
+					for (const size_t &l : it->second)
+						if (isAdjacentShape(l, i))
+							candidates.push_back(l);
+				}
+			sort(candidates.begin(), candidates.end());
+
+			for (const size_t &l : candidates)
+			{
+				// results beyond DuplicateEpsilon(inclusive) are not needed
+				Real d = _measure->Measure(
+					trajlist[l], trajlist[i],
+					isDistance ? nextafter(_c.DuplicateEpsilon, numeric_limits<Real>::infinity())
+							   : nextafter(_c.DuplicateEpsilon, -numeric_limits<Real>::infinity()));
+				if (isDistance ? (d <= _c.DuplicateEpsilon) : (d >= _c.DuplicateEpsilon))
+				{
+					leaderOf[i] = l;
+					break;
+				}
+			}
+			if (leaderOf[i] == i)
+				leadersAt[cellKey(cells[i][0], cells[i][1])].push_back(i);
+		}
+
+		// compact representatives in input order
+		DeduplicationResult re;
+		re.MemberOf.resize(N);
+		vector<size_t> repIdx(N, numeric_limits<size_t>::max());
+		for (size_t i = 0; i < N; i++)
+		{
+			if (leaderOf[i] == i)
+			{
+				repIdx[i] = re.Representatives.size();
+				re.Representatives.push_back(i);
+				re.Weights.push_back(0);
+			}
+		}
+		for (size_t i = 0; i < N; i++)
+		{
+			assert(repIdx[leaderOf[i]] != numeric_limits<size_t>::max());
+			re.MemberOf[i] = repIdx[leaderOf[i]];
+			re.Weights[re.MemberOf[i]]++;
+		}
+		return re;
+	}
+
+	template <typename T>
+	std::vector<T> TrajectoryDeduplication<T>::GetRepresentatives(
+		const std::vector<T> &trajlist, const DeduplicationResult &result)
+	{
+		std::vector<T> re;
+		re.reserve(result.Representatives.size());
+		for (const size_t &r : result.Representatives)
+			re.push_back(trajlist[r]);
+		return re;
+	}
+
+	template <typename T>
+	std::vector<size_t> TrajectoryDeduplication<T>::ExpandLabels(
+		const DeduplicationResult &result, const std::vector<size_t> &representativeLabels)
+	{
+		if (representativeLabels.size() != result.Representatives.size())
+			throw Exception("Number of labels does not match number of representatives.");
+
+		std::vector<size_t> re(result.MemberOf.size());
+		for (size_t i = 0; i < result.MemberOf.size(); i++)
+			re[i] = representativeLabels[result.MemberOf[i]];
+		return re;
+	}
+}
+
+#endif
@@ -10,6 +10,7 @@
 // std libraries
 #include <algorithm>
 #include <cctype>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -101,56 +102,58 @@ namespace HashColon::Feline
 		const vector<Table> &tables,
 		int threadCnt) const
 	{
-		map<string, mutex> mutices;
 		map<string, Table> reMap;
+		mutex reMapMutex;
 
 		// check headers
 		for (size_t i = 1; i < tables.size(); i++)
 			if (!tables.at(0).HasSameHeaderWith(tables.at(i)))
 				throw AisTrajectoryException("GetAisByVessel: headers of input tables do not match.");
 
+		// rows of a table are grouped locally, then merged into reMap under the lock once per table
 		auto processATable = [&](int Tidx, const Table &table) -> void
 		{
+			map<string, Table> local;
 			for (const auto &row : table)
 			{
 				// build a key for table in format "mmsi,imo"
 				string key = row.at(_c.colName.imo).Get() + "," + row.at(_c.colName.mmsi).Get();
+				local.try_emplace(key, table.GetColumnNames()).first->second.push_back(row);
+			}
 
-				// if new key is found, create a mutex and a table
-				if (mutices.find(key) == mutices.end())
-				{
-					mutices.try_emplace(key);
-					reMap.emplace(key, Table(table.GetColumnNames()));
-				}
-				{
-					lock_guard<mutex> lg(mutices[key]);
-					reMap[key].push_back(row);
-				}
+			lock_guard<mutex> lg(reMapMutex);
+			for (auto &[key, localTable] : local)
+			{
+				Table &reTable = reMap.try_emplace(key, table.GetColumnNames()).first->second;
+				reTable.insert(reTable.end(), make_move_iterator(localTable.begin()), make_move_iterator(localTable.end()));
 			}
 		};
 
+		// one pool for both steps: Wait/ParallelFor do not stop the pool
 		ThreadPool tp(threadCnt);
-		for (const auto &table : tables)
-		{
-			tp.Push(processATable, table);
-		}
-		tp.Wait();
+		tp.ParallelFor(
+			0, tables.size(), [&](int Tidx, size_t i)
+			{ processATable(Tidx, tables[i]); },
+			ThreadPool::Schedule::Dynamic, 1);
 
 		auto sortByTime = [&](int Tidx, Table &reTable) -> void
 		{
 			sort(reTable.begin(), reTable.end(),
-				 [&](Row a, Row b)
+				 [&](const Row &a, const Row &b)
 				 {
 					 return a.at(_c.colName.timestamp) < b.at(_c.colName.timestamp);
 				 });
 		};
 
-		ThreadPool tp2(threadCnt);
+		vector<Table *> reTables;
+		reTables.reserve(reMap.size());
 		for (auto &[key, reTable] : reMap)
-		{
-			tp2.Push(sortByTime, reTable);
-		}
-		tp2.Wait();
+			reTables.push_back(&reTable);
+		// vessels have very different number of rows
+		tp.ParallelFor(
+			0, reTables.size(), [&](int Tidx, size_t i)
+			{ sortByTime(Tidx, *reTables[i]); },
+			ThreadPool::Schedule::Dynamic, 1);
 
 		return reMap;
 	}
@@ -0,0 +1,280 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <utility>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// HashColon libraries
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/DtwSearch.hpp>
+
+using namespace std;
+using namespace HashColon;
+using namespace HashColon::Feline;
+
+namespace
+{
+	// slack for the difference between the spherical projection and the distance function(e.g. an ellipsoid)
+	constexpr Real ProjectionMargin = 0.99;
+
+	// to [-180, 180)
+	inline Real WrapLongitude(Real lon)
+	{
+		return lon - 360.0 * floor((lon + 180.0) / 360.0);
+	}
+
+	// projection around the mean position, longitude by circular mean so that tracks crossing the antimeridian stay together
+	TrajectoryClustering::LocalProjection CircularMeanProjection(const vector<XYList> &data)
+	{
+		XY base = TrajectoryClustering::LocalProjection::FromTrajectories(data).Base;
+		Real sx = 0, sy = 0;
+		for (const XYList &traj : data)
+			for (const XY &p : traj)
+			{
+				sx += cos(p.longitude * Constant::PI / 180.0);
+				sy += sin(p.longitude * Constant::PI / 180.0);
+			}
+		if (sx != 0 || sy != 0)
+			base.longitude = atan2(sy, sx) * 180.0 / Constant::PI;
+		return TrajectoryClustering::LocalProjection(base);
+	}
+}
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	DtwSearch::DtwSearch(DynamicTimeWarping::Ptr measure, const vector<XYList> &data)
+		: _measure(measure), _data(&data), _proj(CircularMeanProjection(data))
+	{
+		if (!_measure)
+			throw Exception("Measure function is not given.");
+
+		_local.resize(data.size());
+		_lower.resize(data.size());
+		_upper.resize(data.size());
+		_extents.resize(data.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t idx = 0; idx < data.size(); idx++)
+		{
+			_local[idx] = ToLocal(data[idx]);
+			_extents[idx] = GetExtent(_local[idx]);
+
+			// envelope of each row for queries of the same length
+			const size_t m = data[idx].size();
+			const vector<pair<size_t, size_t>> band = _measure->GetBand(m, m);
+			_lower[idx].resize(m);
+			_upper[idx].resize(m);
+			for (size_t i = 0; i < m; i++)
+			{
+				Eigen::Vector2R lo = _local[idx][band[i].first];
+				Eigen::Vector2R hi = lo;
+				for (size_t j = band[i].first + 1; j <= band[i].second; j++)
+				{
+					lo = lo.cwiseMin(_local[idx][j]);
+					hi = hi.cwiseMax(_local[idx][j]);
+				}
+				_lower[idx][i] = lo;
+				_upper[idx][i] = hi;
+			}
+		}
+	}
+
+	vector<Eigen::Vector2R> DtwSearch::ToLocal(const XYList &traj) const
+	{
+		vector<Eigen::Vector2R> re(traj.size());
+		for (size_t i = 0; i < traj.size(); i++)
+		{
+			XY p = traj[i];
+			p.longitude = _proj.Base.longitude + WrapLongitude(p.longitude - _proj.Base.longitude);
+			re[i] = _proj.ToLocal(p);
+		}
+		return re;
+	}
+
+	DtwSearch::Extent DtwSearch::GetExtent(const vector<Eigen::Vector2R> &local) const
+	{
+		Extent re{0, numeric_limits<Real>::infinity(), -numeric_limits<Real>::infinity()};
+		for (const Eigen::Vector2R &v : local)
+		{
+			re.MaxAbsLat = max(re.MaxAbsLat, abs(_proj.Base.latitude + v(1) / _proj.LatUnit));
+			re.MinLon = min(re.MinLon, v(0) / _proj.LonUnit);
+			re.MaxLon = max(re.MaxLon, v(0) / _proj.LonUnit);
+		}
+		return re;
+	}
+
+	Real DtwSearch::LocalToGeodesicScale(const Extent &extent) const
+	{
+		// longitude differences are true ones only below 180 degrees
+		const Real lonSpan = extent.MaxLon - extent.MinLon;
+		if (!(lonSpan < 180))
+			return 0;
+
+		// east-west local distances are scaled by cos(lat0), true ones by cos(lat) along the great circle,
+		// which reaches atan(tan(lat) / cos(lonSpan / 2)) between points within lat.
+		const Real toRad = Constant::PI / 180.0;
+		const Real lat = min(extent.MaxAbsLat, (Real)90) * toRad;
+		const Real pathLat = atan2(sin(lat), cos(lat) * cos(lonSpan / 2 * toRad));
+		const Real r = cos(pathLat) / cos(_proj.Base.latitude * toRad);
+		return min((Real)1, r) * ProjectionMargin;
+	}
+
+	Real DtwSearch::LB_Kim_core(const XYList &q, bool reversed, size_t idx) const
+	{
+		const XYList &b = (*_data)[idx];
+		const size_t n = q.size();
+		const size_t m = b.size();
+		auto qa = [&q, n, reversed](size_t i) -> const XY &
+		{ return q[reversed ? n - 1 - i : i]; };
+
+		// cost of (0, 0) is not counted in DynamicTimeWarping
+		if (n == 1 && m == 1)
+			return 0;
+		Real re = qa(n - 1).DistanceTo(b[m - 1]);
+
+		// second cell of the path, if it is not the last cell
+		if (n > 2 || m > 2)
+		{
+			Real second = numeric_limits<Real>::infinity();
+			if (n > 1)
+				second = min(second, qa(1).DistanceTo(b[0]));
+			if (m > 1)
+				second = min(second, qa(0).DistanceTo(b[1]));
+			if (n > 1 && m > 1)
+				second = min(second, qa(1).DistanceTo(b[1]));
+			re += second;
+		}
+		return re / (Real)(n + m);
+	}
+
+	Real DtwSearch::LB_Keogh_core(const vector<Eigen::Vector2R> &q, bool reversed, size_t idx) const
+	{
+		const size_t n = q.size();
+		if (n != _lower[idx].size())
+			return 0;
+
+		// row 0 may cost nothing as the path can leave (0, 0) downwards.
+		Real re = 0;
+		for (size_t i = 1; i < n; i++)
+		{
+			const Eigen::Vector2R &p = q[reversed ? n - 1 - i : i];
+			const Eigen::Vector2R d = (_lower[idx][i] - p).cwiseMax(p - _upper[idx][i]).cwiseMax(0);
+			re += d.norm();
+		}
+		return re / (Real)(n + n);
+	}
+
+	Real DtwSearch::LB_Kim(const XYList &q, size_t idx) const
+	{
+		Real re = LB_Kim_core(q, false, idx);
+		if (_measure->GetParams().Enable_ReversedSequence)
+			re = min(re, LB_Kim_core(q, true, idx));
+		return re;
+	}
+
+	Real DtwSearch::LB_Keogh(const vector<Eigen::Vector2R> &qLocal, size_t idx) const
+	{
+		Real re = LB_Keogh_core(qLocal, false, idx);
+		if (_measure->GetParams().Enable_ReversedSequence)
+			re = min(re, LB_Keogh_core(qLocal, true, idx));
+
+		// local distances may exceed geodesic ones away from the base latitude or over wide longitude spans.
+		// scale down to stay a lower bound.
+		if (re <= 0)
+			return 0;
+		Extent e = GetExtent(qLocal);
+		e.MaxAbsLat = max(e.MaxAbsLat, _extents[idx].MaxAbsLat);
+		e.MinLon = min(e.MinLon, _extents[idx].MinLon);
+		e.MaxLon = max(e.MaxLon, _extents[idx].MaxLon);
+		return re * LocalToGeodesicScale(e);
+	}
+
+	Real DtwSearch::MeasureWithCutoff(
+		const XYList &q, const vector<Eigen::Vector2R> &qLocal,
+		size_t idx, Real cutoff) const
+	{
+		const Real inf = numeric_limits<Real>::infinity();
+		if (LB_Kim(q, idx) >= cutoff)
+			return inf;
+		if (LB_Keogh(qLocal, idx) >= cutoff)
+			return inf;
+		Real re = _measure->Measure(q, (*_data)[idx], cutoff);
+		return re < cutoff ? re : inf;
+	}
+
+	vector<vector<size_t>> DtwSearch::GetRangeNeighbors(Real epsilon) const
+	{
+		const size_t N = _data->size();
+		vector<vector<size_t>> upper(N);
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < N; i++)
+		{
+			for (size_t j = i + 1; j < N; j++)
+			{
+				if (MeasureWithCutoff((*_data)[i], _local[i], j, epsilon) < epsilon)
+					upper[i].push_back(j);
+			}
+		}
+
+		vector<vector<size_t>> re(N);
+		for (size_t i = 0; i < N; i++)
+		{
+			for (const size_t &j : upper[i])
+			{
+				re[i].push_back(j);
+				re[j].push_back(i);
+			}
+		}
+		for (auto &r : re)
+			sort(r.begin(), r.end());
+		return re;
+	}
+
+	vector<size_t> DtwSearch::GetKNearest(const XYList &query, size_t k) const
+	{
+		const size_t N = _data->size();
+		const vector<Eigen::Vector2R> qLocal = ToLocal(query);
+
+		vector<Real> lb(N);
+#pragma omp parallel for
+		for (size_t i = 0; i < N; i++)
+			lb[i] = max(LB_Kim(query, i), LB_Keogh(qLocal, i));
+
+		vector<size_t> order(N);
+		iota(order.begin(), order.end(), 0);
+		sort(order.begin(), order.end(), [&lb](size_t l, size_t r)
+			 { return lb[l] < lb[r]; });
+
+		// visit in lower bound order. the k-th best so far is the cutoff.
+		priority_queue<pair<Real, size_t>> best;
+		for (const size_t &i : order)
+		{
+			const Real cutoff = best.size() < k ? numeric_limits<Real>::infinity() : best.top().first;
+			if (lb[i] >= cutoff)
+				break;
+			Real d = _measure->Measure(query, (*_data)[i], cutoff);
+			if (d < cutoff)
+			{
+				best.push({d, i});
+				if (best.size() > k)
+					best.pop();
+			}
+		}
+
+		vector<size_t> re(best.size());
+		for (size_t i = re.size(); i > 0; i--)
+		{
+			re[i - 1] = best.top().second;
+			best.pop();
+		}
+		return re;
+	}
+}
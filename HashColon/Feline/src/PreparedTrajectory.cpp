@@ -0,0 +1,396 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <utility>
+#include <vector>
+// HashColon libraries
+#include <HashColon/Helper.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/PreparedTrajectory.hpp>
+
+using namespace std;
+using namespace HashColon;
+using namespace HashColon::Feline;
+using namespace HashColon::Feline::TrajectoryClustering;
+
+// float kernels on prepared trajectories
+namespace
+{
+	// a prepared trajectory read forward or backward
+	struct TrajectoryView
+	{
+		const PreparedTrajectory *T;
+		bool Reversed;
+
+		size_t size() const { return T->size(); };
+		size_t Idx(size_t i) const { return Reversed ? T->size() - 1 - i : i; };
+		float X(size_t i) const { return T->X[Idx(i)]; };
+		float Y(size_t i) const { return T->Y[Idx(i)]; };
+		// length from the first point(of the view) to i-th point
+		float Prefix(size_t i) const { return Reversed ? T->Length() - T->CumLength[Idx(i)] : T->CumLength[i]; };
+	};
+
+	inline float Dist(const TrajectoryView &a, size_t i, const TrajectoryView &b, size_t j)
+	{
+		const float dx = a.X(i) - b.X(j);
+		const float dy = a.Y(i) - b.Y(j);
+		return sqrt(dx * dx + dy * dy);
+	}
+
+	struct HausdorffKernelTag
+	{
+	};
+
+	// symmetric Hausdorff distance by early break with randomized order. see Hausdorff.
+	Real HausdorffKernel(const TrajectoryView &a, const TrajectoryView &b)
+	{
+		thread_local minstd_rand rng;
+		vector<size_t> &aOrder = ScratchBuffer<size_t, HausdorffKernelTag>::Get(0, a.size());
+		vector<size_t> &bOrder = ScratchBuffer<size_t, HausdorffKernelTag>::Get(1, b.size());
+		iota(aOrder.begin(), aOrder.end(), 0);
+		iota(bOrder.begin(), bOrder.end(), 0);
+		shuffle(aOrder.begin(), aOrder.end(), rng);
+		shuffle(bOrder.begin(), bOrder.end(), rng);
+
+		// on squared distances
+		auto directed = [](const TrajectoryView &from, const vector<size_t> &fromOrder,
+						   const TrajectoryView &to, const vector<size_t> &toOrder, float cmax)
+		{
+			for (const size_t &i : fromOrder)
+			{
+				float cmin = numeric_limits<float>::max();
+				for (const size_t &j : toOrder)
+				{
+					const float dx = from.X(i) - to.X(j);
+					const float dy = from.Y(i) - to.Y(j);
+					const float d = dx * dx + dy * dy;
+					if (d < cmax)
+					{
+						cmin = d;
+						break;
+					}
+					cmin = min(cmin, d);
+				}
+				cmax = max(cmax, cmin);
+			}
+			return cmax;
+		};
+
+		const float re = directed(a, aOrder, b, bOrder, 0);
+		return (Real)sqrt(directed(b, bOrder, a, aOrder, re));
+	}
+
+	Real EuclideanKernel(const TrajectoryView &a, const TrajectoryView &b, bool rms, Real upperBound)
+	{
+		const size_t n = max(a.size(), b.size());
+		const Real sumBound = (rms ? upperBound * upperBound : upperBound) * (Real)n;
+		Real dist = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			const Real d = Dist(a, min(i, a.size() - 1), b, min(i, b.size() - 1));
+			dist += rms ? d * d : d;
+			if (dist >= sumBound)
+				return numeric_limits<Real>::infinity();
+		}
+		dist /= (Real)n;
+		return rms ? sqrt(dist) : dist;
+	}
+
+	struct MergeKernelTag
+	{
+	};
+
+	// see Merge::Measure_core
+	Real MergeKernel(const TrajectoryView &a, const TrajectoryView &b)
+	{
+		if (b.size() > a.size())
+			return MergeKernel(b, a);
+
+		const size_t m = b.size();
+		vector<Real> &Aprev = ScratchBuffer<Real, MergeKernelTag>::Get(0, m);
+		vector<Real> &Bprev = ScratchBuffer<Real, MergeKernelTag>::Get(1, m);
+		vector<Real> &Acur = ScratchBuffer<Real, MergeKernelTag>::Get(2, m);
+		vector<Real> &Bcur = ScratchBuffer<Real, MergeKernelTag>::Get(3, m);
+
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			const Real aSeg = i > 0 ? a.Prefix(i) - a.Prefix(i - 1) : 0;
+			for (size_t j = 0; j < m; j++)
+			{
+				if (i == 0)
+					Acur[j] = b.Prefix(j) + Dist(a, 0, b, j);
+				else
+					Acur[j] = min(Aprev[j] + aSeg, Bprev[j] + Dist(a, i, b, j));
+
+				if (j == 0)
+					Bcur[j] = a.Prefix(i) + Dist(a, i, b, 0);
+				else
+					Bcur[j] = min(Acur[j - 1] + Dist(a, i, b, j), Bcur[j - 1] + (b.Prefix(j) - b.Prefix(j - 1)));
+			}
+			swap(Aprev, Acur);
+			swap(Bprev, Bcur);
+		}
+		return 2.0 * min(Aprev[m - 1], Bprev[m - 1]) / ((Real)a.T->Length() + (Real)b.T->Length()) - 1.0;
+	}
+
+	struct LcssKernelTag
+	{
+	};
+
+	// banded LCSS. see LCSS::Measure_core
+	Real LcssKernel(const TrajectoryView &a, const TrajectoryView &b, Real epsilon, Real delta)
+	{
+		if (b.size() > a.size())
+			return LcssKernel(b, a, epsilon, delta);
+
+		const size_t n = a.size();
+		const size_t m = b.size();
+		if (delta < 0)
+			return 0;
+		const size_t w = (size_t)min(floor(delta), (Real)n);
+		const float eps = (float)epsilon;
+
+		vector<Real> &prev = ScratchBuffer<Real, LcssKernelTag>::Get(0, m + 1, 0);
+		vector<Real> &cur = ScratchBuffer<Real, LcssKernelTag>::Get(1, m + 1, 0);
+
+		const size_t iEnd = min(n, m + w);
+		for (size_t i = 1; i <= iEnd; i++)
+		{
+			const size_t jBegin = i > w ? i - w : 1;
+			const size_t jEnd = min(m, i + w);
+			for (size_t j = jBegin; j <= jEnd; j++)
+			{
+				if (Dist(a, i - 1, b, j - 1) < eps)
+					cur[j] = 1.0 + ((i == 1 || j == 1) ? 0 : prev[j - 1]);
+				else
+				{
+					const Real up = (i == 1) ? 0 : prev[min(j, i - 1 + w)];
+					const Real left = (j == 1) ? 0 : (j == jBegin ? prev[j - 1] : cur[j - 1]);
+					cur[j] = max(up, left);
+				}
+			}
+			swap(prev, cur);
+		}
+		return prev[min(m, iEnd + w)] / ((Real)min(n + 1, m + 1));
+	}
+
+	struct DtwKernelTag
+	{
+	};
+
+	// DTW with the convention of DynamicTimeWarping: cost of (0, 0) is not counted, normalized by (n + m).
+	// band[i] is the allowed column range of row i.
+	Real DtwKernel(
+		const TrajectoryView &a, const TrajectoryView &b, const vector<pair<size_t, size_t>> &band, Real upperBound)
+	{
+		const size_t n = a.size();
+		const size_t m = b.size();
+		const Real inf = numeric_limits<Real>::infinity();
+		const Real rowCutoff = upperBound * (Real)(n + m);
+		vector<Real> &prev = ScratchBuffer<Real, DtwKernelTag>::Get(0, m, inf);
+		vector<Real> &cur = ScratchBuffer<Real, DtwKernelTag>::Get(1, m, inf);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			if (i >= 2)
+				fill(cur.begin() + band[i - 2].first, cur.begin() + band[i - 2].second + 1, inf);
+			Real rowMin = inf;
+			for (size_t j = band[i].first; j <= band[i].second; j++)
+			{
+				if (i == 0 && j == 0)
+					cur[j] = 0;
+				else
+					cur[j] = Dist(a, i, b, j) + min({(i >= 1 ? prev[j] : inf),
+													 (j >= 1 ? cur[j - 1] : inf),
+													 ((i >= 1 && j >= 1) ? prev[j - 1] : inf)});
+				rowMin = min(rowMin, cur[j]);
+			}
+			if (rowMin > rowCutoff)
+				return inf;
+			swap(prev, cur);
+		}
+		return prev[m - 1] / (Real)(n + m);
+	}
+
+	// oMatrix(i, j) = measure.Measure(data[i], data[j]), row i is measured against (i+1 ~ l-1)
+	void AllPairsMatrix(
+		const HashColon::Clustering::DistanceMeasureBase<PreparedTrajectory> &measure,
+		const vector<PreparedTrajectory> &data, Eigen::MatrixXR &oMatrix)
+	{
+		oMatrix = Eigen::MatrixXR::Zero(data.size(), data.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < data.size(); i++)
+			for (size_t j = i + 1; j < data.size(); j++)
+				oMatrix(i, j) = oMatrix(j, i) = measure.Measure(data[i], data[j]);
+	}
+}
+
+// prepared trajectories
+namespace HashColon::Feline::TrajectoryClustering
+{
+	PreparedTrajectory PreparedTrajectory::Prepare(const XYList &traj, const LocalProjection &proj)
+	{
+		PreparedTrajectory re;
+		re.X.resize(traj.size());
+		re.Y.resize(traj.size());
+		re.CumLength.resize(traj.size());
+		for (size_t i = 0; i < traj.size(); i++)
+		{
+			const Eigen::Vector2R p = proj.ToLocal(traj[i]);
+			re.X[i] = (float)p(0);
+			re.Y[i] = (float)p(1);
+			re.CumLength[i] = (i == 0) ? 0 : re.CumLength[i - 1] + (float)hypot(p(0) - (Real)re.X[i - 1], p(1) - (Real)re.Y[i - 1]);
+		}
+		return re;
+	}
+
+	vector<PreparedTrajectory> PreparedTrajectory::Prepare(const vector<XYList> &trajlist, const LocalProjection &proj)
+	{
+		vector<PreparedTrajectory> re(trajlist.size());
+#pragma omp parallel for
+		for (size_t i = 0; i < trajlist.size(); i++)
+			re[i] = Prepare(trajlist[i], proj);
+		return re;
+	}
+
+	PreparedTrajectory PreparedTrajectory::Prepare(const XYXtdList &traj, const LocalProjection &proj)
+	{
+		return Prepare(traj.ToXYList(), proj);
+	}
+
+	vector<PreparedTrajectory> PreparedTrajectory::Prepare(const vector<XYXtdList> &trajlist, const LocalProjection &proj)
+	{
+		vector<PreparedTrajectory> re(trajlist.size());
+#pragma omp parallel for
+		for (size_t i = 0; i < trajlist.size(); i++)
+			re[i] = Prepare(trajlist[i], proj);
+		return re;
+	}
+}
+
+// measures on prepared trajectories
+namespace HashColon::Feline::TrajectoryClustering
+{
+	PreparedTrajectoryMeasure::PreparedTrajectoryMeasure(TrajectoryDistanceMeasureBase::Ptr source)
+		: HashColon::Clustering::DistanceMeasureBase<PreparedTrajectory>(
+			  source ? source->GetMeasureType() : HashColon::Clustering::DistanceMeasureType::distance),
+		  _source(source)
+	{
+		if (!_source)
+			throw Exception("Measure function is not given.");
+
+		if (dynamic_pointer_cast<Hausdorff>(_source))
+			_kernel = Kernel_Hausdorff;
+		else if (dynamic_pointer_cast<Euclidean>(_source))
+			_kernel = Kernel_Euclidean;
+		else if (dynamic_pointer_cast<Merge>(_source))
+			_kernel = Kernel_Merge;
+		else if (dynamic_pointer_cast<LCSS>(_source))
+			_kernel = Kernel_LCSS;
+		else if (dynamic_pointer_cast<DynamicTimeWarping>(_source))
+			_kernel = Kernel_DynamicTimeWarping;
+		else
+			throw Exception("Prepared kernel is not available for " + _source->GetMethodName() + ".");
+
+		_enableReversedSequence = _source->GetParams().Enable_ReversedSequence;
+	}
+
+	bool PreparedTrajectoryMeasure::IsAvailableFor(const TrajectoryDistanceMeasureBase &source)
+	{
+		return dynamic_cast<const Hausdorff *>(&source) || dynamic_cast<const Euclidean *>(&source) ||
+			   dynamic_cast<const Merge *>(&source) || dynamic_cast<const LCSS *>(&source) ||
+			   dynamic_cast<const DynamicTimeWarping *>(&source);
+	}
+
+	Real PreparedTrajectoryMeasure::Measure_core(
+		const PreparedTrajectory &a, const PreparedTrajectory &b, bool reversed, Real upperBound) const
+	{
+		const TrajectoryView av{&a, reversed};
+		const TrajectoryView bv{&b, false};
+		switch (_kernel)
+		{
+		case Kernel_Hausdorff:
+			return HausdorffKernel(av, bv);
+		case Kernel_Euclidean:
+			return EuclideanKernel(av, bv, static_pointer_cast<Euclidean>(_source)->GetParams().Enable_RootMeanSquare, upperBound);
+		case Kernel_Merge:
+			return MergeKernel(av, bv);
+		case Kernel_LCSS:
+		{
+			const LCSS::_Params p = static_pointer_cast<LCSS>(_source)->GetParams();
+			return LcssKernel(av, bv, p.Epsilon, p.Delta);
+		}
+		case Kernel_DynamicTimeWarping:
+		{
+			vector<pair<size_t, size_t>> &band = ScratchBuffer<pair<size_t, size_t>, PreparedTrajectoryMeasure>::Get(0, a.size());
+			static_pointer_cast<DynamicTimeWarping>(_source)->GetBand(a.size(), b.size(), band);
+			return DtwKernel(av, bv, band, upperBound);
+		}
+		default:
+			throw Exception("Unknown kernel type.");
+		}
+	}
+
+	Real PreparedTrajectoryMeasure::Measure(const PreparedTrajectory &a, const PreparedTrajectory &b, Real upperBound) const
+	{
+		const Real forward = Measure_core(a, b, false, upperBound);
+		// Hausdorff distance is sequence-invariant
+		if (_enableReversedSequence && _kernel != Kernel_Hausdorff)
+		{
+			if (_measureType == HashColon::Clustering::DistanceMeasureType::distance)
+				return min(forward, Measure_core(a, b, true, min(upperBound, forward)));
+			else
+				return max(forward, Measure_core(a, b, true, upperBound));
+		}
+		return forward;
+	}
+
+	bool PreparedTrajectoryMeasure::MeasureMatrix(const vector<PreparedTrajectory> &data, Eigen::MatrixXR &oMatrix) const
+	{
+		AllPairsMatrix(*this, data, oMatrix);
+		return true;
+	}
+
+	PreparedXtdTrajectoryMeasure::PreparedXtdTrajectoryMeasure(
+		shared_ptr<XtdTrajectoryClustering::DtwXtd> source)
+		: HashColon::Clustering::DistanceMeasureBase<PreparedTrajectory>(
+			  HashColon::Clustering::DistanceMeasureType::distance),
+		  _source(source)
+	{
+		if (!_source)
+			throw Exception("Measure function is not given.");
+		_enableReversedSequence = _source->GetParams().Enable_ReversedSequence;
+	}
+
+	Real PreparedXtdTrajectoryMeasure::Measure_core(
+		const PreparedTrajectory &a, const PreparedTrajectory &b, bool reversed, Real upperBound) const
+	{
+		vector<pair<size_t, size_t>> &band =
+			ScratchBuffer<pair<size_t, size_t>, PreparedXtdTrajectoryMeasure>::Get(0, a.size(), {0, b.size() - 1});
+		return DtwKernel({&a, reversed}, {&b, false}, band, upperBound);
+	}
+
+	Real PreparedXtdTrajectoryMeasure::Measure(
+		const PreparedTrajectory &a, const PreparedTrajectory &b, Real upperBound) const
+	{
+		const Real forward = Measure_core(a, b, false, upperBound);
+		if (_enableReversedSequence)
+			return min(forward, Measure_core(a, b, true, min(upperBound, forward)));
+		return forward;
+	}
+
+	bool PreparedXtdTrajectoryMeasure::MeasureMatrix(const vector<PreparedTrajectory> &data, Eigen::MatrixXR &oMatrix) const
+	{
+		AllPairsMatrix(*this, data, oMatrix);
+		return true;
+	}
+}
@@ -0,0 +1,441 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/Clustering.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/SegmentClustering.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace HashColon;
+using namespace HashColon::Clustering;
+using namespace HashColon::Feline;
+
+// distance components of TRACLUS. Li is the base segment.
+namespace
+{
+	using HashColon::Feline::TrajectoryClustering::TrajectorySegment;
+
+	struct SegmentDistanceComponents
+	{
+		Real Perpendicular;
+		Real Parallel;
+		Real Angle;
+	};
+
+	SegmentDistanceComponents GetDistanceComponents(const TrajectorySegment &Li, const TrajectorySegment &Lj)
+	{
+		SegmentDistanceComponents re;
+
+		const Vector2R di = Li.E - Li.S;
+		const Vector2R dj = Lj.E - Lj.S;
+		const Real li2 = di.squaredNorm();
+
+		// projection points of Lj.S, Lj.E on the line of Li
+		const Real ts = li2 > 0 ? (Lj.S - Li.S).dot(di) / li2 : 0;
+		const Real te = li2 > 0 ? (Lj.E - Li.S).dot(di) / li2 : 0;
+		const Vector2R ps = Li.S + ts * di;
+		const Vector2R pe = Li.S + te * di;
+
+		// perpendicular distance
+		const Real lp1 = (Lj.S - ps).norm();
+		const Real lp2 = (Lj.E - pe).norm();
+		re.Perpendicular = (lp1 + lp2) > 0 ? (lp1 * lp1 + lp2 * lp2) / (lp1 + lp2) : 0;
+
+		// parallel distance
+		const Real ll1 = min((ps - Li.S).norm(), (ps - Li.E).norm());
+		const Real ll2 = min((pe - Li.S).norm(), (pe - Li.E).norm());
+		re.Parallel = min(ll1, ll2);
+
+		// angle distance
+		const Real li = sqrt(li2);
+		const Real lj = dj.norm();
+		if (li == 0 || lj == 0)
+			re.Angle = 0;
+		else
+		{
+			const Real cosTheta = max((Real)-1, min((Real)1, di.dot(dj) / li / lj));
+			re.Angle = cosTheta >= 0 ? lj * sqrt(1 - cosTheta * cosTheta) : lj;
+		}
+		return re;
+	}
+
+	// description length of a value. values below 1 cost nothing.
+	inline Real DescLength(Real x)
+	{
+		return x > 1 ? log2(x) : 0;
+	}
+}
+
+// SegmentDistance
+namespace HashColon::Feline::TrajectoryClustering
+{
+	void SegmentDistance::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.SegmentClustering.SegmentDistance");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--Weight_Perpendicular", _cDefault.Weight_Perpendicular, "Weight of perpendicular distance.");
+		cli->add_option("--Weight_Parallel", _cDefault.Weight_Parallel, "Weight of parallel distance.");
+		cli->add_option("--Weight_Angle", _cDefault.Weight_Angle, "Weight of angle distance.");
+	}
+
+	Real SegmentDistance::Measure(const TrajectorySegment &a, const TrajectorySegment &b, Real) const
+	{
+		// longer segment is the base segment
+		const bool aIsLonger = a.Length() >= b.Length();
+		SegmentDistanceComponents d = aIsLonger ? GetDistanceComponents(a, b) : GetDistanceComponents(b, a);
+		return _c.Weight_Perpendicular * d.Perpendicular + _c.Weight_Parallel * d.Parallel + _c.Weight_Angle * d.Angle;
+	}
+
+	Real SegmentDistance::SearchMargin(Real epsilon) const
+	{
+		if (_c.Weight_Perpendicular <= 0 || _c.Weight_Parallel <= 0)
+			return numeric_limits<Real>::infinity();
+
+		// perpendicular distance (l1^2 + l2^2) / (l1 + l2) is at least (2*sqrt(2) - 2) > 1/2 times the larger
+		// perpendicular length, thus each perpendicular length is below epsilon / ((2*sqrt(2) - 2) * Weight_Perpendicular),
+		// which is rounded up to 2 * epsilon / Weight_Perpendicular.
+		// parallel distance is below epsilon / Weight_Parallel. an end point is within the sum from an end point of the other.
+		return 2.0 * epsilon / _c.Weight_Perpendicular + epsilon / _c.Weight_Parallel;
+	}
+}
+
+// SegmentGridIndex
+namespace HashColon::Feline::TrajectoryClustering
+{
+	SegmentGridIndex::SegmentGridIndex(const vector<TrajectorySegment> &segments, Real cellSize)
+		: _cellSize(cellSize), _segments(&segments)
+	{
+		assert(cellSize > 0);
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			const long long ks = CellKey(CellCoord(segments[i].S(0)), CellCoord(segments[i].S(1)));
+			const long long ke = CellKey(CellCoord(segments[i].E(0)), CellCoord(segments[i].E(1)));
+			_cells[ks].push_back(i);
+			if (ke != ks)
+				_cells[ke].push_back(i);
+		}
+	}
+
+	vector<size_t> SegmentGridIndex::Query(const TrajectorySegment &seg, Real margin) const
+	{
+		vector<size_t> re;
+		const long long r = (long long)ceil(margin / _cellSize);
+		for (const Vector2R *p : {&seg.S, &seg.E})
+		{
+			const long long cx = CellCoord((*p)(0));
+			const long long cy = CellCoord((*p)(1));
+			for (long long x = cx - r; x <= cx + r; x++)
+				for (long long y = cy - r; y <= cy + r; y++)
+				{
+					auto it = _cells.find(CellKey(x, y));
+					if (it != _cells.end())
+						re.insert(re.end(), it->second.begin(), it->second.end());
+				}
+		}
+		sort(re.begin(), re.end());
+		re.erase(unique(re.begin(), re.end()), re.end());
+		return re;
+	}
+}
+
+// SegmentClustering
+namespace HashColon::Feline::TrajectoryClustering
+{
+	void SegmentClustering::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.SegmentClustering");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--MdlCostAdvantage", _cDefault.MdlCostAdvantage,
+						"Additional cost allowed for not partitioning in MDL partitioning. Larger value gives longer segments.");
+		cli->add_option("--MinLines", _cDefault.MinLines,
+						"minPts value of segment DBSCAN. Also used as the minimum number of segments for representative trajectory.");
+		cli->add_option("--DbscanEpsilon", _cDefault.DbscanEpsilon,
+						"Epsilon value of segment DBSCAN.");
+		cli->add_option("--MinTrajectoryCardinality", _cDefault.MinTrajectoryCardinality,
+						"Clusters with segments from less than this number of trajectories are regarded as noise.");
+		cli->add_option("--GridCellSize", _cDefault.GridCellSize,
+						"Cell size(metre) of segment grid index. If 0, search margin of the segment distance is used.");
+		cli->add_option("--Enable_Representative", _cDefault.Enable_Representative,
+						"Builds representative trajectory for each cluster.");
+		cli->add_option("--RepresentativeSmoothing", _cDefault.RepresentativeSmoothing,
+						"Minimum gap(metre) between points of representative trajectory. Represented as gamma.");
+	}
+
+	vector<size_t> SegmentClustering::GetCharacteristicPoints(const XYList &traj, const LocalProjection &proj) const
+	{
+		const size_t n = traj.size();
+		vector<size_t> re;
+		if (n == 0)
+			return re;
+
+		vector<Vector2R> P(n);
+		for (size_t i = 0; i < n; i++)
+			P[i] = proj.ToLocal(traj[i]);
+
+		auto makeSegment = [&P](size_t s, size_t e)
+		{
+			TrajectorySegment seg;
+			seg.S = P[s];
+			seg.E = P[e];
+			return seg;
+		};
+
+		// MDL cost with partitioning at s and e: L(H) + L(D|H)
+		auto costPar = [&](size_t s, size_t e)
+		{
+			TrajectorySegment hyp = makeSegment(s, e);
+			Real lh = DescLength(hyp.Length());
+			Real ldh = 0;
+			for (size_t k = s; k < e; k++)
+			{
+				SegmentDistanceComponents d = GetDistanceComponents(hyp, makeSegment(k, k + 1));
+				ldh += DescLength(d.Perpendicular) + DescLength(d.Angle);
+			}
+			return lh + ldh;
+		};
+
+		// MDL cost without partitioning: L(H) of the original line segments
+		auto costNoPar = [&](size_t s, size_t e)
+		{
+			Real lh = 0;
+			for (size_t k = s; k < e; k++)
+				lh += DescLength((P[k + 1] - P[k]).norm());
+			return lh;
+		};
+
+		re.push_back(0);
+		size_t start = 0, length = 1;
+		while (start + length < n)
+		{
+			const size_t curr = start + length;
+			// a single original segment costs the same either way: never split there(a negative advantage would loop)
+			if (length > 1 && costPar(start, curr) > costNoPar(start, curr) + _c.MdlCostAdvantage)
+			{
+				re.push_back(curr - 1);
+				start = curr - 1;
+				length = 1;
+			}
+			else
+				length++;
+		}
+		if (re.back() != n - 1)
+			re.push_back(n - 1);
+		return re;
+	}
+
+	vector<TrajectorySegment> SegmentClustering::Partition(
+		const vector<XYList> &trajlist, const LocalProjection &proj) const
+	{
+		vector<vector<TrajectorySegment>> segs;
+		segs.resize(trajlist.size());
+
+#pragma omp parallel for schedule(dynamic)
+		for (size_t t = 0; t < trajlist.size(); t++)
+		{
+			vector<size_t> cp = GetCharacteristicPoints(trajlist[t], proj);
+			for (size_t k = 1; k < cp.size(); k++)
+			{
+				TrajectorySegment seg;
+				seg.TrajectoryIdx = t;
+				seg.StartIdx = cp[k - 1];
+				seg.EndIdx = cp[k];
+				seg.S = proj.ToLocal(trajlist[t][cp[k - 1]]);
+				seg.E = proj.ToLocal(trajlist[t][cp[k]]);
+				segs[t].push_back(seg);
+			}
+		}
+
+		vector<TrajectorySegment> re;
+		for (auto &s : segs)
+			re.insert(re.end(), s.begin(), s.end());
+		return re;
+	}
+
+	vector<vector<size_t>> SegmentClustering::GetNeighbors(const vector<TrajectorySegment> &segments) const
+	{
+		const size_t N = segments.size();
+		vector<vector<size_t>> re;
+		re.resize(N);
+
+		const Real margin = _measure->SearchMargin(_c.DbscanEpsilon);
+
+		// without finite search margin, grid index is useless
+		if (!isfinite(margin))
+		{
+#pragma omp parallel for schedule(dynamic)
+			for (size_t i = 0; i < N; i++)
+				for (size_t j = 0; j < N; j++)
+					if (i != j && _measure->Measure(segments[i], segments[j]) < _c.DbscanEpsilon)
+						re[i].push_back(j);
+			return re;
+		}
+
+		SegmentGridIndex grid(segments, _c.GridCellSize > 0 ? _c.GridCellSize : max(margin, (Real)1));
+
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < N; i++)
+		{
+			for (const size_t &j : grid.Query(segments[i], margin))
+			{
+				if (i != j && _measure->Measure(segments[i], segments[j]) < _c.DbscanEpsilon)
+					re[i].push_back(j);
+			}
+		}
+		return re;
+	}
+
+	XYList SegmentClustering::GetRepresentative(
+		const vector<TrajectorySegment> &segments, const vector<size_t> &members,
+		const LocalProjection &proj) const
+	{
+		XYList re;
+		if (members.empty())
+			return re;
+
+		// average direction vector
+		Vector2R V = Vector2R::Zero();
+		for (const size_t &m : members)
+			V += segments[m].E - segments[m].S;
+		if (V.norm() == 0)
+			return re;
+		V.normalize();
+
+		// rotate axes so that x' is parallel to V
+		Matrix2R R;
+		R << V(0), V(1),
+			-V(1), V(0);
+
+		struct RotatedSegment
+		{
+			Vector2R s;
+			Vector2R e;
+		};
+		vector<RotatedSegment> rs(members.size());
+		for (size_t k = 0; k < members.size(); k++)
+		{
+			rs[k].s = R * segments[members[k]].S;
+			rs[k].e = R * segments[members[k]].E;
+			if (rs[k].s(0) > rs[k].e(0))
+				swap(rs[k].s, rs[k].e);
+		}
+
+		// sweep along x': (x', is end point, segment)
+		struct SweepEvent
+		{
+			Real x;
+			bool isEnd;
+			size_t k;
+		};
+		vector<SweepEvent> events;
+		events.reserve(rs.size() * 2);
+		for (size_t k = 0; k < rs.size(); k++)
+		{
+			events.push_back({rs[k].s(0), false, k});
+			events.push_back({rs[k].e(0), true, k});
+		}
+		sort(events.begin(), events.end(),
+			 [](const SweepEvent &l, const SweepEvent &r)
+			 { return l.x < r.x || (l.x == r.x && !l.isEnd && r.isEnd); });
+
+		set<size_t> active;
+		Real prevX = -numeric_limits<Real>::infinity();
+		for (size_t ev = 0; ev < events.size(); ev++)
+		{
+			if (!events[ev].isEnd)
+				active.insert(events[ev].k);
+
+			const Real x = events[ev].x;
+			if (active.size() >= _c.MinLines && x - prevX >= _c.RepresentativeSmoothing)
+			{
+				Real ySum = 0;
+				for (const size_t &k : active)
+				{
+					const Real dx = rs[k].e(0) - rs[k].s(0);
+					ySum += dx > 0
+								? rs[k].s(1) + (x - rs[k].s(0)) / dx * (rs[k].e(1) - rs[k].s(1))
+								: (rs[k].s(1) + rs[k].e(1)) / 2;
+				}
+				Vector2R p(x, ySum / (Real)active.size());
+				re.push_back(proj.ToGeo(R.transpose() * p));
+				prevX = x;
+			}
+
+			if (events[ev].isEnd)
+				active.erase(events[ev].k);
+		}
+		return re;
+	}
+
+	SegmentClustering::Results SegmentClustering::Run(const vector<XYList> &trajlist) const
+	{
+		Results re;
+		re.Projection = LocalProjection::FromTrajectories(trajlist);
+		re.Segments = Partition(trajlist, re.Projection);
+		re.NumOfClusters = 0;
+		if (re.Segments.empty())
+			return re;
+
+		// density clustering with grid-based neighbors
+		vector<vector<size_t>> neighbors = GetNeighbors(re.Segments);
+		DistanceBasedDBSCAN<TrajectorySegment> dbscan(_measure, {_c.MinLines, _c.DbscanEpsilon, false});
+		auto labels = make_shared<vector<size_t>>();
+		dbscan.TrainModel_withNeighbors(neighbors, labels);
+		re.Labels = *labels;
+
+		// dismiss clusters from too few trajectories, then compact labels
+		const size_t clusterNo = dbscan.GetNumOfClusters();
+		vector<set<size_t>> trajOfCluster(clusterNo);
+		for (size_t i = 0; i < re.Labels.size(); i++)
+			trajOfCluster[re.Labels[i]].insert(re.Segments[i].TrajectoryIdx);
+
+		vector<size_t> newLabel(clusterNo, 0);
+		for (size_t c = 1; c < clusterNo; c++)
+		{
+			if (trajOfCluster[c].size() >= _c.MinTrajectoryCardinality)
+				newLabel[c] = ++re.NumOfClusters;
+		}
+		for (auto &l : re.Labels)
+			l = newLabel[l];
+
+		// representative trajectories
+		if (_c.Enable_Representative)
+		{
+			vector<vector<size_t>> members(re.NumOfClusters);
+			for (size_t i = 0; i < re.Labels.size(); i++)
+				if (re.Labels[i] > 0)
+					members[re.Labels[i] - 1].push_back(i);
+
+			re.Representatives.resize(re.NumOfClusters);
+#pragma omp parallel for schedule(dynamic)
+			for (size_t c = 0; c < re.NumOfClusters; c++)
+				re.Representatives[c] = GetRepresentative(re.Segments, members[c], re.Projection);
+		}
+		return re;
+	}
+}
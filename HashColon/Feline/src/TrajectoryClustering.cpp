@@ -1,19 +1,28 @@
-// HashColon config
+﻿// HashColon config
 #include <HashColon/HashColon_config.h>
 // std libraries
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <numeric>
+#include <random>
+#include <utility>
 #include <vector>
 // dependant external libraries
 #include <Eigen/Eigen>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 // modified external libraries
 #include <HashColon/CLI11.hpp>
 #include <HashColon/CLI11_JsonSupport.hpp>
+#include <Wasserstein/Wasserstein.hh>
 // HashColon libraries
+#include <HashColon/Helper.hpp>
 #include <HashColon/Real.hpp>
 #include <HashColon/SingletonCLI.hpp>
 #include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/PreparedTrajectory.hpp>
 // header file for this source file
 #include <HashColon/Feline/TrajectoryClustering.hpp>
 
@@ -41,139 +50,580 @@ namespace HashColon::Feline::TrajectoryClustering
 
 	Real TrajectoryDistanceMeasureBase::Measure(
 		const XYList &a,
-		const XYList &b) const
+		const XYList &b,
+		Real upperBound) const
 	{
 		if (_c.Enable_ReversedSequence)
+			return MeasureBothDirections_core(a, b, upperBound);
+		else
+			return Measure_core(a, b, false, upperBound);
+	}
+
+	Real TrajectoryDistanceMeasureBase::MeasureBothDirections_core(
+		const XYList &a,
+		const XYList &b,
+		Real upperBound) const
+	{
+		// the forward result tightens the bound of the reversed one
+		const Real forward = Measure_core(a, b, false, upperBound);
+		if (DistanceMeasureBase<XYList>::_measureType == DistanceMeasureType::distance)
+			return min(forward, Measure_core(a, b, true, min(upperBound, forward)));
+		else
+			return max(forward, Measure_core(a, b, true, isinf(upperBound) ? forward : max(upperBound, forward)));
+	}
+
+	bool TrajectoryDistanceMeasureBase::IsWithin(
+		const XYList &a,
+		const XYList &b,
+		Real threshold) const
+	{
+		return Measure(a, b, threshold) < threshold;
+	}
+
+	void TrajectoryDistanceMeasureBase::MeasureBatch(
+		const XYList &query,
+		const vector<const XYList *> &targets,
+		vector<Real> &oResults) const
+	{
+		oResults.resize(targets.size());
+		for (size_t k = 0; k < targets.size(); k++)
 		{
-			if (DistanceMeasureBase<XYList>::_measureType == DistanceMeasureType::distance)
-				return min(Measure_core(a, b), Measure_core(a.GetReversed(), b));
-			else
-				return max(Measure_core(a, b), Measure_core(a.GetReversed(), b));
+			oResults[k] = _c.Enable_ReversedSequence
+							  ? MeasureBothDirections_core(query, *targets[k], numeric_limits<Real>::infinity())
+							  : Measure_core(query, *targets[k], false, numeric_limits<Real>::infinity());
 		}
-		else
+	}
+
+	bool TrajectoryDistanceMeasureBase::MeasureMatrix(
+		const vector<XYList> &data, Eigen::MatrixXR &oMatrix) const
+	{
+		if (!_c.Enable_PreparedKernel || !PreparedTrajectoryMeasure::IsAvailableFor(*this))
+			return false;
+
+		// the prepared measure lives only in this call, therefore does not own this measure.
+		const PreparedTrajectoryMeasure prepared(
+			Ptr(Ptr(), const_cast<TrajectoryDistanceMeasureBase *>(this)));
+		return prepared.MeasureMatrix(
+			PreparedTrajectory::Prepare(data, LocalProjection::FromTrajectories(data)), oMatrix);
+	}
+}
+
+namespace
+{
+	// kernels may open their own parallel region only for large pairs outside of parallel regions
+	inline bool AllowInnerParallel(size_t threshold, size_t workload)
+	{
+#ifdef _OPENMP
+		return threshold > 0 && workload >= threshold && !omp_in_parallel();
+#else
+		return false;
+#endif
+	}
+
+	// all-pairs euclidean distances between rows of F by |a|^2 + |b|^2 - 2ab^T, one matrix product.
+	// if Fr(rows of reversed sequences) is given, min(D(F[i], F[j]), D(Fr[i], F[j])) for i < j,
+	// mirrored to j > i as ComputeDistanceMatrix does.
+	Eigen::MatrixXR RowDistanceMatrix(Eigen::MatrixXR F, Eigen::MatrixXR *Fr = nullptr)
+	{
+		using namespace Eigen;
+		// distances are translation invariant. centering reduces the cancellation error of the expansion.
+		const RowVectorXR mean = F.colwise().mean();
+		F.rowwise() -= mean;
+		const VectorXR sqNorm = F.rowwise().squaredNorm();
+
+		auto squaredDistances = [&F, &sqNorm](const MatrixXR &A)
+		{
+			MatrixXR re(A.rows(), F.rows());
+			re.noalias() = -2.0 * A * F.transpose();
+			re.colwise() += A.rowwise().squaredNorm();
+			re.rowwise() += sqNorm.transpose();
+			return re;
+		};
+
+		MatrixXR re = squaredDistances(F);
+		if (Fr)
 		{
-			return Measure_core(a, b);
+			Fr->rowwise() -= mean;
+			re = re.cwiseMin(squaredDistances(*Fr));
 		}
+		re.triangularView<StrictlyLower>() = re.transpose();
+		re.diagonal().setZero();
+		return re.cwiseMax(0).cwiseSqrt();
+	}
+
+	// EMD of Wasserstein library on 2D points in metre. R = 1, beta = 1: cost is the euclidean distance.
+	using TrajectoryEMDSolver = emd::EMDFloat64<emd::EuclideanEvent2D, emd::EuclideanDistance2D>;
+
+	// particles given in longitude/latitude, projected by proj
+	TrajectoryEMDSolver::Event ToEmdEvent(
+		const HashColon::Feline::TrajectoryClustering::TrajectoryEMD::ParticleSet &geo,
+		const HashColon::Feline::TrajectoryClustering::LocalProjection &proj)
+	{
+		vector<emd::EuclideanParticle2D<Real>> particles;
+		particles.reserve(geo.Weight.size());
+		for (Eigen::Index i = 0; i < geo.Weight.size(); i++)
+		{
+			XY p;
+			p.longitude = geo.Pos(i, 0);
+			p.latitude = geo.Pos(i, 1);
+			const Eigen::Vector2R v = proj.ToLocal(p);
+			particles.emplace_back(geo.Weight(i), v(0), v(1));
+		}
+		return TrajectoryEMDSolver::Event(particles);
+	}
+
+	// ground metric of a pair: both particle sets(longitude/latitude) projected around the middle of their centroids.
+	// depends on the pair only, so that every path measuring the pair gives the same value.
+	Real TrajectoryEMDOfPair(
+		const HashColon::Feline::TrajectoryClustering::TrajectoryEMD::ParticleSet &a,
+		const HashColon::Feline::TrajectoryClustering::TrajectoryEMD::ParticleSet &b)
+	{
+		// solver keeps its buffers per thread
+		thread_local TrajectoryEMDSolver solver(1, 1, true);
+
+		const Eigen::RowVector2R mid = (a.Weight.transpose() * a.Pos + b.Weight.transpose() * b.Pos) / 2;
+		XY base;
+		base.longitude = mid(0);
+		base.latitude = mid(1);
+		const HashColon::Feline::TrajectoryClustering::LocalProjection proj(base);
+		if (solver.compute(ToEmdEvent(a, proj), ToEmdEvent(b, proj)) != emd::EMDStatus::Success)
+			return numeric_limits<Real>::infinity();
+		return solver.emd();
 	}
 }
 
 // Measure methods
 namespace HashColon::Feline::TrajectoryClustering
 {
+	// order of points does not matter
 	Real Hausdorff::Measure_core(
 		const XYList &a,
-		const XYList &b) const
+		const XYList &b,
+		bool,
+		Real upperBound) const
 	{
-		Real maxdist = 0;
-#pragma omp parallel for
-		for (size_t i = 0; i < a.size(); i++)
+		const bool parallel = AllowInnerParallel(_c.InnerParallelThreshold, a.size() * b.size());
+
+		// random visiting order breaks the sequential correlation of trajectory points,
+		// so that early breaks happen soon
+		thread_local minstd_rand rng;
+		vector<size_t> &aOrder = ScratchBuffer<size_t, Hausdorff>::Get(0, a.size());
+		vector<size_t> &bOrder = ScratchBuffer<size_t, Hausdorff>::Get(1, b.size());
+		iota(aOrder.begin(), aOrder.end(), 0);
+		iota(bOrder.begin(), bOrder.end(), 0);
+		shuffle(aOrder.begin(), aOrder.end(), rng);
+		shuffle(bOrder.begin(), bOrder.end(), rng);
+
+		// directed distance h(from, to) given a known lower bound cmax of the result.
+		// search for the nearest point stops as soon as it cannot raise cmax.
+		// once cmax reaches upperBound, remaining points are skipped.
+		auto directed = [parallel, upperBound](
+							const XYList &from, const vector<size_t> &fromOrder,
+							const XYList &to, const vector<size_t> &toOrder, Real cmax)
 		{
-			Real mindist = numeric_limits<Real>::max();
-			for (size_t j = 0; j < b.size(); j++)
+			// distance from x to its nearest point of to, or any distance below cmax(cannot raise cmax)
+			auto nearest = [&to, &toOrder](const XY &x, Real cmax)
+			{
+				Real cmin = numeric_limits<Real>::max();
+				for (size_t jj = 0; jj < toOrder.size(); jj++)
+				{
+					Real d = x.DistanceTo(to[toOrder[jj]]);
+					if (d < cmax)
+						return d;
+					cmin = min(cmin, d);
+				}
+				return cmin;
+			};
+
+			if (!parallel)
 			{
-				Real tmpdist = a[i].DistanceTo(b[i]);
-				mindist = mindist > tmpdist ? tmpdist : mindist;
+				for (size_t ii = 0; ii < fromOrder.size() && cmax < upperBound; ii++)
+					cmax = max(cmax, nearest(from[fromOrder[ii]], cmax));
+				return cmax;
 			}
-#pragma omp critical
+
+			// private copies of a reduction start from the lowest value. seed them with the known bound.
+			const Real seed = cmax;
+#pragma omp parallel reduction(max : cmax)
 			{
-				maxdist = maxdist < mindist ? mindist : maxdist;
+				cmax = max(cmax, seed);
+#pragma omp for schedule(dynamic, 16)
+				for (size_t ii = 0; ii < fromOrder.size(); ii++)
+				{
+					if (cmax >= upperBound)
+						continue;
+					cmax = max(cmax, nearest(from[fromOrder[ii]], cmax));
+				}
 			}
-		}
-		return maxdist;
+			return cmax;
+		};
+
+		Real re = directed(a, aOrder, b, bOrder, 0);
+		if (re < upperBound)
+			re = directed(b, bOrder, a, aOrder, re);
+		return re < upperBound ? re : numeric_limits<Real>::infinity();
 	}
 
 	Real Euclidean::Measure_core(
 		const XYList &a,
-		const XYList &b) const
+		const XYList &b,
+		bool reversed,
+		Real upperBound) const
 	{
 		Real dist = 0;
-		const size_t &n = a.size() > b.size() ? a.size() : b.size();
-		size_t i_a, i_b;
+		const size_t n = a.size() > b.size() ? a.size() : b.size();
+		// partial sums only grow
+		const Real sumBound = (_c.Enable_RootMeanSquare ? upperBound * upperBound : upperBound) * (Real)n;
 
-#pragma omp parallel for reduction(+ \
-								   : dist)
 		for (size_t i = 0; i < n; i++)
 		{
-			i_a = i >= a.size() ? a.size() - 1 : i;
-			i_b = i >= b.size() ? b.size() - 1 : i;
-			dist += a[i_a].DistanceTo(b[i_b]);
+			const size_t i_a = i >= a.size() ? a.size() - 1 : i;
+			const size_t i_b = i >= b.size() ? b.size() - 1 : i;
+			const Real d = a[reversed ? a.size() - 1 - i_a : i_a].DistanceTo(b[i_b]);
+			dist += _c.Enable_RootMeanSquare ? d * d : d;
+			if (dist >= sumBound)
+				return numeric_limits<Real>::infinity();
 		}
 		dist /= (Real)n;
-		return dist;
+		return _c.Enable_RootMeanSquare ? sqrt(dist) : dist;
 	}
 
-	Real Merge::Measure_core(
-		const XYList &a,
-		const XYList &b) const
+	bool Euclidean::MeasureMatrix(
+		const vector<XYList> &data, Eigen::MatrixXR &oMatrix) const
 	{
-		vector<vector<Real>> A, B;
-		A.resize(a.size());
-		B.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
+		// mean of distances is not a norm of any feature vector, therefore no matrix product form.
+		if (!_c.Enable_ProjectedMatrix || !_c.Enable_RootMeanSquare || data.empty())
+			return TrajectoryDistanceMeasureBase::MeasureMatrix(data, oMatrix);
+		const size_t n = data[0].size();
+		for (const XYList &t : data)
+		{
+			if (t.size() != n || n == 0)
+				return TrajectoryDistanceMeasureBase::MeasureMatrix(data, oMatrix);
+		}
+
+		// trajectories as row vectors of local coordinates
+		const LocalProjection proj = LocalProjection::FromTrajectories(data);
+		Eigen::MatrixXR F(data.size(), 2 * n);
+		Eigen::MatrixXR Fr(_c.Enable_ReversedSequence ? data.size() : 0, 2 * n);
+#pragma omp parallel for
+		for (size_t i = 0; i < data.size(); i++)
 		{
-			A[i].resize(b.size());
-			B[i].resize(b.size());
+			for (size_t k = 0; k < n; k++)
+			{
+				F.block<1, 2>(i, 2 * k) = proj.ToLocal(data[i][k]).transpose();
+				if (_c.Enable_ReversedSequence)
+					Fr.block<1, 2>(i, 2 * (n - 1 - k)) = F.block<1, 2>(i, 2 * k);
+			}
 		}
 
+		oMatrix = RowDistanceMatrix(F, _c.Enable_ReversedSequence ? &Fr : nullptr) / sqrt((Real)n);
+		return true;
+	}
+
+	Real Merge::Measure_core(
+		const XYList &a,
+		const XYList &b,
+		bool reversed,
+		Real upperBound) const
+	{
+		// merge distance is symmetric, and so is reversing both trajectories.
+		// keep rows along the shorter trajectory: D(a.rev, b) == D(b.rev, a).
+		if (b.size() > a.size())
+			return Measure_core(b, a, reversed, upperBound);
+		auto A = [&a, reversed](size_t i) -> const XY &
+		{ return a[reversed ? a.size() - 1 - i : i]; };
+
+		// every merge path passes every row and its cost never decreases,
+		// therefore the minimum of a row bounds the result. needs whole lengths beforehand.
+		const Real rowBound = isinf(upperBound)
+								  ? upperBound
+								  : (upperBound + 1.0) * (a.GetLength() + b.GetLength()) / 2.0;
+
+		// rolling rows of A, B tables
+		vector<Real> &Aprev = ScratchBuffer<Real, Merge>::Get(0, b.size());
+		vector<Real> &Bprev = ScratchBuffer<Real, Merge>::Get(1, b.size());
+		vector<Real> &Acur = ScratchBuffer<Real, Merge>::Get(2, b.size());
+		vector<Real> &Bcur = ScratchBuffer<Real, Merge>::Get(3, b.size());
+
+		Real aLen = 0, bLen = 0;
 		for (size_t i = 0; i < a.size(); i++)
 		{
+			if (i > 0)
+				aLen += A(i - 1).DistanceTo(A(i));
+			bLen = 0;
+			Real rowMin = numeric_limits<Real>::infinity();
 			for (size_t j = 0; j < b.size(); j++)
 			{
+				if (j > 0)
+					bLen += b[j - 1].DistanceTo(b[j]);
+
 				if (i == 0)
-					A[i][j] = b.GetLength(0, j) + a[0].DistanceTo(b[j]);
+					Acur[j] = bLen + A(0).DistanceTo(b[j]);
 				else
-					A[i][j] = min(
-						A[i - 1][j] + a[i - 1].DistanceTo(a[i]),
-						B[i - 1][j] + b[j].DistanceTo(a[i]));
+					Acur[j] = min(
+						Aprev[j] + A(i - 1).DistanceTo(A(i)),
+						Bprev[j] + b[j].DistanceTo(A(i)));
 
 				if (j == 0)
-					B[i][j] = a.GetLength(0, i) + b[0].DistanceTo(a[i]);
+					Bcur[j] = aLen + b[0].DistanceTo(A(i));
+				else
+					Bcur[j] = min(
+						Acur[j - 1] + A(i).DistanceTo(b[j]),
+						Bcur[j - 1] + b[j - 1].DistanceTo(b[j]));
+				rowMin = min({rowMin, Acur[j], Bcur[j]});
+			}
+			if (rowMin >= rowBound)
+				return numeric_limits<Real>::infinity();
+			swap(Aprev, Acur);
+			swap(Bprev, Bcur);
+		}
+		// aLen, bLen are now the whole lengths of a, b
+		return 2.0 * min(Aprev[b.size() - 1], Bprev[b.size() - 1]) / (aLen + bLen) - 1.0;
+	}
+
+	Real DiscreteFrechet::Measure_core(
+		const XYList &a,
+		const XYList &b,
+		bool reversed,
+		Real upperBound) const
+	{
+		const size_t n = a.size();
+		auto A = [&a, reversed, n](size_t i) -> const XY &
+		{ return a[reversed ? n - 1 - i : i]; };
+
+		// every coupling couples the first points and the last points
+		if (max(A(0).DistanceTo(b.front()), A(n - 1).DistanceTo(b.back())) >= upperBound)
+			return numeric_limits<Real>::infinity();
+
+		// rolling rows of the coupling table
+		const size_t m = b.size();
+		vector<Real> &prev = ScratchBuffer<Real, DiscreteFrechet>::Get(0, m);
+		vector<Real> &cur = ScratchBuffer<Real, DiscreteFrechet>::Get(1, m);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			Real rowMin = numeric_limits<Real>::infinity();
+			for (size_t j = 0; j < m; j++)
+			{
+				Real reach;
+				if (i == 0)
+					reach = j == 0 ? 0 : cur[j - 1];
+				else if (j == 0)
+					reach = prev[0];
 				else
-					B[i][j] = min(
-						A[i][j - 1] + a[i].DistanceTo(b[j]),
-						B[i][j - 1] + b[j - 1].DistanceTo(b[j]));
+					reach = min({prev[j], prev[j - 1], cur[j - 1]});
+				cur[j] = max(reach, A(i).DistanceTo(b[j]));
+				rowMin = min(rowMin, cur[j]);
 			}
+			// every coupling passes every row
+			if (rowMin >= upperBound)
+				return numeric_limits<Real>::infinity();
+			swap(prev, cur);
 		}
-		return 2.0 * min(A[a.size() - 1][b.size() - 1], B[a.size() - 1][b.size() - 1]) / (a.GetLength() + b.GetLength()) - 1.0;
+		return prev[m - 1] < upperBound ? prev[m - 1] : numeric_limits<Real>::infinity();
+	}
+
+	Real DiscreteFrechet::MeasureBothDirections_core(
+		const XYList &a,
+		const XYList &b,
+		Real upperBound) const
+	{
+		const Real inf = numeric_limits<Real>::infinity();
+		const size_t n = a.size();
+		const size_t m = b.size();
+
+		// the reversed table is filled from its end cell: its row for a[i] follows the row for a[i - 1],
+		// and depends on the right cell. couplings are the same in either direction,
+		// therefore both tables take rows of a in the same order and share each row of distances.
+		bool forwardAlive = max(a.front().DistanceTo(b.front()), a.back().DistanceTo(b.back())) < upperBound;
+		bool reverseAlive = max(a.back().DistanceTo(b.front()), a.front().DistanceTo(b.back())) < upperBound;
+		if (!forwardAlive && !reverseAlive)
+			return inf;
+
+		vector<Real> &dist = ScratchBuffer<Real, DiscreteFrechet>::Get(0, m);
+		vector<Real> &prev = ScratchBuffer<Real, DiscreteFrechet>::Get(1, m);
+		vector<Real> &cur = ScratchBuffer<Real, DiscreteFrechet>::Get(2, m);
+		vector<Real> &rprev = ScratchBuffer<Real, DiscreteFrechet>::Get(3, m);
+		vector<Real> &rcur = ScratchBuffer<Real, DiscreteFrechet>::Get(4, m);
+
+		for (size_t i = 0; i < n && (forwardAlive || reverseAlive); i++)
+		{
+			for (size_t j = 0; j < m; j++)
+				dist[j] = a[i].DistanceTo(b[j]);
+
+			if (forwardAlive)
+			{
+				Real rowMin = inf;
+				for (size_t j = 0; j < m; j++)
+				{
+					Real reach;
+					if (i == 0)
+						reach = j == 0 ? 0 : cur[j - 1];
+					else if (j == 0)
+						reach = prev[0];
+					else
+						reach = min({prev[j], prev[j - 1], cur[j - 1]});
+					cur[j] = max(reach, dist[j]);
+					rowMin = min(rowMin, cur[j]);
+				}
+				// every coupling passes every row
+				forwardAlive = rowMin < upperBound;
+				swap(prev, cur);
+			}
+
+			if (reverseAlive)
+			{
+				Real rowMin = inf;
+				for (size_t j = m; j-- > 0;)
+				{
+					Real reach;
+					if (i == 0)
+						reach = j == m - 1 ? 0 : rcur[j + 1];
+					else if (j == m - 1)
+						reach = rprev[m - 1];
+					else
+						reach = min({rprev[j], rprev[j + 1], rcur[j + 1]});
+					rcur[j] = max(reach, dist[j]);
+					rowMin = min(rowMin, rcur[j]);
+				}
+				reverseAlive = rowMin < upperBound;
+				swap(rprev, rcur);
+			}
+		}
+
+		const Real re = min(forwardAlive ? prev[m - 1] : inf, reverseAlive ? rprev[0] : inf);
+		return re < upperBound ? re : inf;
+	}
+
+	bool DiscreteFrechet::IsWithin(
+		const XYList &a,
+		const XYList &b,
+		Real threshold) const
+	{
+		return IsWithin_core(a, b, false, threshold) ||
+			   (_c.Enable_ReversedSequence && IsWithin_core(a, b, true, threshold));
+	}
+
+	bool DiscreteFrechet::IsWithin_core(
+		const XYList &a,
+		const XYList &b,
+		bool reversed,
+		Real threshold) const
+	{
+		if (a.empty() || b.empty())
+			return false;
+		const size_t n = a.size();
+		auto A = [&a, reversed, n](size_t i) -> const XY &
+		{ return a[reversed ? n - 1 - i : i]; };
+		if (max(A(0).DistanceTo(b.front()), A(n - 1).DistanceTo(b.back())) >= threshold)
+			return false;
+
+		// free space: cells of distance < threshold. a cell is reachable if it is free and
+		// its left, lower or lower-left cell is reachable. rows keep reachable flags in [lo, hi] only.
+		const size_t m = b.size();
+		vector<char> &prev = ScratchBuffer<char, DiscreteFrechet>::Get(0, m);
+		vector<char> &cur = ScratchBuffer<char, DiscreteFrechet>::Get(1, m);
+
+		// first row: free prefix
+		size_t lo = 0, hi = 0;
+		cur[0] = 1;
+		while (hi + 1 < m && A(0).DistanceTo(b[hi + 1]) < threshold)
+			cur[++hi] = 1;
+		swap(prev, cur);
+
+		for (size_t i = 1; i < n; i++)
+		{
+			auto prevAt = [&prev, lo, hi](size_t j)
+			{ return j >= lo && j <= hi && prev[j]; };
+
+			size_t newLo = m, newHi = 0;
+			bool left = false;
+			// beyond hi + 1, cells are reachable only from the left
+			for (size_t j = lo; j < m && (left || j <= hi + 1); j++)
+			{
+				left = (left || prevAt(j) || (j > 0 && prevAt(j - 1))) && A(i).DistanceTo(b[j]) < threshold;
+				cur[j] = left;
+				if (left)
+				{
+					newLo = min(newLo, j);
+					newHi = j;
+				}
+			}
+			// no coupling passes this row
+			if (newLo == m)
+				return false;
+			lo = newLo;
+			hi = newHi;
+			swap(prev, cur);
+		}
+		return hi == m - 1;
 	}
 
 	Real LCSS::Measure_core(
 		const XYList &a,
-		const XYList &b) const
+		const XYList &b,
+		bool reversed,
+		Real upperBound) const
 	{
 		assert(a.size() > 1 && b.size() > 1);
 
-		size_t aN = a.size() + 1;
-		size_t bN = b.size() + 1;
+		// LCSS is symmetric. keep rows along the shorter trajectory, the reversed one may be either.
+		const bool swapped = b.size() > a.size();
+		const XYList &rowList = swapped ? b : a;
+		const XYList &colList = swapped ? a : b;
+		const size_t n = rowList.size();
+		const size_t m = colList.size();
+		const bool rowReversed = reversed && !swapped;
+		const bool colReversed = reversed && swapped;
+		auto A = [&rowList, rowReversed, n](size_t i) -> const XY &
+		{ return rowList[rowReversed ? n - 1 - i : i]; };
+		auto B = [&colList, colReversed, m](size_t j) -> const XY &
+		{ return colList[colReversed ? m - 1 - j : j]; };
+
+		const Real denominator = (Real)min(n + 1, m + 1);
+		// similarity: upperBound is the value to beat. each remaining row adds at most 1.
+		const Real lcssBound = isinf(upperBound) ? -numeric_limits<Real>::infinity() : upperBound * denominator;
+		if (_c.Delta < 0)
+			return 0 > lcssBound ? 0 : -numeric_limits<Real>::infinity();
+		// points can be matched only if their index difference is within delta.
+		// lcss[i][j] == lcss[i][i + w] for j > i + w and lcss[i][j] == lcss[j + w][j] for i > j + w,
+		// therefore only the band |i - j| <= w is filled.
+		const size_t w = (size_t)min(floor(_c.Delta), (Real)n);
 
-		// initialize dynamic programming table
-		vector<vector<Real>> lcss;
-		lcss.resize(aN);
-		for (size_t i = 0; i < aN; i++)
-			lcss[i].resize(bN);
+		// rolling rows of dynamic programming table. index 0 is the empty prefix.
+		vector<Real> &prev = ScratchBuffer<Real, LCSS>::Get(0, m + 1, 0);
+		vector<Real> &cur = ScratchBuffer<Real, LCSS>::Get(1, m + 1, 0);
 
-		for (size_t aend = 0; aend < aN; aend++)
+		const size_t iEnd = min(n, m + w);
+		for (size_t i = 1; i <= iEnd; i++)
 		{
-			for (size_t bend = 0; bend < bN; bend++)
+			const size_t jBegin = i > w ? i - w : 1;
+			const size_t jEnd = min(m, i + w);
+			Real rowMax = 0;
+			for (size_t j = jBegin; j <= jEnd; j++)
 			{
-				// if any of the index is 0, then 0.0
-				if (aend == 0 || bend == 0)
-					lcss[aend][bend] = 0;
-				// if distance btwn the end points is below Epsilon,
-				// end the index difference is less than given delta
-				else if (
-					(a[aend].DistanceTo(b[bend]) < _c.Epsilon) && ((Real)(aend > bend ? aend - bend : bend - aend) <= _c.Delta))
+				const Real diag = (i == 1 || j == 1) ? 0 : prev[j - 1];
+				if (A(i - 1).DistanceTo(B(j - 1)) < _c.Epsilon)
 				{
-					lcss[aend][bend] = 1.0 + lcss[aend - 1][bend - 1];
+					cur[j] = 1.0 + diag;
 				}
 				else
 				{
-					lcss[aend][bend] = max(lcss[aend - 1][bend], lcss[aend][bend - 1]);
+					// lcss[i - 1][j]: beyond the band of row (i - 1) equals its last band cell
+					const Real up = (i == 1) ? 0 : prev[min(j, i - 1 + w)];
+					// lcss[i][j - 1]: left of the band equals lcss[i - 1][j - 1]
+					const Real left = (j == 1) ? 0 : (j == jBegin ? prev[j - 1] : cur[j - 1]);
+					cur[j] = max(up, left);
 				}
+				rowMax = max(rowMax, cur[j]);
 			}
+			if (rowMax + (Real)(iEnd - i) <= lcssBound)
+				return -numeric_limits<Real>::infinity();
+			swap(prev, cur);
 		}
 
-		return lcss[a.size()][b.size()] / ((Real)min(aN, bN));
+		const Real re = prev[min(m, iEnd + w)];
+		return re > lcssBound ? re / denominator : -numeric_limits<Real>::infinity();
 	}
 
 	void TrajectoryDistanceMeasureBase::Initialize(const std::string configFilePath)
@@ -187,6 +637,25 @@ namespace HashColon::Feline::TrajectoryClustering
 
 		cli->add_option("--Enable_ReversedSequence", _cDefault.Enable_ReversedSequence,
 						"Computes sequence-invariant measure. Computes min(D(A,B), D(A.rev, B))");
+		cli->add_option("--InnerParallelThreshold", _cDefault.InnerParallelThreshold,
+						"Min. number of point pairs(n x m) of a single measurement to be parallelized inside the measure. 0: never");
+		cli->add_option("--Enable_PreparedKernel", _cDefault.Enable_PreparedKernel,
+						"Computes distance matrices by float kernels on trajectories prepared in a local projection. Approximate.");
+	}
+
+	void Euclidean::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.Euclidean");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--Enable_RootMeanSquare", _cDefault.Enable_RootMeanSquare,
+						"Use root mean square of point distances instead of mean.");
+		cli->add_option("--Enable_ProjectedMatrix", _cDefault.Enable_ProjectedMatrix,
+						"Computes all-pairs RMS distances by matrix product in one local projection. Approximate: differs from pairwise geodesic distances.");
 	}
 
 	void LCSS::Initialize(const std::string configFilePath)
@@ -204,6 +673,23 @@ namespace HashColon::Feline::TrajectoryClustering
 						"Max index difference between two comparing points in LCSS. Represented as delta.");
 	}
 
+	void DynamicTimeWarping::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.DynamicTimeWarping");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--Band", _cDefault.Band,
+						"Global constraint of warping path. 0: None, 1: Sakoe-Chiba band, 2: Itakura parallelogram");
+		cli->add_option("--BandRatio", _cDefault.BandRatio,
+						"Half width of Sakoe-Chiba band as a ratio to the longer trajectory length.");
+		cli->add_option("--ItakuraSlope", _cDefault.ItakuraSlope,
+						"Max slope of Itakura parallelogram. Should be larger than 1.");
+	}
+
 	void ProjectedPCA::Initialize(const std::string configFilePath)
 	{
 		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.ProjectedPCA");
@@ -220,14 +706,16 @@ namespace HashColon::Feline::TrajectoryClustering
 						"Set PCA dimension automatically. if true, PcaDimension is ignored.");
 	}
 
-	Eigen::VectorXR GetSingleDimensionVector(const XYList &t)
+	// t is read backward if reversed is true
+	Eigen::VectorXR GetSingleDimensionVector(const XYList &t, bool reversed = false)
 	{
 		Eigen::VectorXR re(t.size() * 2);
 
 		for (size_t i = 0; i < t.size(); i++)
 		{
-			re(2 * i) = t[i].longitude;
-			re(2 * i + 1) = t[i].latitude;
+			const XY &p = t[reversed ? t.size() - 1 - i : i];
+			re(2 * i) = p.longitude;
+			re(2 * i + 1) = p.latitude;
 		}
 		return re;
 	}
@@ -247,8 +735,8 @@ namespace HashColon::Feline::TrajectoryClustering
 			return;
 		}
 
-		MatrixXR E(vN, vN);
-		VectorXR mu(vN);
+		MatrixXR E = MatrixXR::Zero(vN, vN);
+		VectorXR mu = VectorXR::Zero(vN);
 
 		// compute E(x*x^T) & E(x)
 		for (size_t i = 0; i < trajlist.size(); i++)
@@ -285,13 +773,14 @@ namespace HashColon::Feline::TrajectoryClustering
 		_pca = eigenSolver.eigenvectors().rightCols(_c.PcaDimension).transpose();
 	}
 
+	// a few vector products. no early abandoning.
 	Real ProjectedPCA::Measure_core(
-		const XYList &a, const XYList &b) const
+		const XYList &a, const XYList &b, bool reversed, Real) const
 	{
 		assert(a.size() == b.size());
 		assert((size_t)_pca.cols() == a.size() * 2);
 
-		Eigen::VectorXR avec = GetSingleDimensionVector(a);
+		Eigen::VectorXR avec = GetSingleDimensionVector(a, reversed);
 		Eigen::VectorXR bvec = GetSingleDimensionVector(b);
 
 		avec = _pca * avec;
@@ -300,6 +789,39 @@ namespace HashColon::Feline::TrajectoryClustering
 		return (avec - bvec).norm();
 	}
 
+	bool ProjectedPCA::MeasureMatrix(
+		const vector<XYList> &data, Eigen::MatrixXR &oMatrix) const
+	{
+		const size_t n = (size_t)_pca.cols() / 2;
+		if (data.empty() || n == 0)
+			return false;
+		for (const XYList &t : data)
+		{
+			if (t.size() != n)
+				return false;
+		}
+
+		// trajectories as row vectors, projected to the reduced space by one product
+		Eigen::MatrixXR X(data.size(), 2 * n);
+		Eigen::MatrixXR Xr(_c.Enable_ReversedSequence ? data.size() : 0, 2 * n);
+#pragma omp parallel for
+		for (size_t i = 0; i < data.size(); i++)
+		{
+			X.row(i) = GetSingleDimensionVector(data[i]).transpose();
+			if (_c.Enable_ReversedSequence)
+				Xr.row(i) = GetSingleDimensionVector(data[i], true).transpose();
+		}
+
+		if (_c.Enable_ReversedSequence)
+		{
+			Eigen::MatrixXR Fr = Xr * _pca.transpose();
+			oMatrix = RowDistanceMatrix(X * _pca.transpose(), &Fr);
+		}
+		else
+			oMatrix = RowDistanceMatrix(X * _pca.transpose());
+		return true;
+	}
+
 	void ModifiedHausdorff::Initialize(const std::string configFilePath)
 	{
 		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.ModifiedHausdorff");
@@ -317,77 +839,378 @@ namespace HashColon::Feline::TrajectoryClustering
 	}
 
 	Real ModifiedHausdorff::Measure_core(
-		const XYList &a, const XYList &b) const
+		const XYList &a, const XYList &b, bool reversed, Real upperBound) const
 	{
 		assert(a.size() == b.size());
 		size_t N = a.size();
 		// compute parameters
 		// discretized w: _delta / discretized alpha: _rank
 		int delta = (int)(floor((Real)N * _c.NeighborhoodWindowSize));
-		size_t rank = (size_t)(round((Real)N * _c.InlierPortion));
-		vector<Real> dista, distb;
+		size_t rank = min((size_t)(round((Real)N * _c.InlierPortion)), N - 1);
 
-		// for each point in a(or b)
-		for (size_t i = 0; i < N; i++)
+		// i-th point of a, read backward if reversed
+		auto A = [&a, reversed, N](size_t i) -> const XY &
+		{ return a[reversed ? N - 1 - i : i]; };
+
+		// minimum distance from a[i] to b in the neighborhood N(a[i]) if aToB, from b[i] to a otherwise
+		auto neighborhoodMin = [&A, &b, delta, N](bool aToB, size_t i)
 		{
-			// compute minimum distance to b(or a) in the neighborhood N(a[i])(or N(b[i]))
-			double mina = numeric_limits<Real>::max();
-			double minb = numeric_limits<Real>::max();
+			Real re = numeric_limits<Real>::max();
 			for (int d = -delta; d <= delta; d++)
 			{
 				int j = (int)i + d;
-				if (j < 0)
+				if (j < 0 || j >= (int)N)
 					continue;
-				Real ab = a[i].DistanceTo(b[j]);
-				Real ba = b[i].DistanceTo(a[j]);
-				mina = mina > ab ? ab : mina;
-				minb = minb > ba ? ba : minb;
+				re = min(re, aToB ? A(i).DistanceTo(b[j]) : b[i].DistanceTo(A(j)));
 			}
-			dista.push_back(mina);
-			distb.push_back(minb);
+			return re;
+		};
+
+		// rank-th of a
+		vector<Real> &dista = ScratchBuffer<Real, ModifiedHausdorff>::Get(0, N);
+		for (size_t i = 0; i < N; i++)
+			dista[i] = neighborhoodMin(true, i);
+		nth_element(dista.begin(), dista.begin() + rank, dista.end());
+		const Real ra = dista[rank];
+
+		// result >= upperBound iff rank-th of b >= upperBound^2 / ra,
+		// i.e. at least (N - rank) values of b reach it.
+		const Real bBound = (isinf(upperBound) || ra <= 0) ? numeric_limits<Real>::infinity() : upperBound * upperBound / ra;
+		size_t reachCnt = 0;
+		vector<Real> &distb = ScratchBuffer<Real, ModifiedHausdorff>::Get(1, N);
+		for (size_t i = 0; i < N; i++)
+		{
+			distb[i] = neighborhoodMin(false, i);
+			if (distb[i] >= bBound && ++reachCnt >= N - rank)
+				return numeric_limits<Real>::infinity();
 		}
+		nth_element(distb.begin(), distb.begin() + rank, distb.end());
 
-		// get rank
-		sort(dista.begin(), dista.end());
-		sort(distb.begin(), distb.end());
+		return sqrt(ra * distb[rank]);
+	}
 
-		return sqrt(dista[rank] * distb[rank]);
+	vector<pair<size_t, size_t>> DynamicTimeWarping::GetBand(size_t n, size_t m) const
+	{
+		vector<pair<size_t, size_t>> re;
+		GetBand(n, m, re);
+		return re;
 	}
 
-	Real DynamicTimeWarping::Measure_core(
-		const XYList &a, const XYList &b) const
+	void DynamicTimeWarping::GetBand(size_t n, size_t m, vector<pair<size_t, size_t>> &re) const
 	{
-		vector<vector<Real>> warp;
+		re.assign(n, {0, m - 1});
+		if (_c.Band == DtwBand_None || n < 2 || m < 2)
+			return;
 
-		// initialize arrays
-		warp.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
-			warp[i].resize(b.size());
+		const Real slope = (Real)(m - 1) / (Real)(n - 1);
+		const Real maxSlope = max({_c.ItakuraSlope, slope, 1.0 / slope});
+		const Real halfWidth = _c.BandRatio * (Real)max(n, m);
+		for (size_t i = 0; i < n; i++)
+		{
+			Real lo, hi;
+			if (_c.Band == DtwBand_SakoeChiba)
+			{
+				lo = (Real)i * slope - halfWidth;
+				hi = (Real)i * slope + halfWidth;
+			}
+			else
+			{
+				const Real x = (Real)i / (Real)(n - 1);
+				lo = max(x / maxSlope, 1.0 - maxSlope * (1.0 - x)) * (Real)(m - 1);
+				hi = min(x * maxSlope, 1.0 - (1.0 - x) / maxSlope) * (Real)(m - 1);
+			}
+			re[i].first = (size_t)min(max(floor(lo), 0.0), (Real)(m - 1));
+			re[i].second = (size_t)min(max(ceil(hi), 0.0), (Real)(m - 1));
+		}
 
-		for (size_t i = 0; i < a.size(); i++)
+		// keep consecutive rows connected
+		re[0].first = 0;
+		re[n - 1].second = m - 1;
+		for (size_t i = 1; i < n; i++)
 		{
-			for (size_t j = 0; j < b.size(); j++)
+			re[i].first = min(re[i].first, re[i - 1].second + 1);
+			re[i].second = max(re[i].second, re[i].first);
+		}
+	}
+
+	Real DynamicTimeWarping::Measure_core(
+		const XYList &a, const XYList &b, bool reversed, Real upperBound) const
+	{
+		const size_t n = a.size();
+		const size_t m = b.size();
+		const Real inf = numeric_limits<Real>::infinity();
+		auto A = [&a, reversed, n](size_t i) -> const XY &
+		{ return a[reversed ? n - 1 - i : i]; };
+		// every warping path passes every row, and costs are non-negative.
+		// therefore the minimum of a row never decreases in the following rows.
+		const Real rowCutoff = upperBound * (Real)(n + m);
+		vector<pair<size_t, size_t>> &band = ScratchBuffer<pair<size_t, size_t>, DynamicTimeWarping>::Get(0, n);
+		GetBand(n, m, band);
+
+		// rolling rows. cells outside of the band remain infinity.
+		vector<Real> &prev = ScratchBuffer<Real, DynamicTimeWarping>::Get(0, m, inf);
+		vector<Real> &cur = ScratchBuffer<Real, DynamicTimeWarping>::Get(1, m, inf);
+		for (size_t i = 0; i < n; i++)
+		{
+			if (i >= 2)
+				fill(cur.begin() + band[i - 2].first, cur.begin() + band[i - 2].second + 1, inf);
+
+			Real rowMin = inf;
+			for (size_t j = band[i].first; j <= band[i].second; j++)
 			{
 				if (i == 0 && j == 0)
-					warp[i][j] = 0;
+					cur[j] = 0;
 				else
 				{
-					assert(!isnan(a[i].DistanceTo(b[j])));
-					warp[i][j] = a[i].DistanceTo(b[j]) + min({(i >= 1 ? warp[i - 1][j] : numeric_limits<Real>::max()),
-															  (j >= 1 ? warp[i][j - 1] : numeric_limits<Real>::max()),
-															  ((i >= 1 && j >= 1) ? warp[i - 1][j - 1] : numeric_limits<Real>::max())});
+					assert(!isnan(A(i).DistanceTo(b[j])));
+					cur[j] = A(i).DistanceTo(b[j]) + min({(i >= 1 ? prev[j] : inf),
+														  (j >= 1 ? cur[j - 1] : inf),
+														  ((i >= 1 && j >= 1) ? prev[j - 1] : inf)});
 				}
+				rowMin = min(rowMin, cur[j]);
 			}
+			if (rowMin > rowCutoff)
+				return inf;
+			swap(prev, cur);
+		}
+
+		return prev[m - 1] / (Real)(n + m);
+	}
+
+	Real DynamicTimeWarping::MeasureBothDirections_core(
+		const XYList &a, const XYList &b, Real upperBound) const
+	{
+		const size_t n = a.size();
+		const size_t m = b.size();
+		const Real inf = numeric_limits<Real>::infinity();
+		Real rowCutoff = upperBound * (Real)(n + m);
+		vector<pair<size_t, size_t>> &band = ScratchBuffer<pair<size_t, size_t>, DynamicTimeWarping>::Get(0, n);
+		GetBand(n, m, band);
+
+		// a warping path along the diagonal kept in the band is valid for both tables(band of the row k is band[k] in either).
+		// its cost bounds the result, so a direction exceeding it in a row is never the answer.
+		// diag[i]: first column of the path in row i. the path takes a diagonal step to the next row.
+		vector<size_t> &diag = ScratchBuffer<size_t, DynamicTimeWarping>::Get(0, n);
+		for (size_t i = 0; i < n; i++)
+		{
+			size_t t = (n < 2) ? 0 : (size_t)llround((Real)i * (Real)(m - 1) / (Real)(n - 1));
+			t = min(max(t, band[i].first), band[i].second);
+			diag[i] = (i == 0) ? 0 : max(t, diag[i - 1]);
 		}
+		Real forwardPath = 0, reversePath = 0;
+		for (size_t i = 0; i < n && !isinf(forwardPath); i++)
+		{
+			const size_t jEnd = (i + 1 < n) ? max(diag[i], diag[i + 1] - (diag[i + 1] > 0 ? 1 : 0)) : m - 1;
+			if (jEnd > band[i].second)
+			{
+				forwardPath = reversePath = inf;
+				break;
+			}
+			for (size_t j = diag[i]; j <= jEnd; j++)
+			{
+				if (i == 0 && j == 0)
+					continue;
+				forwardPath += a[i].DistanceTo(b[j]);
+				reversePath += a[n - 1 - i].DistanceTo(b[j]);
+			}
+		}
+		// the path may be the optimal one, summed in another order: margin for the rounding
+		rowCutoff = min(rowCutoff, min(forwardPath, reversePath) * (1 + numeric_limits<Real>::epsilon() * (Real)(n + m)));
+
+		// the table of reversed a is filled from its end cell(row of a[0], last column):
+		// row of a[i] follows the row of a[i - 1] and depends on the right cell.
+		// warping paths are the same in either direction, therefore both tables take rows of a
+		// in the same order and share each row of distances. band of the row of a[i] in the reversed table is band[n - 1 - i].
+		// as Measure_core, the start cell of each table(a[0]-b[0], a[n - 1]-b[0]) costs nothing.
+		vector<Real> &dist = ScratchBuffer<Real, DynamicTimeWarping>::Get(0, m, inf);
+		vector<Real> &prev = ScratchBuffer<Real, DynamicTimeWarping>::Get(1, m, inf);
+		vector<Real> &cur = ScratchBuffer<Real, DynamicTimeWarping>::Get(2, m, inf);
+		vector<Real> &rprev = ScratchBuffer<Real, DynamicTimeWarping>::Get(3, m, inf);
+		vector<Real> &rcur = ScratchBuffer<Real, DynamicTimeWarping>::Get(4, m, inf);
+		bool forwardAlive = true, reverseAlive = true;
+		for (size_t i = 0; i < n && (forwardAlive || reverseAlive); i++)
+		{
+			const pair<size_t, size_t> &fb = band[i];
+			const pair<size_t, size_t> &rb = band[n - 1 - i];
+
+			// distances of the columns either table needs
+			const size_t jBegin = forwardAlive ? (reverseAlive ? min(fb.first, rb.first) : fb.first) : rb.first;
+			const size_t jEnd = forwardAlive ? (reverseAlive ? max(fb.second, rb.second) : fb.second) : rb.second;
+			for (size_t j = jBegin; j <= jEnd; j++)
+			{
+				assert(!isnan(a[i].DistanceTo(b[j])));
+				dist[j] = a[i].DistanceTo(b[j]);
+			}
+
+			if (forwardAlive)
+			{
+				if (i >= 2)
+					fill(cur.begin() + band[i - 2].first, cur.begin() + band[i - 2].second + 1, inf);
+
+				Real rowMin = inf;
+				for (size_t j = fb.first; j <= fb.second; j++)
+				{
+					if (i == 0 && j == 0)
+						cur[j] = 0;
+					else
+						cur[j] = dist[j] + min({(i >= 1 ? prev[j] : inf),
+												(j >= 1 ? cur[j - 1] : inf),
+												((i >= 1 && j >= 1) ? prev[j - 1] : inf)});
+					rowMin = min(rowMin, cur[j]);
+				}
+				forwardAlive = rowMin <= rowCutoff;
+				swap(prev, cur);
+			}
+
+			if (reverseAlive)
+			{
+				if (i >= 2)
+					fill(rcur.begin() + band[n + 1 - i].first, rcur.begin() + band[n + 1 - i].second + 1, inf);
+
+				Real rowMin = inf;
+				for (size_t j = rb.second + 1; j-- > rb.first;)
+				{
+					const Real cost = (i == n - 1 && j == 0) ? 0 : dist[j];
+					if (i == 0 && j == m - 1)
+						rcur[j] = cost;
+					else
+						rcur[j] = cost + min({(i >= 1 ? rprev[j] : inf),
+											  (j + 1 < m ? rcur[j + 1] : inf),
+											  ((i >= 1 && j + 1 < m) ? rprev[j + 1] : inf)});
+					rowMin = min(rowMin, rcur[j]);
+				}
+				reverseAlive = rowMin <= rowCutoff;
+				swap(rprev, rcur);
+			}
+		}
+
+		Real re = inf;
+		if (forwardAlive)
+			re = min(re, prev[m - 1] / (Real)(n + m));
+		if (reverseAlive)
+			re = min(re, rprev[0] / (Real)(n + m));
+		return re;
+	}
+
+	void TrajectoryEMD::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.TrajectoryEMD");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--ParticleWeight", _cDefault.ParticleWeight,
+						"Weight of waypoints. 0: Uniform(dwell time of uniformly time-sampled trajectories), 1: Segment length");
+		cli->add_option("--MaxParticleNumber", _cDefault.MaxParticleNumber,
+						"Max. number of particles of a trajectory. Consecutive waypoints are merged to their weighted centroid. 0: no limit");
+	}
+
+	TrajectoryEMD::ParticleSet TrajectoryEMD::GetParticles(const XYList &traj, const LocalProjection &proj) const
+	{
+		const size_t n = traj.size();
+		Eigen::MatrixX2R pos(n, 2);
+		for (size_t i = 0; i < n; i++)
+			pos.row(i) = proj.ToLocal(traj[i]).transpose();
+
+		// half of each adjacent segment belongs to a waypoint
+		Eigen::VectorXR w = Eigen::VectorXR::Ones(n);
+		if (_c.ParticleWeight == ParticleWeight_SegmentLength && n > 1)
+		{
+			const Eigen::VectorXR segLen = (pos.bottomRows(n - 1) - pos.topRows(n - 1)).rowwise().norm();
+			w.setZero();
+			w.head(n - 1) += segLen / 2;
+			w.tail(n - 1) += segLen / 2;
+			// stationary trajectory
+			if (w.sum() <= 0)
+				w.setOnes();
+		}
+		w /= w.sum();
+
+		ParticleSet re;
+		const size_t k = _c.MaxParticleNumber;
+		if (k == 0 || n <= k)
+		{
+			re.Pos = move(pos);
+			re.Weight = move(w);
+			return re;
+		}
+
+		// bin of a waypoint by the cumulative weight at its center, so that bins hold consecutive waypoints of equal weight
+		re.Pos = Eigen::MatrixX2R::Zero(k, 2);
+		re.Weight = Eigen::VectorXR::Zero(k);
+		Real cum = 0;
+		for (size_t i = 0; i < n; i++)
+		{
+			const size_t bin = min(k - 1, (size_t)((cum + w(i) / 2) * (Real)k));
+			re.Pos.row(bin) += w(i) * pos.row(i);
+			re.Weight(bin) += w(i);
+			cum += w(i);
+		}
+
+		// drop empty bins(possible with zero-length segments), others to their weighted centroid
+		size_t cnt = 0;
+		for (size_t b = 0; b < k; b++)
+		{
+			if (re.Weight(b) <= 0)
+				continue;
+			re.Pos.row(cnt) = re.Pos.row(b) / re.Weight(b);
+			re.Weight(cnt) = re.Weight(b);
+			cnt++;
+		}
+		re.Pos.conservativeResize(cnt, 2);
+		re.Weight.conservativeResize(cnt);
+		return re;
+	}
+
+	TrajectoryEMD::ParticleSet TrajectoryEMD::GetGeoParticles(const XYList &traj) const
+	{
+		const LocalProjection proj = LocalProjection::FromTrajectories({traj});
+		ParticleSet re = GetParticles(traj, proj);
+		for (Eigen::Index i = 0; i < re.Pos.rows(); i++)
+		{
+			const XY p = proj.ToGeo(re.Pos.row(i).transpose());
+			re.Pos(i, 0) = p.longitude;
+			re.Pos(i, 1) = p.latitude;
+		}
+		return re;
+	}
+
+	Real TrajectoryEMD::Measure_core(
+		const XYList &a,
+		const XYList &b,
+		bool,
+		Real) const
+	{
+		return TrajectoryEMDOfPair(GetGeoParticles(a), GetGeoParticles(b));
+	}
+
+	bool TrajectoryEMD::MeasureMatrix(
+		const vector<XYList> &data, Eigen::MatrixXR &oMatrix) const
+	{
+		vector<ParticleSet> particles(data.size());
+#pragma omp parallel for
+		for (size_t i = 0; i < data.size(); i++)
+			particles[i] = GetGeoParticles(data[i]);
 
-		return warp[a.size() - 1][b.size() - 1] / (Real)(a.size() + b.size());
+		// row i is measured against (i+1 ~ l-1), rows have different lengths
+		oMatrix = Eigen::MatrixXR::Zero(data.size(), data.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < data.size(); i++)
+			for (size_t j = i + 1; j < data.size(); j++)
+				oMatrix(i, j) = oMatrix(j, i) = TrajectoryEMDOfPair(particles[i], particles[j]);
+		return true;
 	}
 
 	void Initialize_All_TrajectoryDistanceMeasure()
 	{
 		TrajectoryDistanceMeasureBase::Initialize();
+		Euclidean::Initialize();
 		LCSS::Initialize();
 		ProjectedPCA::Initialize();
 		ModifiedHausdorff::Initialize();
+		DynamicTimeWarping::Initialize();
+		TrajectoryEMD::Initialize();
 	}
 }
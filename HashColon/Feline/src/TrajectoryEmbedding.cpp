@@ -0,0 +1,283 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/HNSW.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/TrajectoryEmbedding.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace HashColon;
+using namespace HashColon::Feline;
+
+namespace
+{
+	const char EmbeddingIndexMagic[8] = {'H', 'C', 'T', 'E', 'M', 'B', '0', '1'};
+
+	template <typename T>
+	void WriteBinary(ostream &os, const T &v) { os.write(reinterpret_cast<const char *>(&v), sizeof(T)); }
+
+	template <typename T>
+	void ReadBinary(istream &is, T &v) { is.read(reinterpret_cast<char *>(&v), sizeof(T)); }
+}
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	TrajectoryEmbedding::TrajectoryEmbedding(_Params params)
+		: _c(params)
+	{
+		if (_c.SampleNumber < 2)
+			throw Exception("SampleNumber should be at least 2.");
+	}
+
+	void TrajectoryEmbedding::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryEmbedding");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--SampleNumber", _cDefault.SampleNumber,
+						"Number of points sampled in uniform length for the coordinate part. At least 2.");
+		cli->add_option("--HeadingBins", _cDefault.HeadingBins,
+						"Number of circular bins of the heading histogram. 0 disables the heading part.");
+		cli->add_option("--CoordinateWeight", _cDefault.CoordinateWeight, "Weight of the coordinate part.");
+		cli->add_option("--HeadingWeight", _cDefault.HeadingWeight, "Weight of the heading histogram part.");
+		cli->add_option("--XtdWeight", _cDefault.XtdWeight, "Weight of the XTD summary part. Used for XYXtdList only.");
+	}
+
+	void TrajectoryEmbedding::Fit(const vector<XYList> &trajlist)
+	{
+		_proj = LocalProjection::FromTrajectories(trajlist);
+
+		Real sq = 0;
+		size_t cnt = 0;
+		for (const XYList &traj : trajlist)
+			for (const XY &p : traj)
+			{
+				sq += _proj.ToLocal(p).squaredNorm();
+				cnt++;
+			}
+		_scale = (cnt > 0 && sq > 0) ? sqrt(sq / (Real)cnt) : 1;
+	}
+
+	void TrajectoryEmbedding::Fit(const vector<XYXtdList> &trajlist)
+	{
+		vector<XYList> shapes(trajlist.size());
+		for (size_t i = 0; i < trajlist.size(); i++)
+			shapes[i] = trajlist[i].ToXYList();
+		Fit(shapes);
+	}
+
+	void TrajectoryEmbedding::SetFrame(const XY &base, Real scale)
+	{
+		if (!(scale > 0))
+			throw Exception("scale should be positive.");
+		_proj = LocalProjection(base);
+		_scale = scale;
+	}
+
+	void TrajectoryEmbedding::EmbedShape(const XYList &traj, Ref<VectorXR> oVec) const
+	{
+		if (traj.size() < 2)
+			throw Exception("trajectory should have at least 2 points.");
+
+		// coordinates
+		const XYList sampled = traj.GetUniformLengthSampled(_c.SampleNumber);
+		const Real coordMult = _c.CoordinateWeight / sqrt((Real)_c.SampleNumber) / _scale;
+		for (size_t i = 0; i < _c.SampleNumber; i++)
+			oVec.segment<2>(2 * i) = _proj.ToLocal(sampled[i]) * coordMult;
+
+		// heading histogram. each segment is split between two nearest bins(linear interpolation)
+		// so that a small change of heading changes the vector a little.
+		if (_c.HeadingBins == 0)
+			return;
+		auto hist = oVec.segment(2 * _c.SampleNumber, _c.HeadingBins);
+		hist.setZero();
+		const Real binWidth = 2 * Constant::PI / (Real)_c.HeadingBins;
+		Real total = 0;
+		Vector2R prev = _proj.ToLocal(traj[0]);
+		for (size_t i = 1; i < traj.size(); i++)
+		{
+			const Vector2R cur = _proj.ToLocal(traj[i]);
+			const Vector2R d = cur - prev;
+			prev = cur;
+			const Real len = d.norm();
+			if (len <= 0)
+				continue;
+
+			// clockwise from north, in [0, 2 pi)
+			Real heading = atan2(d(0), d(1));
+			if (heading < 0)
+				heading += 2 * Constant::PI;
+			const Real pos = heading / binWidth - 0.5;
+			const Real lo = floor(pos);
+			const Real frac = pos - lo;
+			const size_t bLo = (size_t)(((long long)lo % (long long)_c.HeadingBins + (long long)_c.HeadingBins) % (long long)_c.HeadingBins);
+			const size_t bHi = (bLo + 1) % _c.HeadingBins;
+			hist(bLo) += len * (1 - frac);
+			hist(bHi) += len * frac;
+			total += len;
+		}
+		if (total > 0)
+			hist *= _c.HeadingWeight / total;
+	}
+
+	VectorXR TrajectoryEmbedding::Embed(const XYList &traj) const
+	{
+		VectorXR re(GetDimension(false));
+		EmbedShape(traj, re);
+		return re;
+	}
+
+	VectorXR TrajectoryEmbedding::Embed(const XYXtdList &traj) const
+	{
+		VectorXR re(GetDimension(true));
+		EmbedShape(traj.ToXYList(), re.head(GetDimension(false)));
+
+		// mean and max of portside and starboard XTD
+		Vector2R sum = Vector2R::Zero();
+		Vector2R maxXtd = Vector2R::Zero();
+		for (const XYXtd &p : traj)
+		{
+			const Vector2R x(p.Xtd.xtdPortside, p.Xtd.xtdStarboard);
+			sum += x;
+			maxXtd = maxXtd.cwiseMax(x);
+		}
+		const Real mult = _c.XtdWeight / _scale;
+		re.tail<4>() << sum * (mult / (Real)traj.size()), maxXtd * mult;
+		return re;
+	}
+
+	MatrixXR TrajectoryEmbedding::Embed(const vector<XYList> &trajlist) const
+	{
+		MatrixXR re(trajlist.size(), GetDimension(false));
+#pragma omp parallel for
+		for (size_t i = 0; i < trajlist.size(); i++)
+			re.row(i) = Embed(trajlist[i]).transpose();
+		return re;
+	}
+
+	MatrixXR TrajectoryEmbedding::Embed(const vector<XYXtdList> &trajlist) const
+	{
+		MatrixXR re(trajlist.size(), GetDimension(true));
+#pragma omp parallel for
+		for (size_t i = 0; i < trajlist.size(); i++)
+			re.row(i) = Embed(trajlist[i]).transpose();
+		return re;
+	}
+
+	TrajectoryEmbeddingIndex::TrajectoryEmbeddingIndex(
+		TrajectoryEmbedding::_Params embeddingParams, HNSW::_Params indexParams)
+		: _embedding(embeddingParams),
+		  _index(make_shared<HNSW>(_embedding.GetDimension(false), indexParams))
+	{
+	}
+
+	void TrajectoryEmbeddingIndex::BuildIndex(const vector<XYList> &trajlist)
+	{
+		_embedding.Fit(trajlist);
+		_withXtd = false;
+		_index = make_shared<HNSW>(_embedding.GetDimension(false), _index->GetParams());
+		_index->Build(_embedding.Embed(trajlist));
+	}
+
+	void TrajectoryEmbeddingIndex::BuildIndex(const vector<XYXtdList> &trajlist)
+	{
+		_embedding.Fit(trajlist);
+		_withXtd = true;
+		_index = make_shared<HNSW>(_embedding.GetDimension(true), _index->GetParams());
+		_index->Build(_embedding.Embed(trajlist));
+	}
+
+	HNSW::ResultList TrajectoryEmbeddingIndex::GetCandidates(const XYList &query, size_t k) const
+	{
+		if (_withXtd)
+			throw Exception("the index is built with XTD. query should be XYXtdList.");
+		return _index->Search(_embedding.Embed(query), k);
+	}
+
+	HNSW::ResultList TrajectoryEmbeddingIndex::GetCandidates(const XYXtdList &query, size_t k) const
+	{
+		if (!_withXtd)
+			throw Exception("the index is built without XTD. query should be XYList.");
+		return _index->Search(_embedding.Embed(query), k);
+	}
+
+	void TrajectoryEmbeddingIndex::Save(const string filepath) const
+	{
+		ofstream ofs(filepath, ios::binary);
+		if (!ofs.is_open())
+			throw Exception("Invalid output file path: " + filepath);
+
+		const TrajectoryEmbedding::_Params p = _embedding.GetParams();
+		ofs.write(EmbeddingIndexMagic, sizeof(EmbeddingIndexMagic));
+		WriteBinary(ofs, (uint64_t)p.SampleNumber);
+		WriteBinary(ofs, (uint64_t)p.HeadingBins);
+		WriteBinary(ofs, (double)p.CoordinateWeight);
+		WriteBinary(ofs, (double)p.HeadingWeight);
+		WriteBinary(ofs, (double)p.XtdWeight);
+		WriteBinary(ofs, (double)_embedding.GetProjection().Base.longitude);
+		WriteBinary(ofs, (double)_embedding.GetProjection().Base.latitude);
+		WriteBinary(ofs, (double)_embedding.GetScale());
+		WriteBinary(ofs, (uint8_t)_withXtd);
+		_index->Save(ofs);
+	}
+
+	void TrajectoryEmbeddingIndex::Load(const string filepath)
+	{
+		ifstream ifs(filepath, ios::binary);
+		if (!ifs.is_open())
+			throw Exception("Invalid input file path: " + filepath);
+
+		char magic[sizeof(EmbeddingIndexMagic)];
+		ifs.read(magic, sizeof(magic));
+		if (!ifs || memcmp(magic, EmbeddingIndexMagic, sizeof(EmbeddingIndexMagic)) != 0)
+			throw Exception("not a trajectory embedding index file: " + filepath);
+
+		uint64_t sampleNumber, headingBins;
+		double coordW, headingW, xtdW, baseLon, baseLat, scale;
+		uint8_t withXtd;
+		ReadBinary(ifs, sampleNumber);
+		ReadBinary(ifs, headingBins);
+		ReadBinary(ifs, coordW);
+		ReadBinary(ifs, headingW);
+		ReadBinary(ifs, xtdW);
+		ReadBinary(ifs, baseLon);
+		ReadBinary(ifs, baseLat);
+		ReadBinary(ifs, scale);
+		ReadBinary(ifs, withXtd);
+		if (!ifs)
+			throw Exception("failed to read the index file: " + filepath);
+
+		TrajectoryEmbedding embedding({(size_t)sampleNumber, (size_t)headingBins, coordW, headingW, xtdW});
+		XY base;
+		base.longitude = baseLon;
+		base.latitude = baseLat;
+		embedding.SetFrame(base, scale);
+		// load into a separate graph so that a rejected file leaves this index untouched
+		auto index = make_shared<HNSW>(embedding.GetDimension(withXtd != 0), _index->GetParams());
+		index->Load(ifs);
+		if (index->GetDimension() != embedding.GetDimension(withXtd != 0))
+			throw Exception("dimension of the index does not match with the embedding: " + filepath);
+		_index = index;
+		_embedding = embedding;
+		_withXtd = withXtd != 0;
+	}
+}
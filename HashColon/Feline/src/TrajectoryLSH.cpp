@@ -0,0 +1,243 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+// header file for this source file
+#include <HashColon/Feline/TrajectoryLSH.hpp>
+
+using namespace std;
+using namespace HashColon;
+using namespace HashColon::Feline;
+
+namespace
+{
+	// splitmix64 finalizer: fast 64-bit mixing function
+	inline uint64_t Mix64(uint64_t x)
+	{
+		x += 0x9e3779b97f4a7c15ULL;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+}
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	TrajectoryLSH::TrajectoryLSH(_Params params)
+		: _c(params)
+	{
+		if (_c.GeohashPrecision < 1 || _c.GeohashPrecision > 12)
+			throw Exception("GeohashPrecision should be in [1, 12].");
+		if (_c.NumOfBands == 0 || _c.RowsPerBand == 0)
+			throw Exception("NumOfBands and RowsPerBand should be positive.");
+
+		mt19937_64 rng(_c.Seed);
+		_hashSeeds.resize(_c.NumOfBands * _c.RowsPerBand);
+		for (auto &s : _hashSeeds)
+			s = rng();
+	}
+
+	void TrajectoryLSH::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryLSH");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--GeohashPrecision", _cDefault.GeohashPrecision,
+						"Number of geohash characters for cells. 1..12 (e.g. 5: ~4.9km x 4.9km, 6: ~1.2km x 0.6km)");
+		cli->add_option("--Enable_CellTransitions", _cDefault.Enable_CellTransitions,
+						"Use transitions between consecutive cells as tokens instead of cells. Direction-sensitive.");
+		cli->add_option("--NumOfBands", _cDefault.NumOfBands, "Number of LSH bands.");
+		cli->add_option("--RowsPerBand", _cDefault.RowsPerBand, "Number of MinHash values in each LSH band.");
+		cli->add_option("--Seed", _cDefault.Seed, "Random seed for MinHash functions.");
+	}
+
+	uint64_t TrajectoryLSH::GeohashEncode(const XY &pos, size_t precision)
+	{
+		assert(precision >= 1 && precision <= 12);
+		Real lonLo = -180, lonHi = 180;
+		Real latLo = -90, latHi = 90;
+		uint64_t code = 0;
+		for (size_t b = 0; b < precision * 5; b++)
+		{
+			// even bits: longitude, odd bits: latitude
+			Real &lo = (b % 2 == 0) ? lonLo : latLo;
+			Real &hi = (b % 2 == 0) ? lonHi : latHi;
+			const Real v = (b % 2 == 0) ? pos.longitude : pos.latitude;
+			const Real mid = (lo + hi) / 2;
+			code <<= 1;
+			if (v >= mid)
+			{
+				code |= 1;
+				lo = mid;
+			}
+			else
+				hi = mid;
+		}
+		return code;
+	}
+
+	string TrajectoryLSH::GeohashToString(uint64_t code, size_t precision)
+	{
+		static const char base32[] = "0123456789bcdefghjkmnpqrstuvwxyz";
+		string re(precision, '0');
+		for (size_t i = 0; i < precision; i++)
+			re[precision - 1 - i] = base32[(code >> (5 * i)) & 0x1f];
+		return re;
+	}
+
+	vector<uint64_t> TrajectoryLSH::GetTokens(const XYList &traj) const
+	{
+		const size_t bits = _c.GeohashPrecision * 5;
+		const Real cellW = 360.0 / pow(2.0, (Real)((bits + 1) / 2));
+		const Real cellH = 180.0 / pow(2.0, (Real)(bits / 2));
+
+		// sequence of visited cells. segments are densified so that no cell is skipped.
+		vector<uint64_t> cells;
+		for (size_t k = 0; k < traj.size(); k++)
+		{
+			if (k == 0)
+			{
+				cells.push_back(GeohashEncode(traj[0], _c.GeohashPrecision));
+				continue;
+			}
+			const Real dlon = traj[k].longitude - traj[k - 1].longitude;
+			const Real dlat = traj[k].latitude - traj[k - 1].latitude;
+			const size_t steps = max((size_t)1, (size_t)ceil(2.0 * max(fabs(dlon) / cellW, fabs(dlat) / cellH)));
+			for (size_t s = 1; s <= steps; s++)
+			{
+				XY p;
+				p.longitude = traj[k - 1].longitude + dlon * (Real)s / (Real)steps;
+				p.latitude = traj[k - 1].latitude + dlat * (Real)s / (Real)steps;
+				uint64_t c = GeohashEncode(p, _c.GeohashPrecision);
+				if (c != cells.back())
+					cells.push_back(c);
+			}
+		}
+
+		vector<uint64_t> re;
+		if (_c.Enable_CellTransitions && cells.size() > 1)
+		{
+			for (size_t k = 1; k < cells.size(); k++)
+				re.push_back(Mix64(cells[k - 1]) ^ cells[k]);
+		}
+		else
+			re = move(cells);
+
+		sort(re.begin(), re.end());
+		re.erase(unique(re.begin(), re.end()), re.end());
+		return re;
+	}
+
+	TrajectoryLSH::Signature TrajectoryLSH::GetSignature(const XYList &traj) const
+	{
+		vector<uint64_t> tokens = GetTokens(traj);
+		Signature re(_hashSeeds.size(), numeric_limits<uint64_t>::max());
+		for (const uint64_t &t : tokens)
+		{
+			for (size_t k = 0; k < _hashSeeds.size(); k++)
+				re[k] = min(re[k], Mix64(t ^ _hashSeeds[k]));
+		}
+		return re;
+	}
+
+	Real TrajectoryLSH::EstimateJaccard(const Signature &a, const Signature &b)
+	{
+		assert(a.size() == b.size());
+		if (a.empty())
+			return 0;
+		size_t same = 0;
+		for (size_t k = 0; k < a.size(); k++)
+			same += (a[k] == b[k]) ? 1 : 0;
+		return (Real)same / (Real)a.size();
+	}
+
+	uint64_t TrajectoryLSH::GetBandKey(const Signature &sig, size_t band) const
+	{
+		uint64_t key = band;
+		for (size_t r = 0; r < _c.RowsPerBand; r++)
+			key = Mix64(key ^ sig[band * _c.RowsPerBand + r]);
+		return key;
+	}
+
+	void TrajectoryLSH::BuildIndex(const vector<XYList> &trajlist)
+	{
+		_signatures.clear();
+		_signatures.resize(trajlist.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < trajlist.size(); i++)
+			_signatures[i] = GetSignature(trajlist[i]);
+
+		_bandTables.clear();
+		_bandTables.resize(_c.NumOfBands);
+#pragma omp parallel for
+		for (size_t b = 0; b < _c.NumOfBands; b++)
+		{
+			for (size_t i = 0; i < _signatures.size(); i++)
+				_bandTables[b][GetBandKey(_signatures[i], b)].push_back(i);
+		}
+	}
+
+	TrajectoryLSH::PairList TrajectoryLSH::GetCandidatePairs() const
+	{
+		// pairs are packed into 64 bits, 32 bits for each index
+		if (size() > (size_t)numeric_limits<uint32_t>::max())
+			throw Exception("too many items.");
+
+		vector<vector<uint64_t>> bandPairs(_c.NumOfBands);
+#pragma omp parallel for
+		for (size_t b = 0; b < _c.NumOfBands; b++)
+		{
+			for (const auto &bucket : _bandTables[b])
+			{
+				const vector<size_t> &m = bucket.second;
+				for (size_t i = 0; i < m.size(); i++)
+					for (size_t j = i + 1; j < m.size(); j++)
+						bandPairs[b].push_back(((uint64_t)m[i] << 32) | (uint64_t)m[j]);
+			}
+		}
+
+		vector<uint64_t> all;
+		for (auto &p : bandPairs)
+			all.insert(all.end(), p.begin(), p.end());
+		sort(all.begin(), all.end());
+		all.erase(unique(all.begin(), all.end()), all.end());
+
+		PairList re(all.size());
+		for (size_t p = 0; p < all.size(); p++)
+			re[p] = {(size_t)(all[p] >> 32), (size_t)(all[p] & 0xffffffffULL)};
+		return re;
+	}
+
+	vector<size_t> TrajectoryLSH::GetCandidates(const XYList &query) const
+	{
+		Signature sig = GetSignature(query);
+		vector<size_t> re;
+		for (size_t b = 0; b < _c.NumOfBands; b++)
+		{
+			auto it = _bandTables[b].find(GetBandKey(sig, b));
+			if (it != _bandTables[b].end())
+				re.insert(re.end(), it->second.begin(), it->second.end());
+		}
+		sort(re.begin(), re.end());
+		re.erase(unique(re.begin(), re.end()), re.end());
+		return re;
+	}
+}
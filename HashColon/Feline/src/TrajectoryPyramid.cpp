@@ -0,0 +1,317 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stack>
+#include <utility>
+#include <vector>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+#include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+// header file for this source file
+#include <HashColon/Feline/TrajectoryPyramid.hpp>
+
+using namespace std;
+using namespace HashColon;
+using namespace HashColon::Clustering;
+using namespace HashColon::Feline;
+
+// pyramid construction
+namespace
+{
+	// Douglas-Peucker simplification returning indices of kept points
+	vector<size_t> DouglasPeuckerIndices(const XYList &traj, Real tolerance)
+	{
+		const size_t n = traj.size();
+		vector<bool> keep(n, false);
+		keep[0] = keep[n - 1] = true;
+
+		stack<pair<size_t, size_t>> st;
+		st.push({0, n - 1});
+		while (!st.empty())
+		{
+			auto [s, e] = st.top();
+			st.pop();
+			if (e - s < 2)
+				continue;
+
+			Real maxDist = 0;
+			size_t maxIdx = s;
+			for (size_t i = s + 1; i < e; i++)
+			{
+				Real d = fabs(traj[i].CrossTrackDistanceTo(traj[s], traj[e]));
+				if (d > maxDist)
+				{
+					maxDist = d;
+					maxIdx = i;
+				}
+			}
+
+			if (maxDist > tolerance)
+			{
+				keep[maxIdx] = true;
+				st.push({s, maxIdx});
+				st.push({maxIdx, e});
+			}
+		}
+
+		vector<size_t> re;
+		for (size_t i = 0; i < n; i++)
+			if (keep[i])
+				re.push_back(i);
+		return re;
+	}
+
+	// Discrete Frechet distance between a trajectory and its subsequence given by kept indices.
+	// Between two consecutive kept points s, e, the removed points s+1..t are coupled to s
+	// and t+1..e-1 are coupled to e. The best split t is chosen for each gap.
+	Real SubsequenceCouplingError(const XYList &traj, const vector<size_t> &kept)
+	{
+		Real re = 0;
+		vector<Real> suffix;
+		for (size_t k = 1; k < kept.size(); k++)
+		{
+			const size_t s = kept[k - 1];
+			const size_t e = kept[k];
+			if (e - s < 2)
+				continue;
+
+			// suffix[t - s]: max distance from points t+1..e-1 to e
+			suffix.assign(e - s, 0);
+			for (size_t t = e - 1; t > s; t--)
+				suffix[t - 1 - s] = max(suffix[t - s], traj[t].DistanceTo(traj[e]));
+
+			// prefix: max distance from points s+1..t to s
+			Real prefix = 0;
+			Real best = suffix[0];
+			for (size_t t = s + 1; t < e; t++)
+			{
+				prefix = max(prefix, traj[t].DistanceTo(traj[s]));
+				best = min(best, max(prefix, suffix[t - s]));
+			}
+			re = max(re, best);
+		}
+		return re;
+	}
+}
+
+namespace HashColon::Feline::TrajectoryClustering
+{
+	CoarseToFineMeasure::CoarseToFineMeasure(TrajectoryDistanceMeasureBase::Ptr measure, _Params params)
+		: _c(params), _measure(measure)
+	{
+		if (!_measure)
+			throw Exception("Trajectory measure is not given.");
+		if (_measure->GetMeasureType() != DistanceMeasureType::distance)
+			throw Exception("Coarse-to-fine computation supports distance type measures only. (" + _measure->GetMethodName() + ")");
+		if (_c.PyramidLevels == 0)
+			throw Exception("PyramidLevels should be at least 1.");
+	}
+
+	void CoarseToFineMeasure::Initialize(const std::string configFilePath)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.TrajectoryDistanceMeasure.CoarseToFine");
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--PyramidLevels", _cDefault.PyramidLevels,
+						"Number of pyramid levels including the original trajectory. 1 disables coarse computation.");
+		cli->add_option("--BaseTolerance", _cDefault.BaseTolerance,
+						"Douglas-Peucker tolerance(metre) for the first coarse level. Doubled for each following level.");
+	}
+
+	TrajectoryPyramid CoarseToFineMeasure::BuildPyramid(const XYList &traj) const
+	{
+		TrajectoryPyramid re;
+		re.Levels.push_back(traj);
+		re.Errors.push_back(0);
+
+		if (traj.size() < 3)
+			return re;
+
+		Real tolerance = _c.BaseTolerance;
+		for (size_t l = 1; l < _c.PyramidLevels; l++, tolerance *= 2)
+		{
+			vector<size_t> kept = DouglasPeuckerIndices(traj, tolerance);
+
+			// skip levels which are not coarser than the previous one
+			if (kept.size() >= re.Levels.back().size())
+				continue;
+
+			XYList level;
+			level.reserve(kept.size());
+			for (const size_t &k : kept)
+				level.push_back(traj[k]);
+
+			re.Levels.push_back(move(level));
+			re.Errors.push_back(SubsequenceCouplingError(traj, kept));
+
+			if (kept.size() <= 2)
+				break;
+		}
+		return re;
+	}
+
+	vector<TrajectoryPyramid> CoarseToFineMeasure::BuildPyramids(const vector<XYList> &trajlist) const
+	{
+		vector<TrajectoryPyramid> re;
+		re.resize(trajlist.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < trajlist.size(); i++)
+		{
+			re[i] = BuildPyramid(trajlist[i]);
+		}
+		return re;
+	}
+
+	ValueInterval<Real> CoarseToFineMeasure::MeasureInterval(
+		const TrajectoryPyramid &a, const TrajectoryPyramid &b, size_t level) const
+	{
+		assert(a.size() > 0 && b.size() > 0);
+		const size_t la = min(level, a.size() - 1);
+		const size_t lb = min(level, b.size() - 1);
+
+		ValueInterval<Real> re;
+		re.repVal = _measure->Measure(a.Levels[la], b.Levels[lb]);
+		if (la == 0 && lb == 0)
+		{
+			re.minVal = re.maxVal = re.repVal;
+		}
+		else
+		{
+			Real err = _measure->CoarseErrorBound(a.Errors[la], b.Errors[lb]);
+			re.minVal = max((Real)0, re.repVal - err);
+			re.maxVal = re.repVal + err;
+		}
+		return re;
+	}
+
+	bool CoarseToFineMeasure::IsWithin(const TrajectoryPyramid &a, const TrajectoryPyramid &b, Real threshold) const
+	{
+		// coarse levels are useless if the measure has no error bound
+		if (isfinite(_measure->CoarseErrorBound(0, 0)))
+		{
+			const size_t top = max(a.size(), b.size()) - 1;
+			for (size_t level = top; level > 0; level--)
+			{
+				ValueInterval<Real> iv = MeasureInterval(a, b, level);
+				if (iv.maxVal < threshold)
+					return true;
+				if (iv.minVal >= threshold)
+					return false;
+			}
+		}
+		return _measure->IsWithin(a.Original(), b.Original(), threshold);
+	}
+
+	vector<vector<size_t>> CoarseToFineMeasure::GetRangeNeighbors(
+		const vector<TrajectoryPyramid> &pyramids, Real epsilon) const
+	{
+		const size_t N = pyramids.size();
+
+		// hits[i] holds j > i only, written by the thread handling i
+		vector<vector<size_t>> hits;
+		hits.resize(N);
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < N; i++)
+		{
+			for (size_t j = i + 1; j < N; j++)
+			{
+				if (IsWithin(pyramids[i], pyramids[j], epsilon))
+					hits[i].push_back(j);
+			}
+		}
+
+		vector<vector<size_t>> re;
+		re.resize(N);
+		for (size_t i = 0; i < N; i++)
+		{
+			for (const size_t &j : hits[i])
+			{
+				re[i].push_back(j);
+				re[j].push_back(i);
+			}
+		}
+		for (auto &r : re)
+			sort(r.begin(), r.end());
+		return re;
+	}
+
+	vector<size_t> CoarseToFineMeasure::GetKNearest(
+		const TrajectoryPyramid &query, const vector<TrajectoryPyramid> &pyramids, size_t k) const
+	{
+		k = min(k, pyramids.size());
+		if (k == 0)
+			return {};
+
+		vector<size_t> cand(pyramids.size());
+		iota(cand.begin(), cand.end(), 0);
+
+		size_t top = 0;
+		if (isfinite(_measure->CoarseErrorBound(0, 0)))
+		{
+			top = query.size() - 1;
+			for (const auto &p : pyramids)
+				top = max(top, p.size() - 1);
+		}
+
+		vector<Real> lo, hi, cut;
+		for (size_t level = top;; level--)
+		{
+			lo.resize(cand.size());
+			hi.resize(cand.size());
+#pragma omp parallel for schedule(dynamic)
+			for (size_t c = 0; c < cand.size(); c++)
+			{
+				ValueInterval<Real> iv = MeasureInterval(query, pyramids[cand[c]], level);
+				lo[c] = iv.minVal;
+				hi[c] = iv.maxVal;
+			}
+
+			// at least k candidates are closer than the k-th smallest upper bound
+			cut = hi;
+			nth_element(cut.begin(), cut.begin() + (k - 1), cut.end());
+			const Real kthUpper = cut[k - 1];
+
+			vector<size_t> survived;
+			vector<Real> survivedDist;
+			for (size_t c = 0; c < cand.size(); c++)
+			{
+				if (lo[c] <= kthUpper)
+				{
+					survived.push_back(cand[c]);
+					survivedDist.push_back(hi[c]);
+				}
+			}
+			cand = move(survived);
+			hi = move(survivedDist);
+
+			if (level == 0)
+				break;
+		}
+
+		// at level 0, hi holds exact distances
+		vector<size_t> order(cand.size());
+		iota(order.begin(), order.end(), 0);
+		sort(order.begin(), order.end(),
+			 [&hi](size_t l, size_t r)
+			 { return hi[l] < hi[r]; });
+
+		vector<size_t> re;
+		for (size_t i = 0; i < k; i++)
+			re.push_back(cand[order[i]]);
+		return re;
+	}
+}
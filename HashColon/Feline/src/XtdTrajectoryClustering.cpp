@@ -1,14 +1,17 @@
-// HashColon config
+﻿// HashColon config
 #include <HashColon/HashColon_config.h>
 // std libraries
 #include <algorithm>
 #include <array>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <limits>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 // dependant external libraries
 #include <Eigen/Eigen>
@@ -17,10 +20,13 @@
 #include <HashColon/CLI11_JsonSupport.hpp>
 #include <Wasserstein/Wasserstein.hh>
 // HashColon libraries
+#include <HashColon/Helper.hpp>
 #include <HashColon/Real.hpp>
 #include <HashColon/SingletonCLI.hpp>
 #include <HashColon/Statistics.hpp>
 #include <HashColon/Feline/GeoValues.hpp>
+#include <HashColon/Feline/PreparedTrajectory.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
 // header file for this source file
 #include <HashColon/Feline/XtdTrajectoryClustering.hpp>
 
@@ -34,104 +40,77 @@ using namespace HashColon::Feline;
 // XTD distance btwn waypoints
 namespace HashColon::Feline::XtdTrajectoryClustering
 {
-	mutex _XtdDistance_cpp_mutex;
-
 	namespace _hidden
 	{
-		static unique_ptr<vector<vector<Real>>> zBvn;
-		static Real zUnit;
-		static Real zDomain;
-
-		struct SampleType
+		/*
+		 * Standard bivariate normal pdf on the grid z = (i, j) * stepSize, -k <= i, j <= k.
+		 * Immutable once built.
+		 */
+		struct ZGrid
 		{
-			array<Real, 2> Pos;
-			Real ProbValue;
+			Real StepSize;
+			Real DomainSize;
+			int K;
+			vector<Real> Pdf; // index (i + k) * (2k + 1) + (j + k)
+			Real PdfTotal;
 		};
 
-		vector<vector<Real>> PreComputeZNormals(Real stepSize, Real domainSize)
+		unique_ptr<const ZGrid> BuildZGrid(Real stepSize, Real domainSize)
 		{
 			int k = (int)floor(domainSize / stepSize);
 			Statistics::BVN bvn;
-			vector<vector<Real>> re(2 * k + 1, vector<Real>(2 * k + 1));
-
+			auto re = make_unique<ZGrid>();
+			re->StepSize = stepSize;
+			re->DomainSize = domainSize;
+			re->K = k;
+			re->Pdf.reserve((2 * k + 1) * (2 * k + 1));
+			re->PdfTotal = 0;
 			for (int i = -k; i <= k; i++)
 				for (int j = -k; j <= k; j++)
 				{
 					Eigen::Vector2R tmp;
 					tmp << (Real)i * stepSize, (Real)j * stepSize;
-					re[i + k][j + k] = bvn.PDF(tmp);
+					re->Pdf.push_back(bvn.PDF(tmp));
+					re->PdfTotal += re->Pdf.back();
 				}
 			return re;
 		}
 
-		/* Computes sampled points in domain. Result samples are not ordered.
-		 * The return vectors are in distance space, which means the units are in meters,
-		 * not in lat/lon space.
-		 * Projection of uniform sampling from symmetric normal distribution for each quadrant
-		 * ex)
-		 *            +---------+----+    each quardrant is distored quadrant
-		 *	avg(xtds, |         |    |    of symmetric normal distribution.
-		 *      xtdp) |         |    |    uniform sampled points are projected
-		 *            +---------+----+    to the distorted quardrants
-		 *  avg(xtds, |         |    |
-		 *      xtdp) |         |    |
-		 *            +---------+----+
-		 *             xtdp       xtds
-		 */
-		vector<SampleType> GetBVNSamples(
-			XYXtd point, Degree direction,
-			Real stepSize,						  // sample rate in unit of sigma
-			Real domainSize,					  // size of the domain box in unit of sigma
-			shared_ptr<Real> pdfTotVal = nullptr) // nomalize Pdf so that the sum of pdf satisfies sum-to-one property
-		{
-			assert(domainSize > 0);
-			assert(stepSize > 0);
-
-			// Get base vectors
-			Position pos = point.Pos;
-			Degree aS = direction + 90; // starboard direction
-			Degree aH = direction;
-			Real sigmaP = point.Xtd.xtdPortside / domainSize;  // set sigma in portside direction as 1/3 of xtd portside
-			Real sigmaS = point.Xtd.xtdStarboard / domainSize; // set sigma in starboard direction  as 1/3 of xtd starboard
-			Real sigmaH = (sigmaP + sigmaS) / 2;			   // set sigma in fwd/back direction as average of p/s sigma1
-			int k = (int)floor(domainSize / stepSize);
-			size_t N = (2 * k + 1) * (2 * k + 1);
-
-			if (zDomain != domainSize || zUnit != stepSize || !zBvn)
-			{
-				lock_guard<mutex> _lg(_XtdDistance_cpp_mutex);
-				zDomain = domainSize;
-				zUnit = stepSize;
-				zBvn = make_unique<vector<vector<Real>>>(PreComputeZNormals(zUnit, zDomain));
-			}
+		// Grids are cached per (stepSize, domainSize) for the lifetime of the program.
+		// Each thread remembers the last grid it used, so the mutex is taken only when the option changes.
+		const ZGrid &GetZGrid(Real stepSize, Real domainSize)
+		{
+			thread_local const ZGrid *last = nullptr;
+			if (last && last->StepSize == stepSize && last->DomainSize == domainSize)
+				return *last;
+
+			static mutex cacheMutex;
+			static map<pair<Real, Real>, unique_ptr<const ZGrid>> cache;
+			lock_guard<mutex> _lg(cacheMutex);
+			unique_ptr<const ZGrid> &grid = cache[{stepSize, domainSize}];
+			if (!grid)
+				grid = BuildZGrid(stepSize, domainSize);
+			last = grid.get();
+			return *last;
+		}
 
-			vector<SampleType> re;
-			re.reserve(N);
-			Real totProbVal = 0.0;
-			for (int i = -k; i <= k; i++)
-			{
-				for (int j = -k; j <= k; j++)
-				{
-					Real x = i <= 0 ? sigmaP * stepSize * i : sigmaS * stepSize * i;
-					Real y = sigmaH * stepSize * j;
-					Position tmpPos = pos.MoveTo(x, aS).MoveTo(y, aH);
-					SampleType tmp;
-					tmp.Pos[0] = tmpPos.dat[0];
-					tmp.Pos[1] = tmpPos.dat[1];
-					{
-						lock_guard<mutex> _lg(_XtdDistance_cpp_mutex);
-						tmp.ProbValue = (*zBvn)[i + k][j + k];
-						totProbVal += (*zBvn)[i + k][j + k];
-					}
-					// cout << i << ", " << j << endl;
-					re.push_back(tmp);
-				}
-			}
+		// offset of a from b in metres, on a local projection centered at their mid-point
+		Vector2R LocalOffset(const Position &a, const Position &b)
+		{
+			XY mid;
+			mid.longitude = (a.longitude + b.longitude) / 2;
+			mid.latitude = (a.latitude + b.latitude) / 2;
+			const TrajectoryClustering::LocalProjection proj(mid);
+			return proj.ToLocal(a) - proj.ToLocal(b);
+		}
 
-			for (auto &item : re)
-				item.ProbValue /= totProbVal;
-			if (pdfTotVal)
-				(*pdfTotVal) = totProbVal;
+		// direction of each waypoint: toward the next waypoint, and from the previous one for the last waypoint.
+		vector<Degree> WaypointDirections(const XYXtdList &traj)
+		{
+			vector<Degree> re(traj.size());
+			if (traj.size() > 1)
+				for (size_t i = 0; i < traj.size(); i++)
+					re[i] = (i == (traj.size() - 1)) ? traj[i - 1].Pos.AngleTo(traj[i].Pos) : traj[i].Pos.AngleTo(traj[i + 1].Pos);
 			return re;
 		}
 
@@ -151,113 +130,260 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 		}
 	}
 
-	// geospatial particle for computing emd
-	template <typename Value = Real>
-	struct GeospatialParticle
+	/* Samples in result are not ordered.
+	 * The samples are placed in distance space(meters) and then converted to lon/lat.
+	 * Projection of uniform sampling from symmetric normal distribution for each quadrant
+	 * ex)
+	 *            +---------+----+    each quardrant is distored quadrant
+	 *	avg(xtds, |         |    |    of symmetric normal distribution.
+	 *      xtdp) |         |    |    uniform sampled points are projected
+	 *            +---------+----+    to the distorted quardrants
+	 *  avg(xtds, |         |    |
+	 *      xtdp) |         |    |
+	 *            +---------+----+
+	 *             xtdp       xtds
+	 */
+	XtdParticleCloud XtdParticleCloud::Build(
+		XYXtd point, Degree direction,
+		Real stepSize,	 // sample rate in unit of sigma
+		Real domainSize) // size of the domain box in unit of sigma
 	{
-		using value_type = Value;
-		using Coords = array<Value, 2>;
-		using Self = GeospatialParticle;
-
-		// constructor from weight and coord array
-		GeospatialParticle(Value weight, const Coords &xs) : weight_(weight), xs_(xs){};
-		GeospatialParticle(Value weight, Value x, Value y) : weight_(weight), xs_({x, y}){};
-
-		Value weight() const { return weight_; };
-
-		const Value &operator[](ptrdiff_t i) const { return xs_[i]; };
-		Value &operator[](ptrdiff_t i) { return xs_[i]; };
-
-		static ptrdiff_t dimension() { return 2; };
-
-		static Value plain_distance(const Self &p0, const Self &p1)
+		assert(domainSize > 0);
+		assert(stepSize > 0);
+		const _hidden::ZGrid &zGrid = _hidden::GetZGrid(stepSize, domainSize);
+
+		// Get base vectors
+		Position pos = point.Pos;
+		Degree aS = direction + 90; // starboard direction
+		Degree aH = direction;
+		Real sigmaP = point.Xtd.xtdPortside / domainSize;  // set sigma in portside direction as 1/3 of xtd portside
+		Real sigmaS = point.Xtd.xtdStarboard / domainSize; // set sigma in starboard direction  as 1/3 of xtd starboard
+		Real sigmaH = (sigmaP + sigmaS) / 2;			   // set sigma in fwd/back direction as average of p/s sigma1
+		const int k = zGrid.K;
+		const size_t N = (2 * k + 1) * (2 * k + 1);
+
+		XtdParticleCloud re;
+		re.Point = point;
+		re.Direction = direction;
+		re.DomainSize = domainSize;
+		re.PdfTotal = zGrid.PdfTotal;
+		re.Pos.reserve(N);
+		re.ProbValue.reserve(N);
+		re.Local.resize(N, 2);
+
+		// unit vectors of starboard/heading direction in [east, north]
+		const Real radS = (Real)aS * Constant::PI / 180;
+		const Real radH = (Real)aH * Constant::PI / 180;
+		const Vector2R unitS{sin(radS), cos(radS)};
+		const Vector2R unitH{sin(radH), cos(radH)};
+
+		size_t idx = 0;
+		for (int i = -k; i <= k; i++)
 		{
-			Position A{p0[0], p0[1]}, B{p1[0], p1[1]};
-			Value dist = A.DistanceTo(B);
-			return dist * dist;
-		};
+			// samples of a row share the starboard offset
+			Real x = i <= 0 ? sigmaP * stepSize * i : sigmaS * stepSize * i;
+			const Position rowPos = pos.MoveTo(x, aS);
+			for (int j = -k; j <= k; j++, idx++)
+			{
+				Real y = sigmaH * stepSize * j;
+				Position tmpPos = rowPos.MoveTo(y, aH);
+				re.Pos.push_back({tmpPos.dat[0], tmpPos.dat[1]});
+				re.ProbValue.push_back(zGrid.Pdf[idx] / zGrid.PdfTotal);
+				re.Local.row(idx) = (x * unitS + y * unitH).transpose();
+			}
+		}
+		return re;
+	}
 
-		static std::string name() { return "GeospatialParticle: [lon, lat]"; };
-		static std::string distance_name() { return "HaversineDistance"; };
-
-	protected:
-		// store particle info
-		Value weight_;
-		Coords xs_;
-	};
-
-	using GeoParticle = GeospatialParticle<>;
-	template <typename Value = Real>
-	using GeoEvent = emd::EuclideanParticleEvent<GeospatialParticle<Value>>;
-	template <typename Value = Real>
-	using GeoDistance = emd::EuclideanParticleDistance<GeospatialParticle<Value>>;
-	template <
-		template <typename> class Event = GeoEvent,
-		template <typename> class Distance = GeoDistance>
-	using GeoEMD = emd::EMD<Real, Event, Distance>;
+	vector<XtdParticleCloud> XtdParticleCloud::Build(const XYXtdList &traj, Real stepSize, Real domainSize)
+	{
+		const vector<Degree> dir = _hidden::WaypointDirections(traj);
+		vector<XtdParticleCloud> re;
+		re.reserve(traj.size());
+		for (size_t i = 0; i < traj.size(); i++)
+			re.push_back(Build(traj[i], dir[i], stepSize, domainSize));
+		return re;
+	}
 
 	Real WassersteinDistance(
 		XYXtd a, Degree aDir,
 		XYXtd b, Degree bDir,
 		_WassersteinOption options)
 	{
-		using namespace emd;
-		using namespace _hidden;
+		return WassersteinDistance(
+			XtdParticleCloud::Build(a, aDir, options.domainUnit, options.domainSize),
+			XtdParticleCloud::Build(b, bDir, options.domainUnit, options.domainSize));
+	}
 
-		// Alias of Wasserstein library (EMD: Earth-Mover Distance)
-		using EMDParticle = emd::EuclideanParticle2D<>;
-		using EMD = EMDFloat64<EuclideanEvent2D, EuclideanDistance2D>;
+	Real WassersteinDistance(const XtdParticleCloud &a, const XtdParticleCloud &b, bool warmStart)
+	{
+		using RowMajorMatrixXR = Eigen::Matrix<Real, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+		// network simplex solver of Wasserstein library (EMD: Earth-Mover Distance).
+		// a solver per thread keeps its buffers, so repeated calls in a DTW table do not allocate.
+		// clouds share the weights of the z-grid, therefore the solution of the previous call of the thread
+		// (the left cell in a DTW table) is a feasible warm start of the next one.
+		thread_local emd::DefaultNetworkSimplex<Real> solver(100000, 1000, 1);
+
+		const Eigen::Index n0 = a.Local.rows();
+		const Eigen::Index n1 = b.Local.rows();
+
+		// supplies: weights of a followed by weights of b, scaled by the larger total as emd::EMD does.
+		// clouds are normalized, therefore the totals match and no extra particle is needed.
+		vector<Real> &weights = solver.weights();
+		weights.resize(n0 + n1 + 1);
+		copy(b.ProbValue.begin(), b.ProbValue.end(), copy(a.ProbValue.begin(), a.ProbValue.end(), weights.begin()));
+		Eigen::Map<VectorXR> wA(weights.data(), n0);
+		Eigen::Map<VectorXR> wB(weights.data() + n0, n1);
+		const Real scale = max(wA.sum(), wB.sum());
+		wA /= scale;
+		wB /= scale;
+
+		// ground distances in metres on a local projection centered at the mid-point of a and b
+		const Vector2R offset = _hidden::LocalOffset(a.Point.Pos, b.Point.Pos);
+
+		vector<Real> &dists = solver.dists();
+		dists.resize(n0 * n1);
+		Eigen::Map<RowMajorMatrixXR> D(dists.data(), n0, n1);
+		D.array() =
+			((a.Local.col(0).array() + offset(0)).replicate(1, n1).rowwise() - b.Local.col(0).transpose().array()).square() +
+			((a.Local.col(1).array() + offset(1)).replicate(1, n1).rowwise() - b.Local.col(1).transpose().array()).square();
+		D.array() = D.array().sqrt();
+
+		const emd::EMDStatus status = warmStart ? solver.compute_warm(n0, n1) : solver.compute(n0, n1);
+		if (status == emd::EMDStatus::Success)
+			return solver.total_cost() * scale;
+		else
+			return numeric_limits<Real>::min();
+	}
 
-		// using GeoEMD = EMDReal<GeoEvent, GeoDistance>;
+	namespace _hidden
+	{
+		// buffers of a Sinkhorn solve, reused by a thread.
+		// computed in float: the entropic bias is far above float precision, and exp/sqrt over the ground
+		// distance matrix, which dominate the cost of a solve, run twice as wide.
+		struct SinkhornWorkspace
+		{
+			Eigen::MatrixXf C; // ground distances
+			Eigen::MatrixXf K; // exp((f + g^T - C) / epsilon)
+			Eigen::VectorXf f; // log-domain potentials(scaled by epsilon) of the absorbed scalings
+			Eigen::VectorXf g;
+			Eigen::VectorXf u;
+			Eigen::VectorXf v;
+			Eigen::VectorXf Kv;
+			Eigen::VectorXf wa;
+			Eigen::VectorXf wb;
+
+			// column by column, which keeps exp vectorized over contiguous memory.
+			// exponents are clamped above the denormal range of float, where arithmetic gets very slow.
+			void BuildKernel(float epsilon)
+			{
+				K.resize(C.rows(), C.cols());
+				const float invEpsilon = 1 / epsilon;
+				for (Index j = 0; j < C.cols(); j++)
+					K.col(j).array() = ((f.array() + g(j) - C.col(j).array()) * invEpsilon).max(-80.f).exp();
+			}
 
-		/*using FelineEMD = EMD<Real,
-			EuclideanParticleEvent<GeospatialParticle>, EuclideanParticleDistance<GeospatialParticle>
-		>;*/
-		int k = (int)floor(options.domainSize / options.domainUnit);
-		int N = (2 * k + 1) * (2 * k + 1);
+			Real Solve(const XtdParticleCloud &a, const XtdParticleCloud &b, const _SinkhornOption &options)
+			{
+				assert(options.regularization > 0);
+				const Index n0 = a.Local.rows();
+				const Index n1 = b.Local.rows();
+				wa = Eigen::Map<const VectorXR>(a.ProbValue.data(), n0).cast<float>();
+				wb = Eigen::Map<const VectorXR>(b.ProbValue.data(), n1).cast<float>();
+
+				// ground distances in metres as WassersteinDistance
+				const Vector2R offset = LocalOffset(a.Point.Pos, b.Point.Pos);
+				const Eigen::ArrayXf ax = (a.Local.col(0).array() + offset(0)).cast<float>();
+				const Eigen::ArrayXf ay = (a.Local.col(1).array() + offset(1)).cast<float>();
+				const Eigen::ArrayXf bx = b.Local.col(0).array().cast<float>();
+				const Eigen::ArrayXf by = b.Local.col(1).array().cast<float>();
+				C.resize(n0, n1);
+				for (Index j = 0; j < n1; j++)
+					C.col(j).array() = ((ax - bx(j)).square() + (ay - by(j)).square()).sqrt();
+				const float epsilon = (float)options.regularization * C.mean();
+				if (!(epsilon > 0))
+					return 0;
+
+				// start from the c-transforms so that every row and column of K has an entry of one,
+				// which keeps K from underflowing to an empty row or column for small epsilon
+				f = C.rowwise().minCoeff();
+				g = (C.colwise() - f).colwise().minCoeff().transpose();
+				BuildKernel(epsilon);
+				u.setOnes(n0);
+				v.setOnes(n1);
+
+				// scaling iterations. u, v are absorbed into f, g once they leave [1e-25, 1e25]
+				// and K is rebuilt from the potentials, so that the scalings never overflow.
+				for (size_t it = 0; it < options.maxIteration; it++)
+				{
+					Kv.noalias() = K * v;
+					if (it > 0 && (u.cwiseProduct(Kv) - wa).lpNorm<1>() < options.tolerance)
+						break;
+					u = wa.cwiseQuotient(Kv);
+					v = wb.cwiseQuotient(K.transpose() * u);
 
-		auto SamplesA = GetBVNSamples(a, aDir, options.domainUnit, options.domainSize);
-		auto SamplesB = GetBVNSamples(b, bDir, options.domainUnit, options.domainSize);
+					if (u.maxCoeff() > 1e25f || v.maxCoeff() > 1e25f || u.minCoeff() < 1e-25f || v.minCoeff() < 1e-25f)
+					{
+						f.array() += epsilon * u.array().log();
+						g.array() += epsilon * v.array().log();
+						BuildKernel(epsilon);
+						u.setOnes(n0);
+						v.setOnes(n1);
+					}
+				}
 
-		vector<GeoParticle> ParticlesA;
-		vector<GeoParticle> ParticlesB;
+				// <P, C> with P = diag(u) K diag(v)
+				return (Real)u.dot((K.array() * C.array()).matrix() * v);
+			}
+		};
 
-		for (int i = 0; i < N; i++)
+		SinkhornWorkspace &GetSinkhornWorkspace()
 		{
-			GeoParticle tmpParticleA(SamplesA[i].ProbValue, SamplesA[i].Pos);
-			GeoParticle tmpParticleB(SamplesB[i].ProbValue, SamplesB[i].Pos);
-
-			ParticlesA.push_back(tmpParticleA);
-			ParticlesB.push_back(tmpParticleB);
+			thread_local SinkhornWorkspace workspace;
+			return workspace;
 		}
+	}
 
-		// build PDF as emd::Event form
-		EuclideanParticleEvent<GeospatialParticle<>> eventA(ParticlesA);
-		EuclideanParticleEvent<GeospatialParticle<>> eventB(ParticlesB);
+	Real SinkhornDistance(const XtdParticleCloud &a, const XtdParticleCloud &b, _SinkhornOption options)
+	{
+		return _hidden::GetSinkhornWorkspace().Solve(a, b, options);
+	}
 
-		// EMD computing obj (Wasserstein library)
-		GeoEMD<> EmdComputer = GeoEMD<>();
-		auto reCheck = EmdComputer.compute(eventA, eventB);
-		if (reCheck == emd::EMDStatus::Success)
-			return EmdComputer.emd();
-		else
-			return numeric_limits<Real>::min();
+	void SinkhornDistance(
+		const vector<const XtdParticleCloud *> &a, const vector<const XtdParticleCloud *> &b,
+		vector<Real> &oResults, _SinkhornOption options)
+	{
+		assert(a.size() == b.size());
+		oResults.resize(a.size());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t k = 0; k < a.size(); k++)
+			oResults[k] = _hidden::GetSinkhornWorkspace().Solve(*a[k], *b[k], options);
 	}
 
 	Real JSDivergenceDistance(
 		XYXtd a, Degree aDir,
 		XYXtd b, Degree bDir,
 		_JSDivergenceOption options)
+	{
+		return JSDivergenceDistance(
+			XtdParticleCloud::Build(a, aDir, options.domainUnit, options.domainSize),
+			XtdParticleCloud::Build(b, bDir, options.domainUnit, options.domainSize),
+			options);
+	}
+
+	Real JSDivergenceDistance(
+		const XtdParticleCloud &cloudA, const XtdParticleCloud &cloudB,
+		_JSDivergenceOption options)
 	{
 		using namespace _hidden;
 		using namespace HashColon::Statistics;
+		assert(cloudA.DomainSize == options.domainSize && cloudB.DomainSize == options.domainSize);
 
-		shared_ptr<Real> aPdfTot = make_shared<Real>(0);
-		shared_ptr<Real> bPdfTot = make_shared<Real>(0);
-		auto SamplesA = GetBVNSamples(a, aDir, options.domainUnit, options.domainSize, aPdfTot);
-		auto SamplesB = GetBVNSamples(b, bDir, options.domainUnit, options.domainSize, bPdfTot);
-		int k = (int)floor(options.domainSize / options.domainUnit);
-		int N = (2 * k + 1) * (2 * k + 1);
+		const XYXtd &a = cloudA.Point;
+		const XYXtd &b = cloudB.Point;
+		const Degree aDir = cloudA.Direction;
+		const Degree bDir = cloudB.Direction;
 
 		// JS divergence works in very small distance.
 		// Therefore, no matter the distance type is, we will use cartesian distance
@@ -284,10 +410,10 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		// sum( [PDF(A) * dA] * {log(PDF(A)) - log(PDF(M))} )
 		Real KL_AM = 0;
-		for (const auto &sample_ : SamplesA)
+		for (size_t s = 0; s < cloudA.Pos.size(); s++)
 		{
 			// define sample values
-			const Position sample{sample_.Pos[0], sample_.Pos[1]};
+			const Position sample{cloudA.Pos[s][0], cloudA.Pos[s][1]};
 
 			// compute distance in AH/AS/BH/BS to a & b from the sample
 			Real zAH = sample.OnTrackDistanceTo(a.Pos, AH);
@@ -308,8 +434,8 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			// comput Pdf witth area
 			Vector2R z;
 			z << zBH, zBS;
-			const Real PdfA_dArea = sample_.ProbValue;
-			const Real PdfB_dArea = zPDF.PDF(z) / (*bPdfTot);
+			const Real PdfA_dArea = cloudA.ProbValue[s];
+			const Real PdfB_dArea = zPDF.PDF(z) / cloudB.PdfTotal;
 
 			// {log(PDF(A)) - log(PDF(M))}
 			// = log(PDF(A) / PDF(M))
@@ -340,10 +466,10 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		// sum( [PDF(B) * dB] * {log(PDF(B)) - log(PDF(M)) )
 		Real KL_BM = 0;
-		for (const auto &sample_ : SamplesB)
+		for (size_t s = 0; s < cloudB.Pos.size(); s++)
 		{
 			// define sample values
-			const Position sample{sample_.Pos[0], sample_.Pos[1]};
+			const Position sample{cloudB.Pos[s][0], cloudB.Pos[s][1]};
 
 			// compute distance in AH/AS/BH/BS to a & b from the sample
 			Real zAH = sample.OnTrackDistanceTo(a.Pos, AH);
@@ -364,8 +490,8 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 			// comput Pdf witth area
 			Vector2R z;
 			z << zAH, zAS;
-			const Real PdfA_dArea = zPDF.PDF(z) / (*aPdfTot);
-			const Real PdfB_dArea = sample_.ProbValue;
+			const Real PdfA_dArea = zPDF.PDF(z) / cloudA.PdfTotal;
+			const Real PdfB_dArea = cloudB.ProbValue[s];
 
 			// compute dAreaA / dAreaB
 			Real dAreaA =
@@ -386,6 +512,158 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 		return 0.5 * (KL_AM + KL_BM);
 	}
 
+	XtdGaussian XtdGaussian::Build(XYXtd point, Degree direction, Real domainSize)
+	{
+		assert(domainSize > 0);
+
+		// sigma as XtdParticleCloud::Build
+		const Real sigmaP = point.Xtd.xtdPortside / domainSize;
+		const Real sigmaS = point.Xtd.xtdStarboard / domainSize;
+		const Real sigmaH = (sigmaP + sigmaS) / 2;
+		const Real shift = (sigmaS - sigmaP) / sqrt(2 * Constant::PI);
+		const Real varS = (sigmaP * sigmaP + sigmaS * sigmaS) / 2 - shift * shift;
+		const Real varH = sigmaH * sigmaH;
+
+		// unit vectors of starboard/heading direction in [east, north]
+		const Real radS = (Real)(direction + 90) * Constant::PI / 180;
+		const Real radH = (Real)direction * Constant::PI / 180;
+		const Vector2R unitS{sin(radS), cos(radS)};
+		const Vector2R unitH{sin(radH), cos(radH)};
+
+		XtdGaussian re;
+		re.Point = point;
+		re.Mean = shift * unitS;
+		re.Cov = varS * unitS * unitS.transpose() + varH * unitH * unitH.transpose();
+		return re;
+	}
+
+	vector<XtdGaussian> XtdGaussian::Build(const XYXtdList &traj, Real domainSize)
+	{
+		const vector<Degree> dir = _hidden::WaypointDirections(traj);
+		vector<XtdGaussian> re;
+		re.reserve(traj.size());
+		for (size_t i = 0; i < traj.size(); i++)
+			re.push_back(Build(traj[i], dir[i], domainSize));
+		return re;
+	}
+
+	Real GaussianWassersteinDistance(const XtdGaussian &a, const XtdGaussian &b)
+	{
+		const Vector2R d = _hidden::LocalOffset(a.Point.Pos, b.Point.Pos) + a.Mean - b.Mean;
+		// tr((Cb^1/2 Ca Cb^1/2)^1/2) = sqrt(tr(Ca Cb) + 2 sqrt(det(Ca) det(Cb))) for 2x2
+		const Real crossTrace = sqrt(max<Real>(
+			(a.Cov * b.Cov).trace() + 2 * sqrt(max<Real>(a.Cov.determinant() * b.Cov.determinant(), 0)), 0));
+		return sqrt(max<Real>(d.squaredNorm() + a.Cov.trace() + b.Cov.trace() - 2 * crossTrace, 0));
+	}
+
+	Real GaussianJSDivergenceDistance(const XtdGaussian &a, const XtdGaussian &b)
+	{
+		// 2d normal KL divergence of N(d, C0) from N(0, C1)
+		auto KL = [](const Vector2R &d, const Matrix2R &C0, const Matrix2R &C1)
+		{
+			const Matrix2R C1inv = C1.inverse();
+			return ((C1inv * C0).trace() + d.dot(C1inv * d) - 2 + log(C1.determinant() / C0.determinant())) / 2;
+		};
+		assert(a.Cov.determinant() > 0 && b.Cov.determinant() > 0);
+
+		// mixture M = (a + b) / 2 matched by a normal: mean (ma + mb) / 2, cov (Ca + Cb) / 2 + d d^T / 4
+		const Vector2R d = _hidden::LocalOffset(a.Point.Pos, b.Point.Pos) + a.Mean - b.Mean;
+		const Matrix2R CM = (a.Cov + b.Cov) / 2 + d * d.transpose() / 4;
+		const Real re = (KL(d / 2, a.Cov, CM) + KL(-d / 2, b.Cov, CM)) / 2;
+		return min<Real>(max<Real>(re, 0), log(2.0));
+	}
+
+	Real GaussianHellingerDistance(const XtdGaussian &a, const XtdGaussian &b)
+	{
+		assert(a.Cov.determinant() > 0 && b.Cov.determinant() > 0);
+		const Vector2R d = _hidden::LocalOffset(a.Point.Pos, b.Point.Pos) + a.Mean - b.Mean;
+		const Matrix2R C = (a.Cov + b.Cov) / 2;
+		const Real bc =
+			pow(a.Cov.determinant() * b.Cov.determinant(), 0.25) / sqrt(C.determinant()) *
+			exp(-d.dot(C.inverse() * d) / 8);
+		return sqrt(max<Real>(1 - bc, 0));
+	}
+
+	_AnalyticGaussianBenchmark BenchmarkAnalyticGaussian(
+		const vector<XYXtdList> &trajlist, size_t maxPairCount, Real domainUnit, Real domainSize)
+	{
+		using Clock = chrono::steady_clock;
+		auto seconds = [](Clock::time_point from)
+		{ return chrono::duration<Real>(Clock::now() - from).count(); };
+
+		// pairs of (trajectory, waypoint) index: i-th waypoint of trajlist[t] and of trajlist[t + 1]
+		vector<array<size_t, 3>> pairs;
+		for (size_t t = 0; t + 1 < trajlist.size() && pairs.size() < maxPairCount; t++)
+			for (size_t i = 0; i < min(trajlist[t].size(), trajlist[t + 1].size()) && pairs.size() < maxPairCount; i++)
+				pairs.push_back({t, t + 1, i});
+
+		_AnalyticGaussianBenchmark re{pairs.size(), 0, 0, 0, 0, 0, 0, 0, 0};
+		if (pairs.empty())
+			return re;
+
+		const _JSDivergenceOption jsOption{domainUnit, domainSize, _cDefault_JSDivergence.errorEpsilon};
+		vector<Real> sampledJS(pairs.size()), sampledWS(pairs.size());
+		vector<Real> analyticJS(pairs.size()), analyticWS(pairs.size());
+
+		// build clouds/gaussians of every trajectory once, then measure the pairs
+		Clock::time_point from = Clock::now();
+		vector<vector<XtdParticleCloud>> clouds(trajlist.size());
+		for (size_t t = 0; t < trajlist.size(); t++)
+			clouds[t] = XtdParticleCloud::Build(trajlist[t], domainUnit, domainSize);
+		const Real cloudSeconds = seconds(from);
+
+		from = Clock::now();
+		for (size_t k = 0; k < pairs.size(); k++)
+			sampledJS[k] = JSDivergenceDistance(clouds[pairs[k][0]][pairs[k][2]], clouds[pairs[k][1]][pairs[k][2]], jsOption);
+		re.SampledSeconds_JS = cloudSeconds + seconds(from);
+
+		from = Clock::now();
+		for (size_t k = 0; k < pairs.size(); k++)
+			sampledWS[k] = WassersteinDistance(clouds[pairs[k][0]][pairs[k][2]], clouds[pairs[k][1]][pairs[k][2]]);
+		re.SampledSeconds_WS = cloudSeconds + seconds(from);
+
+		from = Clock::now();
+		vector<vector<XtdGaussian>> gaussians(trajlist.size());
+		for (size_t t = 0; t < trajlist.size(); t++)
+			gaussians[t] = XtdGaussian::Build(trajlist[t], domainSize);
+		const Real gaussianSeconds = seconds(from);
+
+		from = Clock::now();
+		for (size_t k = 0; k < pairs.size(); k++)
+			analyticJS[k] = GaussianJSDivergenceDistance(gaussians[pairs[k][0]][pairs[k][2]], gaussians[pairs[k][1]][pairs[k][2]]);
+		re.AnalyticSeconds_JS = gaussianSeconds + seconds(from);
+
+		from = Clock::now();
+		for (size_t k = 0; k < pairs.size(); k++)
+			analyticWS[k] = GaussianWassersteinDistance(gaussians[pairs[k][0]][pairs[k][2]], gaussians[pairs[k][1]][pairs[k][2]]);
+		re.AnalyticSeconds_WS = gaussianSeconds + seconds(from);
+
+		// relative errors are averaged over pairs with non-zero sampled distance
+		size_t relCountJS = 0, relCountWS = 0;
+		for (size_t k = 0; k < pairs.size(); k++)
+		{
+			const Real errJS = abs(analyticJS[k] - sampledJS[k]);
+			const Real errWS = abs(analyticWS[k] - sampledWS[k]);
+			re.MeanAbsError_JS += errJS;
+			re.MeanAbsError_WS += errWS;
+			if (sampledJS[k] > 0)
+			{
+				re.MeanRelError_JS += errJS / sampledJS[k];
+				relCountJS++;
+			}
+			if (sampledWS[k] > 0)
+			{
+				re.MeanRelError_WS += errWS / sampledWS[k];
+				relCountWS++;
+			}
+		}
+		re.MeanAbsError_JS /= (Real)pairs.size();
+		re.MeanAbsError_WS /= (Real)pairs.size();
+		re.MeanRelError_JS = relCountJS > 0 ? re.MeanRelError_JS / (Real)relCountJS : 0;
+		re.MeanRelError_WS = relCountWS > 0 ? re.MeanRelError_WS / (Real)relCountWS : 0;
+		return re;
+	}
+
 	Real PFDistance(
 		XYXtd a, Degree aDir,
 		XYXtd b, Degree bDir,
@@ -418,6 +696,224 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 // XTD distance metric btwn trajectories
 namespace HashColon::Feline::XtdTrajectoryClustering
 {
+	namespace _hidden
+	{
+		struct RollingDtwTag
+		{
+		};
+
+		// DTW of n x m table with rolling rows along the shorter side.
+		// cost(i, j) is always called with the index i of a (size n) and j of b (size m).
+		// DTW recurrence is symmetric to transpose, so the result does not depend on the traversal direction.
+		// returns infinity as soon as the minimum of a row(which never decreases) exceeds upperBound.
+		template <typename CostFunc>
+		Real RollingDtw(size_t n, size_t m, CostFunc cost, Real upperBound)
+		{
+			const Real rowCutoff = upperBound * (Real)(n + m);
+			const bool transposed = m > n;
+			const size_t rows = transposed ? m : n;
+			const size_t cols = transposed ? n : m;
+			vector<Real> &prev = ScratchBuffer<Real, RollingDtwTag>::Get(0, cols);
+			vector<Real> &cur = ScratchBuffer<Real, RollingDtwTag>::Get(1, cols);
+
+			for (size_t r = 0; r < rows; r++)
+			{
+				Real rowMin = numeric_limits<Real>::max();
+				for (size_t c = 0; c < cols; c++)
+				{
+					if (r == 0 && c == 0)
+						cur[c] = 0;
+					else
+					{
+						cur[c] = (transposed ? cost(c, r) : cost(r, c)) +
+								 min({(r >= 1 ? prev[c] : numeric_limits<Real>::max()),
+									  (c >= 1 ? cur[c - 1] : numeric_limits<Real>::max()),
+									  ((r >= 1 && c >= 1) ? prev[c - 1] : numeric_limits<Real>::max())});
+
+						assert(!isnan(cur[c]));
+						assert(cur[c] >= 0);
+					}
+					rowMin = min(rowMin, cur[c]);
+				}
+				if (rowMin > rowCutoff)
+					return numeric_limits<Real>::infinity();
+				swap(prev, cur);
+			}
+
+			assert(prev[cols - 1] >= 0);
+			return prev[cols - 1] / (Real)(n + m);
+		}
+
+		// DTW on per-waypoint data(particle clouds, gaussians) with waypointCost(a[i], b[j]) as the cost of a cell
+		template <typename Waypoint, typename WaypointCost>
+		Real WaypointDtw(
+			const vector<Waypoint> &a, const vector<Waypoint> &b,
+			WaypointCost waypointCost, Real upperBound)
+		{
+			return RollingDtw(
+				a.size(), b.size(),
+				[&a, &b, &waypointCost](size_t i, size_t j)
+				{ return waypointCost(a[i], b[j]); },
+				upperBound);
+		}
+
+		// DTW of RollingDtw for an expensive cost(i, j) bounded below by a cheap lowerCost(i, j) >= 0.
+		// The cost of the diagonal path bounds the table first. Then cost(i, j) is evaluated only for cells
+		// which can still be on a path under the bound, i.e. min(predecessors) + lowerCost(i, j) <= bound.
+		// Other cells are set to infinity, which does not change the result as every path through them exceeds the bound.
+		template <typename LowerCostFunc, typename CostFunc>
+		Real LazyDtw(size_t n, size_t m, LowerCostFunc lowerCost, CostFunc cost, Real upperBound)
+		{
+			// diagonal path: (r * (n - 1) / (L - 1), r * (m - 1) / (L - 1)) for r = 0, ..., L - 1
+			const size_t L = max(n, m);
+			Real diagCost = 0;
+			for (size_t r = 1; r < L; r++)
+				diagCost += cost(r * (n - 1) / (L - 1), r * (m - 1) / (L - 1));
+			// slack for rounding, as the table sums the same path in a different order
+			const Real cutoff = min(diagCost * (1 + 1e-9), upperBound * (Real)(n + m));
+
+			const bool transposed = m > n;
+			const size_t rows = transposed ? m : n;
+			const size_t cols = transposed ? n : m;
+			vector<Real> &prev = ScratchBuffer<Real, RollingDtwTag>::Get(0, cols);
+			vector<Real> &cur = ScratchBuffer<Real, RollingDtwTag>::Get(1, cols);
+
+			for (size_t r = 0; r < rows; r++)
+			{
+				Real rowMin = numeric_limits<Real>::infinity();
+				for (size_t c = 0; c < cols; c++)
+				{
+					if (r == 0 && c == 0)
+						cur[c] = 0;
+					else
+					{
+						const size_t i = transposed ? c : r;
+						const size_t j = transposed ? r : c;
+						const Real pred =
+							min({(r >= 1 ? prev[c] : numeric_limits<Real>::infinity()),
+								 (c >= 1 ? cur[c - 1] : numeric_limits<Real>::infinity()),
+								 ((r >= 1 && c >= 1) ? prev[c - 1] : numeric_limits<Real>::infinity())});
+						cur[c] = (pred + lowerCost(i, j) > cutoff)
+									 ? numeric_limits<Real>::infinity()
+									 : pred + cost(i, j);
+						assert(!isnan(cur[c]));
+						assert(cur[c] >= 0);
+					}
+					rowMin = min(rowMin, cur[c]);
+				}
+				if (rowMin > cutoff)
+					return numeric_limits<Real>::infinity();
+				swap(prev, cur);
+			}
+			return prev[cols - 1] / (Real)(n + m);
+		}
+
+		// per-trajectory data prepared by a measure, for a trajectory and for its reversed sequence if needed
+		template <typename Prepared>
+		struct PreparedSet
+		{
+			Prepared Forward;
+			Prepared Reversed;
+		};
+
+		template <typename PrepareFunc>
+		auto BuildPreparedSet(const XYXtdList &traj, bool withReversed, PrepareFunc prepare)
+		{
+			PreparedSet<decltype(prepare(traj))> re;
+			re.Forward = prepare(traj);
+			if (withReversed)
+				re.Reversed = prepare(traj.GetReversed());
+			return re;
+		}
+
+		// same as XtdTrajectoryDistanceMeasureBase::Measure.
+		// dtw(preparedA, preparedB, upperBound) is Measure_core on prepared data.
+		template <typename Prepared, typename DtwFunc>
+		Real PreparedSetDtw(
+			const PreparedSet<Prepared> &a, const PreparedSet<Prepared> &b, bool reversed, DtwFunc dtw, Real upperBound)
+		{
+			Real re = dtw(a.Forward, b.Forward, upperBound);
+			if (reversed)
+				re = min(re, dtw(a.Reversed, b.Forward, min(upperBound, re)));
+			return re;
+		}
+
+		// MeasureBatch preparing the query once
+		template <typename PrepareFunc, typename DtwFunc>
+		void PreparedMeasureBatch(
+			const XYXtdList &query, const vector<const XYXtdList *> &targets,
+			bool reversed, PrepareFunc prepare, DtwFunc dtw,
+			vector<Real> &oResults)
+		{
+			oResults.resize(targets.size());
+			const auto q = BuildPreparedSet(query, reversed, prepare);
+			for (size_t k = 0; k < targets.size(); k++)
+			{
+				const auto t = BuildPreparedSet(*targets[k], false, prepare);
+				oResults[k] = PreparedSetDtw(q, t, reversed, dtw, numeric_limits<Real>::infinity());
+			}
+		}
+
+		// MeasureMatrix preparing every trajectory once
+		template <typename PrepareFunc, typename DtwFunc>
+		void PreparedMeasureMatrix(
+			const vector<XYXtdList> &data,
+			bool reversed, PrepareFunc prepare, DtwFunc dtw,
+			MatrixXR &oMatrix)
+		{
+			const size_t N = data.size();
+			vector<decltype(BuildPreparedSet(data[0], reversed, prepare))> prepared(N);
+#pragma omp parallel for schedule(dynamic)
+			for (size_t i = 0; i < N; i++)
+				prepared[i] = BuildPreparedSet(data[i], reversed, prepare);
+
+			oMatrix.resize(N, N);
+#pragma omp parallel for schedule(dynamic)
+			for (size_t i = 0; i < N; i++)
+			{
+				oMatrix(i, i) = 0;
+				for (size_t j = i + 1; j < N; j++)
+					oMatrix(i, j) = oMatrix(j, i) =
+						PreparedSetDtw(prepared[i], prepared[j], reversed, dtw, numeric_limits<Real>::infinity());
+			}
+		}
+
+		// PreparedMeasureBatch/PreparedMeasureMatrix of WaypointDtw with per-waypoint data built by build(traj)
+		template <typename BuildFunc, typename WaypointCost>
+		void WaypointMeasureBatch(
+			const XYXtdList &query, const vector<const XYXtdList *> &targets,
+			bool reversed, BuildFunc build, WaypointCost waypointCost,
+			vector<Real> &oResults)
+		{
+			PreparedMeasureBatch(
+				query, targets, reversed, build,
+				[&waypointCost](const auto &pa, const auto &pb, Real upperBound)
+				{ return WaypointDtw(pa, pb, waypointCost, upperBound); },
+				oResults);
+		}
+
+		template <typename BuildFunc, typename WaypointCost>
+		void WaypointMeasureMatrix(
+			const vector<XYXtdList> &data,
+			bool reversed, BuildFunc build, WaypointCost waypointCost,
+			MatrixXR &oMatrix)
+		{
+			PreparedMeasureMatrix(
+				data, reversed, build,
+				[&waypointCost](const auto &pa, const auto &pb, Real upperBound)
+				{ return WaypointDtw(pa, pb, waypointCost, upperBound); },
+				oMatrix);
+		}
+
+		// waypoints of a trajectory with their directions, and particle clouds if JS or WS is blended
+		struct BlendedWaypoints
+		{
+			XYXtdList Traj;
+			vector<Degree> Direction;
+			vector<XtdParticleCloud> Cloud;
+		};
+	}
+
 	vector<XYXtdList> UniformSampling(
 		vector<XYXtdList> &trajlist, size_t sampleNumber)
 	{
@@ -433,24 +929,36 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 	Real XtdTrajectoryDistanceMeasureBase::Measure(
 		const XYXtdList &a,
-		const XYXtdList &b) const
+		const XYXtdList &b,
+		Real upperBound) const
 	{
-		Real re;
+		Real re = Measure_core(a, b, upperBound);
 		if (_c.Enable_ReversedSequence)
 		{
-			re = min(
-				Measure_core(a, b),
-				Measure_core(a.GetReversed(), b));
-		}
-		else
-		{
-			re = Measure_core(a, b);
+			re = min(re, Measure_core(a.GetReversed(), b, min(upperBound, re)));
 		}
 		assert(re >= 0);
 		assert(!isnan(re));
 		return re;
 	}
 
+	void XtdTrajectoryDistanceMeasureBase::MeasureBatch(
+		const XYXtdList &query,
+		const vector<const XYXtdList *> &targets,
+		vector<Real> &oResults) const
+	{
+		oResults.resize(targets.size());
+		const XYXtdList reversed = _c.Enable_ReversedSequence ? query.GetReversed() : XYXtdList();
+		for (size_t k = 0; k < targets.size(); k++)
+		{
+			oResults[k] = Measure_core(query, *targets[k], numeric_limits<Real>::infinity());
+			if (_c.Enable_ReversedSequence)
+				oResults[k] = min(oResults[k], Measure_core(reversed, *targets[k], oResults[k]));
+			assert(oResults[k] >= 0);
+			assert(!isnan(oResults[k]));
+		}
+	}
+
 	void XtdTrajectoryDistanceMeasureBase::Initialize(const string configFilePath)
 	{
 		CLI::App *cli = SingletonCLI::GetInstance().GetCLI("Feline.XtdTrajectoryDistanceMeasure");
@@ -462,38 +970,36 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		cli->add_option("--Enable_ReversedSequence", _cDefault.Enable_ReversedSequence,
 						"Computes sequence-invariant measure. Computes min(D(A,B), D(A.rev, B))");
+		cli->add_option("--Enable_PreparedKernel", _cDefault.Enable_PreparedKernel,
+						"Computes distance matrices of DtwXtd by float kernels on waypoints prepared in a local projection. Approximate.");
 	}
 
-	Real DtwXtd::Measure_core(
-		const XYXtdList &a, const XYXtdList &b) const
+	bool DtwXtd::MeasureMatrix(const vector<XYXtdList> &data, MatrixXR &oMatrix) const
 	{
-		vector<vector<Real>> warp;
-
-		// initialize arrays
-		warp.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
-			warp[i].resize(b.size());
-
-		for (size_t i = 0; i < a.size(); i++)
-		{
-			for (size_t j = 0; j < b.size(); j++)
-			{
-				if (i == 0 && j == 0)
-					warp[i][j] = 0;
-				else
-				{
-					warp[i][j] = a[i].Pos.DistanceTo(b[j].Pos) + min({(i >= 1 ? warp[i - 1][j] : numeric_limits<Real>::max()),
-																	  (j >= 1 ? warp[i][j - 1] : numeric_limits<Real>::max()),
-																	  ((i >= 1 && j >= 1) ? warp[i - 1][j - 1] : numeric_limits<Real>::max())});
-
-					assert(!isnan(warp[i][j]));
-					assert(warp[i][j] >= 0);
-				}
-			}
-		}
+		if (!_c.Enable_PreparedKernel)
+			return false;
+
+		vector<XYList> positions(data.size());
+		for (size_t i = 0; i < data.size(); i++)
+			positions[i] = data[i].ToXYList();
+
+		// the prepared measure lives only in this call, therefore does not own this measure.
+		const TrajectoryClustering::PreparedXtdTrajectoryMeasure prepared(
+			shared_ptr<DtwXtd>(shared_ptr<DtwXtd>(), const_cast<DtwXtd *>(this)));
+		return prepared.MeasureMatrix(
+			TrajectoryClustering::PreparedTrajectory::Prepare(
+				positions, TrajectoryClustering::LocalProjection::FromTrajectories(positions)),
+			oMatrix);
+	}
 
-		assert(warp[a.size() - 1][b.size() - 1] >= 0);
-		return warp[a.size() - 1][b.size() - 1] / (Real)(a.size() + b.size());
+	Real DtwXtd::Measure_core(
+		const XYXtdList &a, const XYXtdList &b, Real upperBound) const
+	{
+		return _hidden::RollingDtw(
+			a.size(), b.size(),
+			[&a, &b](size_t i, size_t j)
+			{ return a[i].Pos.DistanceTo(b[j].Pos); },
+			upperBound);
 	}
 
 	void DtwXtd_usingJSDivergence::Initialize(const string configFilePath)
@@ -513,44 +1019,84 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		cli->add_option("--MonteCarloErrorEpsilon", _cDefault.MonteCarloErrorEpsilon,
 						"Error threshold for Monte Carlo integration.");
+
+		cli->add_option("--Enable_AnalyticGaussian", _cDefault.Enable_AnalyticGaussian,
+						"Computes point distance in closed form on moment-matched normals instead of Monte Carlo samples.");
+
+		cli->add_option("--Enable_Hellinger", _cDefault.Enable_Hellinger,
+						"Uses Hellinger distance instead of moment-matched JS divergence in analytic mode.");
+	}
+
+	Real DtwXtd_usingJSDivergence::CloudDistance(const XtdParticleCloud &a, const XtdParticleCloud &b) const
+	{
+		return JSDivergenceDistance(a, b, {_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon});
+	}
+
+	Real DtwXtd_usingJSDivergence::GaussianDistance(const XtdGaussian &a, const XtdGaussian &b) const
+	{
+		return _c.Enable_Hellinger ? GaussianHellingerDistance(a, b) : GaussianJSDivergenceDistance(a, b);
 	}
 
 	Real DtwXtd_usingJSDivergence::Measure_core(
-		const XYXtdList &a, const XYXtdList &b) const
+		const XYXtdList &a, const XYXtdList &b, Real upperBound) const
 	{
-		vector<vector<Real>> warp;
+		if (_c.Enable_AnalyticGaussian)
+			return _hidden::WaypointDtw(
+				XtdGaussian::Build(a, _c.MonteCarloDomainSize),
+				XtdGaussian::Build(b, _c.MonteCarloDomainSize),
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				upperBound);
+		return _hidden::WaypointDtw(
+			XtdParticleCloud::Build(a, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize),
+			XtdParticleCloud::Build(b, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize),
+			[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+			{ return CloudDistance(ca, cb); },
+			upperBound);
+	}
 
-		// initialize arrays
-		warp.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
-			warp[i].resize(b.size());
+	void DtwXtd_usingJSDivergence::MeasureBatch(
+		const XYXtdList &query, const vector<const XYXtdList *> &targets, vector<Real> &oResults) const
+	{
+		const bool reversed = XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence;
+		if (_c.Enable_AnalyticGaussian)
+			_hidden::WaypointMeasureBatch(
+				query, targets, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdGaussian::Build(traj, _c.MonteCarloDomainSize); },
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				oResults);
+		else
+			_hidden::WaypointMeasureBatch(
+				query, targets, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdParticleCloud::Build(traj, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize); },
+				[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+				{ return CloudDistance(ca, cb); },
+				oResults);
+	}
 
-		for (size_t i = 0; i < a.size(); i++)
-		{
-			for (size_t j = 0; j < b.size(); j++)
-			{
-				if (i == 0 && j == 0)
-					warp[i][j] = 0;
-				else
-				{
-					Degree aDir, bDir;
-					aDir = (i == (a.size() - 1)) ? a[i - 1].Pos.AngleTo(a[i].Pos) : a[i].Pos.AngleTo(a[i + 1].Pos);
-					bDir = (j == (b.size() - 1)) ? b[j - 1].Pos.AngleTo(b[j].Pos) : b[j].Pos.AngleTo(b[j + 1].Pos);
-
-					warp[i][j] =
-						JSDivergenceDistance(a[i], aDir, b[j], bDir,
-											 {_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon}) +
-						min({(i >= 1 ? warp[i - 1][j] : numeric_limits<Real>::max()),
-							 (j >= 1 ? warp[i][j - 1] : numeric_limits<Real>::max()),
-							 ((i >= 1 && j >= 1) ? warp[i - 1][j - 1] : numeric_limits<Real>::max())});
-
-					assert(!isnan(warp[i][j]));
-					assert(warp[i][j] >= 0);
-				}
-			}
-		}
-		assert(warp[a.size() - 1][b.size() - 1] >= 0);
-		return warp[a.size() - 1][b.size() - 1] / (Real)(a.size() + b.size());
+	bool DtwXtd_usingJSDivergence::MeasureMatrix(const vector<XYXtdList> &data, MatrixXR &oMatrix) const
+	{
+		const bool reversed = XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence;
+		if (_c.Enable_AnalyticGaussian)
+			_hidden::WaypointMeasureMatrix(
+				data, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdGaussian::Build(traj, _c.MonteCarloDomainSize); },
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				oMatrix);
+		else
+			_hidden::WaypointMeasureMatrix(
+				data, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdParticleCloud::Build(traj, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize); },
+				[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+				{ return CloudDistance(ca, cb); },
+				oMatrix);
+		return true;
 	}
 
 	void DtwXtd_usingWasserstein::Initialize(const string configFilePath)
@@ -570,44 +1116,93 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 
 		cli->add_option("--MonteCarloErrorEpsilon", _cDefault.MonteCarloErrorEpsilon,
 						"Error threshold for Monte Carlo integration.");
+
+		cli->add_option("--Enable_AnalyticGaussian", _cDefault.Enable_AnalyticGaussian,
+						"Computes 2-Wasserstein distance of moment-matched normals instead of EMD of Monte Carlo samples.");
+
+		cli->add_option("--Enable_Sinkhorn", _cDefault.Enable_Sinkhorn,
+						"Computes entropic(Sinkhorn) transport cost of Monte Carlo samples instead of exact EMD.");
+
+		cli->add_option("--SinkhornRegularization", _cDefault.SinkhornRegularization,
+						"Entropic regularization of Sinkhorn distance relative to the mean ground distance.");
+
+		cli->add_option("--Enable_WarmStart", _cDefault.Enable_WarmStart,
+						"Starts EMD of each DTW cell from the optimal basis of the previous cell.");
+	}
+
+	Real DtwXtd_usingWasserstein::CloudDistance(const XtdParticleCloud &a, const XtdParticleCloud &b) const
+	{
+		if (_c.Enable_Sinkhorn)
+			return SinkhornDistance(
+				a, b, {_c.SinkhornRegularization, _cDefault_Sinkhorn.maxIteration, _cDefault_Sinkhorn.tolerance});
+		return WassersteinDistance(a, b, _c.Enable_WarmStart);
+	}
+
+	Real DtwXtd_usingWasserstein::GaussianDistance(const XtdGaussian &a, const XtdGaussian &b) const
+	{
+		return GaussianWassersteinDistance(a, b);
 	}
 
 	Real DtwXtd_usingWasserstein::Measure_core(
-		const XYXtdList &a, const XYXtdList &b) const
+		const XYXtdList &a, const XYXtdList &b, Real upperBound) const
 	{
-		vector<vector<Real>> warp;
+		if (_c.Enable_AnalyticGaussian)
+			return _hidden::WaypointDtw(
+				XtdGaussian::Build(a, _c.MonteCarloDomainSize),
+				XtdGaussian::Build(b, _c.MonteCarloDomainSize),
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				upperBound);
+		return _hidden::WaypointDtw(
+			XtdParticleCloud::Build(a, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize),
+			XtdParticleCloud::Build(b, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize),
+			[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+			{ return CloudDistance(ca, cb); },
+			upperBound);
+	}
 
-		// initialize arrays
-		warp.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
-			warp[i].resize(b.size());
+	void DtwXtd_usingWasserstein::MeasureBatch(
+		const XYXtdList &query, const vector<const XYXtdList *> &targets, vector<Real> &oResults) const
+	{
+		const bool reversed = XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence;
+		if (_c.Enable_AnalyticGaussian)
+			_hidden::WaypointMeasureBatch(
+				query, targets, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdGaussian::Build(traj, _c.MonteCarloDomainSize); },
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				oResults);
+		else
+			_hidden::WaypointMeasureBatch(
+				query, targets, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdParticleCloud::Build(traj, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize); },
+				[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+				{ return CloudDistance(ca, cb); },
+				oResults);
+	}
 
-		for (size_t i = 0; i < a.size(); i++)
-		{
-			for (size_t j = 0; j < b.size(); j++)
-			{
-				if (i == 0 && j == 0)
-					warp[i][j] = 0;
-				else
-				{
-					Degree aDir, bDir;
-					aDir = (i == (a.size() - 1)) ? a[i - 1].Pos.AngleTo(a[i].Pos) : a[i].Pos.AngleTo(a[i + 1].Pos);
-					bDir = (j == (b.size() - 1)) ? b[j - 1].Pos.AngleTo(b[j].Pos) : b[j].Pos.AngleTo(b[j + 1].Pos);
-
-					warp[i][j] =
-						WassersteinDistance(a[i], aDir, b[j], bDir,
-											{_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon}) +
-						min({(i >= 1 ? warp[i - 1][j] : numeric_limits<Real>::max()),
-							 (j >= 1 ? warp[i][j - 1] : numeric_limits<Real>::max()),
-							 ((i >= 1 && j >= 1) ? warp[i - 1][j - 1] : numeric_limits<Real>::max())});
-
-					assert(!isnan(warp[i][j]));
-					assert(warp[i][j] >= 0);
-				}
-			}
-		}
-		assert(warp[a.size() - 1][b.size() - 1] >= 0);
-		return warp[a.size() - 1][b.size() - 1] / (Real)(a.size() + b.size());
+	bool DtwXtd_usingWasserstein::MeasureMatrix(const vector<XYXtdList> &data, MatrixXR &oMatrix) const
+	{
+		const bool reversed = XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence;
+		if (_c.Enable_AnalyticGaussian)
+			_hidden::WaypointMeasureMatrix(
+				data, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdGaussian::Build(traj, _c.MonteCarloDomainSize); },
+				[this](const XtdGaussian &ga, const XtdGaussian &gb)
+				{ return GaussianDistance(ga, gb); },
+				oMatrix);
+		else
+			_hidden::WaypointMeasureMatrix(
+				data, reversed,
+				[this](const XYXtdList &traj)
+				{ return XtdParticleCloud::Build(traj, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize); },
+				[this](const XtdParticleCloud &ca, const XtdParticleCloud &cb)
+				{ return CloudDistance(ca, cb); },
+				oMatrix);
+		return true;
 	}
 
 	void DtwXtd_BlendedDistance::Initialize(const string configFilePath)
@@ -644,57 +1239,79 @@ namespace HashColon::Feline::XtdTrajectoryClustering
 						"Blend coefficient for PF distance.");
 	}
 
-	Real DtwXtd_BlendedDistance::Measure_core(
-		const XYXtdList &a, const XYXtdList &b) const
+	_hidden::BlendedWaypoints DtwXtd_BlendedDistance::Prepare(const XYXtdList &traj) const
 	{
-		vector<vector<Real>> warp;
-
-		// initialize arrays
-		warp.resize(a.size());
-		for (size_t i = 0; i < a.size(); i++)
-			warp[i].resize(b.size());
+		_hidden::BlendedWaypoints re;
+		re.Traj = traj;
+		re.Direction = _hidden::WaypointDirections(traj);
+		// JS and WS share the same clouds
+		if (_c.Coeff_JS > 0 || _c.Coeff_WS > 0)
+			re.Cloud = XtdParticleCloud::Build(traj, _c.MonteCarloDomainUnit, _c.MonteCarloDomainSize);
+		return re;
+	}
 
-		for (size_t i = 0; i < a.size(); i++)
+	Real DtwXtd_BlendedDistance::PreparedDtw(
+		const _hidden::BlendedWaypoints &a, const _hidden::BlendedWaypoints &b, Real upperBound) const
+	{
+		// Euclidean and PF terms are cheap and evaluated for every cell
+		auto cheapCost = [&a, &b, this](size_t i, size_t j)
 		{
-			for (size_t j = 0; j < b.size(); j++)
+			Real re = 0;
+			if (_c.Coeff_Euclidean > 0)
+				re += _c.Coeff_Euclidean * a.Traj[i].Pos.DistanceTo(b.Traj[j].Pos);
+			if (_c.Coeff_PF > 0)
+				re += _c.Coeff_PF * PFDistance(a.Traj[i], a.Direction[i], b.Traj[j], b.Direction[j], {_c.Pf_XtdSigmaRatio});
+			return re;
+		};
+
+		if (a.Cloud.empty() && b.Cloud.empty())
+			return _hidden::RollingDtw(a.Traj.size(), b.Traj.size(), cheapCost, upperBound);
+
+		// JS and WS terms are non-negative, therefore the cheap terms bound the cost from below
+		return _hidden::LazyDtw(
+			a.Traj.size(), b.Traj.size(), cheapCost,
+			[&a, &b, &cheapCost, this](size_t i, size_t j)
 			{
-				if (i == 0 && j == 0)
-					warp[i][j] = 0;
-				else
-				{
-					Degree aDir, bDir;
-					aDir = (i == (a.size() - 1)) ? a[i - 1].Pos.AngleTo(a[i].Pos) : a[i].Pos.AngleTo(a[i + 1].Pos);
-					bDir = (j == (b.size() - 1)) ? b[j - 1].Pos.AngleTo(b[j].Pos) : b[j].Pos.AngleTo(b[j + 1].Pos);
-
-					// debug
-					Real D_Euclidean = a[i].Pos.DistanceTo(b[j].Pos);
-					Real D_JS = JSDivergenceDistance(a[i], aDir, b[j], bDir,
-													 {_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon});
-					Real D_PF = PFDistance(a[i], aDir, b[j], bDir, {_c.Pf_XtdSigmaRatio});
-					Real D_WS = WassersteinDistance(a[i], aDir, b[j], bDir,
-													{_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon});
-
-					warp[i][j] =
-						(_c.Coeff_Euclidean > 0 ? _c.Coeff_Euclidean * a[i].Pos.DistanceTo(b[j].Pos) : 0) +
-						(_c.Coeff_JS > 0 ? _c.Coeff_JS * JSDivergenceDistance(a[i], aDir, b[j], bDir,
-																			  {_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon})
-										 : 0) +
-						(_c.Coeff_PF > 0 ? _c.Coeff_PF * PFDistance(a[i], aDir, b[j], bDir, {_c.Pf_XtdSigmaRatio}) : 0) +
-						(_c.Coeff_WS > 0 ? _c.Coeff_WS * WassersteinDistance(a[i], aDir, b[j], bDir,
-																			 {_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon})
-										 : 0) +
-						+min({(i >= 1 ? warp[i - 1][j] : numeric_limits<Real>::max()),
-							  (j >= 1 ? warp[i][j - 1] : numeric_limits<Real>::max()),
-							  ((i >= 1 && j >= 1) ? warp[i - 1][j - 1] : numeric_limits<Real>::max())});
-
-					assert(!isnan(warp[i][j]));
-					assert(warp[i][j] >= 0);
-				}
-			}
-		}
+				Real re = cheapCost(i, j);
+				if (_c.Coeff_JS > 0)
+					re += _c.Coeff_JS * JSDivergenceDistance(
+											a.Cloud[i], b.Cloud[j],
+											{_c.MonteCarloDomainUnit, _c.MonteCarloDomainSize, _c.MonteCarloErrorEpsilon});
+				if (_c.Coeff_WS > 0)
+					re += _c.Coeff_WS * WassersteinDistance(a.Cloud[i], b.Cloud[j]);
+				return re;
+			},
+			upperBound);
+	}
 
-		assert(warp[a.size() - 1][b.size() - 1] >= 0);
-		return warp[a.size() - 1][b.size() - 1] / (Real)(a.size() + b.size());
+	Real DtwXtd_BlendedDistance::Measure_core(
+		const XYXtdList &a, const XYXtdList &b, Real upperBound) const
+	{
+		return PreparedDtw(Prepare(a), Prepare(b), upperBound);
+	}
+
+	void DtwXtd_BlendedDistance::MeasureBatch(
+		const XYXtdList &query, const vector<const XYXtdList *> &targets, vector<Real> &oResults) const
+	{
+		_hidden::PreparedMeasureBatch(
+			query, targets, XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence,
+			[this](const XYXtdList &traj)
+			{ return Prepare(traj); },
+			[this](const _hidden::BlendedWaypoints &pa, const _hidden::BlendedWaypoints &pb, Real upperBound)
+			{ return PreparedDtw(pa, pb, upperBound); },
+			oResults);
+	}
+
+	bool DtwXtd_BlendedDistance::MeasureMatrix(const vector<XYXtdList> &data, MatrixXR &oMatrix) const
+	{
+		_hidden::PreparedMeasureMatrix(
+			data, XtdTrajectoryDistanceMeasureBase::_c.Enable_ReversedSequence,
+			[this](const XYXtdList &traj)
+			{ return Prepare(traj); },
+			[this](const _hidden::BlendedWaypoints &pa, const _hidden::BlendedWaypoints &pb, Real upperBound)
+			{ return PreparedDtw(pa, pb, upperBound); },
+			oMatrix);
+		return true;
 	}
 
 	void Initialize_All_XtdTrajectoryDistanceMeasure()
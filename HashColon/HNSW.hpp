@@ -0,0 +1,119 @@
+#ifndef HASHCOLON_HNSW
+#define HASHCOLON_HNSW
+
+// std libraries
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+// dependant external libraries
+#include <Eigen/Eigen>
+// HashColon libraries
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+
+namespace HashColon
+{
+	/*
+	 * HNSW
+	 * Hierarchical navigable small world graph for approximate nearest neighbor search of fixed-length vectors.
+	 * Distance is Euclidean. Vectors are stored in float.
+	 * Malkov & Yashunin, "Efficient and robust approximate nearest neighbor search
+	 * using Hierarchical Navigable Small World graphs", IEEE TPAMI, 2018.
+	 * Items are inserted in parallel, each node guarded by its own lock.
+	 * Add must not run together with Search. Search may run concurrently with other searches.
+	 */
+	class HNSW
+	{
+	public:
+		struct _Params
+		{
+			size_t M;			   // max neighbors of a node in upper layers. 2M in the bottom layer
+			size_t EfConstruction; // size of the dynamic candidate list while inserting
+			size_t EfSearch;	   // size of the dynamic candidate list while searching. at least k is used
+			unsigned int Seed;	   // random seed for the layers of nodes
+		};
+
+		// (item index, distance) pairs, closest first
+		using ResultList = std::vector<std::pair<size_t, HashColon::Real>>;
+
+		HASHCOLON_CLASS_EXCEPTION_DEFINITION(HNSW);
+
+	protected:
+		static inline _Params _cDefault;
+		_Params _c;
+
+		size_t _dim;
+		size_t _size = 0;
+		std::vector<float> _data;
+		std::vector<int> _levels;
+		// bottom layer links of node i: _links0[i * (2M + 1)] is the count, followed by neighbor ids
+		std::vector<std::uint32_t> _links0;
+		// links of node i in layer l >= 1 starts at _linksUpper[i][(l - 1) * (M + 1)], count first
+		std::vector<std::vector<std::uint32_t>> _linksUpper;
+		std::unique_ptr<std::mutex[]> _locks;
+		size_t _lockCapacity = 0;
+		std::mutex _entryLock;
+		std::uint32_t _entry = 0;
+		int _maxLevel = -1;
+		std::mt19937 _rng;
+
+		const float *Vec(std::uint32_t i) const { return _data.data() + (size_t)i * _dim; };
+		size_t MaxLinks(int layer) const { return layer == 0 ? 2 * _c.M : _c.M; };
+		std::uint32_t *Links(std::uint32_t i, int layer);
+		const std::uint32_t *Links(std::uint32_t i, int layer) const;
+		void Reserve(size_t capacity);
+		void InsertNode(std::uint32_t id);
+
+		// ef closest nodes to q in a layer from entry, farthest first. (squared distance, id)
+		std::vector<std::pair<float, std::uint32_t>> SearchLayer(
+			const float *q, std::uint32_t entry, size_t ef, int layer, bool lockNodes) const;
+		// greedy descent from entry at topLayer through the upper layers down to layer stopLayer + 1
+		std::uint32_t Descend(const float *q, std::uint32_t entry, int topLayer, int stopLayer, bool lockNodes) const;
+		// neighbor selection heuristic of the paper(Algorithm 4) on candidates sorted closest first
+		std::vector<std::uint32_t> SelectNeighbors(
+			const std::vector<std::pair<float, std::uint32_t>> &candidates, size_t maxCnt) const;
+
+	public:
+		using Ptr = std::shared_ptr<HNSW>;
+
+		HNSW(size_t dimension, _Params params = _cDefault);
+		HNSW(const HNSW &) = delete;
+		HNSW &operator=(const HNSW &) = delete;
+
+		static void Initialize(
+			const std::string configFilePath = "",
+			const std::string configNamespace = "HNSW");
+
+		static _Params GetDefaultParams() { return _cDefault; };
+		_Params GetParams() const { return _c; };
+		void SetEfSearch(size_t ef) { _c.EfSearch = ef; };
+
+		size_t GetDimension() const { return _dim; };
+		size_t size() const { return _size; };
+
+		// removes all items
+		void Clear();
+		// adds each row of vectors as an item, indexed in the order of addition. parallel.
+		void Add(const Eigen::MatrixXR &vectors);
+		// clears the index and adds vectors
+		void Build(const Eigen::MatrixXR &vectors);
+
+		// approximately k nearest items of query. ef = 0 uses EfSearch.
+		ResultList Search(const Eigen::VectorXR &query, size_t k, size_t ef = 0) const;
+		// Search for each row of queries. parallel.
+		std::vector<ResultList> Search(const Eigen::MatrixXR &queries, size_t k, size_t ef = 0) const;
+
+		// binary persistence. Load replaces the whole index including its parameters.
+		void Save(std::ostream &os) const;
+		void Save(const std::string filepath) const;
+		void Load(std::istream &is);
+		void Load(const std::string filepath);
+	};
+}
+
+#endif
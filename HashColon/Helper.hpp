@@ -3,6 +3,7 @@
 
 // std libraries
 #include <chrono>
+#include <deque>
 #include <functional>
 #include <string>
 #include <vector>
@@ -207,6 +208,33 @@ namespace HashColon
 	};
 }
 
+// per-thread reusable scratch memory
+namespace HashColon
+{
+	/*
+	 * ScratchBuffer
+	 * Thread-local buffers reused across calls of hot loops such as dynamic programming measures.
+	 * Buffers keep their capacity, therefore the steady state performs no heap allocation.
+	 * Tag separates buffers of different users so that nested users do not overwrite each other.
+	 * A reference is valid until the same (Tag, idx) buffer is requested again on the same thread.
+	 */
+	template <typename T, typename Tag = void>
+	class ScratchBuffer
+	{
+	public:
+		// idx-th buffer of the calling thread, filled with size copies of value
+		static std::vector<T> &Get(size_t idx, size_t size, const T &value = T())
+		{
+			// deque keeps references of existing buffers valid while growing
+			thread_local std::deque<std::vector<T>> buffers;
+			if (buffers.size() <= idx)
+				buffers.resize(idx + 1);
+			buffers[idx].assign(size, value);
+			return buffers[idx];
+		}
+	};
+}
+
 #define AsLambda(func) [&](auto &&...args) -> decltype(func(std::forward<decltype(args)>(args)...)) { return func(std::forward<decltype(args)>(args)...); }
 
 //// Typenames helper functions
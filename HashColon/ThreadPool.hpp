@@ -2,66 +2,175 @@
 #define HASHCOLON_THREADPOOL
 
 // std libraries
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <new>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 // This module is inspired by
 // * caolan/async: Async JS library : https://github.com/caolan/async
 // This module [uses/modified from] the following library
 // * vit-vit/CTPL: Cpp Thread Pool Library : https://github.com/vit-vit/CTPL
+// Work-stealing deque of ThreadPool follows
+// * Chase & Lev, "Dynamic circular work-stealing deque", SPAA 2005
+// * Le et al., "Correct and efficient work-stealing for weak memory models", PPoPP 2013
+// Priority scheduling of PriorityThreadPool follows
+// * Rihani, Sanders & Dementiev, "MultiQueues: Simple relaxed concurrent priority queues", SPAA 2015
 
 namespace HashColon::_hidden
 {
-    class TSQueue
+    // type-erased void(int id) task.
+    // callables up to InlineSize bytes are stored in place, larger ones on the heap.
+    // nodes are recycled through per-thread caches, so a task costs no heap allocation in the steady state.
+    class TaskNode
     {
-    protected:
-        using FuncT = std::function<void(int id)> *;
-        std::queue<FuncT> q;
-        std::mutex m;
+    public:
+        static constexpr size_t InlineSize = 56;
+
+        template <typename F>
+        void Set(F &&f)
+        {
+            using D = std::decay_t<F>;
+            if constexpr (sizeof(D) <= InlineSize && alignof(D) <= alignof(std::max_align_t))
+            {
+                new (buf) D(std::forward<F>(f));
+                invoke = [](TaskNode *n, int id) { (*std::launder(reinterpret_cast<D *>(n->buf)))(id); };
+                destroy = [](TaskNode *n) { std::launder(reinterpret_cast<D *>(n->buf))->~D(); };
+            }
+            else
+            {
+                *reinterpret_cast<D **>(buf) = new D(std::forward<F>(f));
+                invoke = [](TaskNode *n, int id) { (**reinterpret_cast<D **>(n->buf))(id); };
+                destroy = [](TaskNode *n) { delete *reinterpret_cast<D **>(n->buf); };
+            }
+        }
+
+        void Run(int id) { invoke(this, id); }
+        void Reset() { destroy(this); }
+
+        TaskNode *next = nullptr; // link in node caches
+
+    private:
+        alignas(std::max_align_t) unsigned char buf[InlineSize];
+        void (*invoke)(TaskNode *, int) = nullptr;
+        void (*destroy)(TaskNode *) = nullptr;
+    };
 
+    TaskNode *AllocTaskNode();
+    // destroys the callable and recycles the node
+    void FreeTaskNode(TaskNode *n);
+
+    // Chase-Lev deque. Push/Take by the owner thread at the bottom, Steal by any thread at the top.
+    class WorkStealingDeque
+    {
     public:
-        bool Push(FuncT const &v);
-        bool Pop(FuncT &v);
-        bool Empty();
+        WorkStealingDeque();
+        ~WorkStealingDeque();
+        WorkStealingDeque(const WorkStealingDeque &) = delete;
+        WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+        void Push(TaskNode *x);
+        TaskNode *Take();
+        // nullptr if empty or lost a race with another thief
+        TaskNode *Steal();
+        bool Empty() const;
+
+    private:
+        struct Array
+        {
+            std::int64_t cap;
+            std::unique_ptr<std::atomic<TaskNode *>[]> items;
+            explicit Array(std::int64_t c) : cap(c), items(new std::atomic<TaskNode *>[c]) {}
+            TaskNode *Get(std::int64_t i) const { return items[i & (cap - 1)].load(std::memory_order_relaxed); }
+            void Put(std::int64_t i, TaskNode *x) { items[i & (cap - 1)].store(x, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<std::int64_t> top;
+        alignas(64) std::atomic<std::int64_t> bottom;
+        std::atomic<Array *> array;
+        // arrays replaced by growth. thieves may still read them, so they live until the deque dies.
+        std::vector<std::unique_ptr<Array>> retired;
     };
 
-    class TSPriorityQueue
+    // MultiQueue: relaxed concurrent priority queue of tasks, the largest key first.
+    // Items are spread over independent heaps each with its own lock. Push goes to a random heap,
+    // Pop takes the better top of two random heaps. No global lock, so producers and consumers scale.
+    // Pop returns one of the largest keys with high probability, not always the largest: rank error is O(number of heaps).
+    class MultiQueue
     {
-    protected:
-        using FuncT = std::function<void(int id)> *;
-        struct ItemT
+    public:
+        explicit MultiQueue(size_t nQueues);
+        MultiQueue(const MultiQueue &) = delete;
+        MultiQueue &operator=(const MultiQueue &) = delete;
+
+        void Push(TaskNode *x, double key);
+        // nullptr if empty
+        TaskNode *Pop();
+        bool Empty() const { return size.load() == 0; }
+
+    private:
+        struct Item
         {
-            FuncT f;
-            size_t priority;
+            double key;
+            TaskNode *task;
         };
-        struct ItemTCmp
+        struct ItemCmp
         {
-            bool operator()(ItemT &a, ItemT &b) { return a.priority < b.priority; };
+            bool operator()(const Item &a, const Item &b) const { return a.key < b.key; };
+        };
+        struct alignas(64) SubQueue
+        {
+            std::mutex m;
+            std::vector<Item> heap;
+            std::atomic<double> top; // key of the top item, -infinity if empty. read without the lock
         };
 
-        std::priority_queue<ItemT, std::vector<ItemT>, ItemTCmp> q;
-        std::mutex m;
+        // pops the top of q. q.m should be locked. nullptr if q is empty.
+        TaskNode *PopLocked(SubQueue &q);
 
-    public:
-        bool Push(FuncT const &v, size_t priority);
-        bool Pop(FuncT &v);
-        bool Empty();
+        size_t nQueues;
+        std::unique_ptr<SubQueue[]> queues;
+        std::atomic<size_t> size;
     };
 }
 
 namespace HashColon
 {
+    class TaskGroup;
+
+    // Work-stealing thread pool.
+    // Each worker owns a deque: tasks pushed from a worker go to its own deque(LIFO), idle workers steal from others(FIFO).
+    // Tasks pushed from other threads go to the inbox of a worker chosen round-robin.
+    // Sleeping workers are notified only if there is any.
     class ThreadPool
     {
+        friend class TaskGroup;
 
     public:
+        // how ParallelFor/ParallelReduce split the range among threads
+        // Static: contiguous blocks(or chunks dealt round-robin if chunk is given). the least overhead for even work.
+        // Dynamic: threads take chunks of the given size one by one. for uneven work.
+        // Guided: like Dynamic, chunks shrink from remaining / (2 x threads) down to the given size.
+        enum class Schedule
+        {
+            Static,
+            Dynamic,
+            Guided
+        };
+
         ThreadPool();
         ThreadPool(int nThreads);
 
@@ -90,19 +199,28 @@ namespace HashColon
         // may be called asynchronously to not pause the calling thread while waiting
         // if isWait == true, all the functions in the queue are run, otherwise the queue is cleared without running the functions
         void Stop(bool isWait = false);
+
+        // wait for all the functions in the queue and running ones to be finished. the threads keep running.
+        // should not be called from a function running in this pool. returns immediately if there is no thread.
         void Wait();
 
+        // run f(id) without a future. no allocation for small callables.
+        // f should not throw: an exception escaping f terminates the program, as in std::thread.
+        template <typename F>
+        void Post(F &&f)
+        {
+            _hidden::TaskNode *n = _hidden::AllocTaskNode();
+            n->Set(std::forward<F>(f));
+            this->Enqueue(n);
+        }
+
         template <typename F, typename... Rest>
         auto Push(F &&f, Rest &&...rest) -> std::future<decltype(f(0, rest...))>
         {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
-                std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
-            auto _f = new std::function<void(int id)>([pck](int id)
-                                                      { (*pck)(id); });
-            this->q.Push(_f);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            // arguments are copied(or moved) into the task, as std::bind does
+            return this->Push(
+                [f = std::forward<F>(f), args = std::make_tuple(std::forward<Rest>(rest)...)](int id) mutable
+                { return std::apply([&f, id](auto &...a) { return f(id, a...); }, args); });
         }
 
         // run the user's function that excepts argument int - id of the running thread. returned value is templatized
@@ -110,13 +228,48 @@ namespace HashColon
         template <typename F>
         auto Push(F &&f) -> std::future<decltype(f(0))>
         {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0))(int)>>(std::forward<F>(f));
-            auto _f = new std::function<void(int id)>([pck](int id)
-                                                      { (*pck)(id); });
-            this->q.Push(_f);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            std::packaged_task<decltype(f(0))(int)> pck(std::forward<F>(f));
+            auto re = pck.get_future();
+            this->Post(std::move(pck));
+            return re;
+        }
+
+        // f(id, i) for each i in [begin, end), blocks until all finish. the first exception thrown by f is rethrown.
+        // chunk = 0 chooses the chunk size automatically. if there is no thread, runs in the calling thread with id 0.
+        // may be called from a function running in this pool: the waiting thread runs other tasks meanwhile.
+        template <typename F>
+        void ParallelFor(size_t begin, size_t end, F &&f, Schedule schedule = Schedule::Static, size_t chunk = 0)
+        {
+            this->ForChunks(begin, end, schedule, chunk, this->RunnerCount(begin, end, schedule, chunk),
+                            [&f](int id, size_t, size_t lo, size_t hi)
+                            {
+                                for (size_t i = lo; i < hi; i++)
+                                    f(id, i);
+                            });
+        }
+
+        // reduce(... reduce(reduce(identity, map(id, begin)), map(id, begin + 1)) ..., map(id, end - 1)) in parallel.
+        // reduce should be associative and reduce(identity, x) == x.
+        // each thread reduces its part, then the parts are reduced in order.
+        // the result is deterministic with Schedule::Static for the same thread count.
+        template <typename T, typename MapF, typename ReduceF>
+        T ParallelReduce(size_t begin, size_t end, T identity, MapF &&map, ReduceF &&reduce,
+                         Schedule schedule = Schedule::Static, size_t chunk = 0)
+        {
+            const size_t runners = this->RunnerCount(begin, end, schedule, chunk);
+            std::vector<T> parts(runners, identity);
+            this->ForChunks(begin, end, schedule, chunk, runners,
+                            [&parts, &map, &reduce](int id, size_t r, size_t lo, size_t hi)
+                            {
+                                T acc = std::move(parts[r]);
+                                for (size_t i = lo; i < hi; i++)
+                                    acc = reduce(std::move(acc), map(id, i));
+                                parts[r] = std::move(acc);
+                            });
+            T re = std::move(identity);
+            for (T &part : parts)
+                re = reduce(std::move(re), std::move(part));
+            return re;
         }
 
     private:
@@ -126,25 +279,197 @@ namespace HashColon
         ThreadPool &operator=(const ThreadPool &); // = delete;
         ThreadPool &operator=(ThreadPool &&);      // = delete;
 
+        struct Inbox
+        {
+            std::mutex m;
+            std::vector<_hidden::TaskNode *> items;
+            std::atomic<size_t> count{0}; // size of items, checked before locking
+            bool closed = false;          // the owner retired. pushes are redirected to the pool inbox
+        };
+
+        struct Worker
+        {
+            int id;
+            std::unique_ptr<std::thread> thread;
+            std::atomic<bool> flag{false}; // the worker finishes after the current task
+            std::atomic<bool> retiring{false}; // removed by ChangeThreadCount, its tasks are handed over to the pool
+            _hidden::WorkStealingDeque deque;
+            Inbox inbox;
+            std::vector<_hidden::TaskNode *> drained; // spare buffer swapped with the inbox
+            std::uint32_t rng;
+        };
+        using WorkerList = std::vector<Worker *>;
+
         void SetThread(int i);
         void Init();
+        void Enqueue(_hidden::TaskNode *n);
+        void Notify();
+        void WorkerLoop(Worker *w);
+        // a task for worker w(nullptr for other threads) from its deque, inboxes or other deques
+        _hidden::TaskNode *FindTask(Worker *w);
+        // moves tasks of inbox into w's deque and returns one of them. takes only one if w is nullptr.
+        _hidden::TaskNode *TakeInbox(Worker *w, Inbox &inbox);
+        // pushes into inbox, or into the pool inbox if inbox is closed
+        void PushInbox(Inbox &inbox, _hidden::TaskNode *n);
+        // whether any inbox or deque has a task. approximate, for waking more workers.
+        bool HasQueuedTasks() const;
+        // counts a finished(or removed) task for Wait
+        void TaskDone();
+        // runs one queued task if the calling thread is a worker of this pool, or with id 0 if the pool has no thread.
+        // false if neither or found none.
+        bool RunPendingTask();
+        bool IsWorkerThread() const;
+
+        // number of tasks [begin, end) is split into. at most the number of threads, at least 1 for a non-empty range.
+        size_t RunnerCount(size_t begin, size_t end, Schedule schedule, size_t chunk) const;
+        // body(id, runner index, lo, hi) on chunks covering [begin, end), one task per runner
+        template <typename Body>
+        void ForChunks(size_t begin, size_t end, Schedule schedule, size_t chunk, size_t runners, Body &&body);
+
+        // all workers ever created, including retired ones. owned until Stop.
+        std::vector<std::unique_ptr<Worker>> allWorkers;
+        // active workers. replaced(not modified) when the number of threads changes, old lists are kept alive.
+        std::atomic<WorkerList *> workers;
+        std::vector<std::unique_ptr<WorkerList>> workerLists;
+        // tasks pushed while there are no workers, and tasks left by retired workers
+        Inbox poolInbox;
+        std::atomic<std::uint32_t> nextInbox;
 
-        std::vector<std::unique_ptr<std::thread>> threads;
-        std::vector<std::shared_ptr<std::atomic<bool>>> flags;
-        _hidden::TSQueue q;
         std::atomic<bool> isDone;
         std::atomic<bool> isStop;
         std::atomic<int> nWaiting; // how many threads are waiting
+        std::atomic<bool> wakePending; // a waiting thread is notified but has not checked the queues yet
+        std::atomic<int> nRetiring; // retiring workers which have not handed their tasks over yet
+        std::atomic<size_t> nPending; // tasks pushed and not finished yet
 
         std::mutex mutex;
         std::condition_variable cv;
+        std::condition_variable doneCv; // notified when nPending becomes 0
+    };
+
+    // Tasks on a ThreadPool which are waited together.
+    // Wait blocks until the tasks of this group finish, the pool keeps running for other groups.
+    // A worker of the pool waiting on a group runs other tasks of the pool meanwhile, so groups can be nested.
+    // If the pool has no thread, Wait runs the queued tasks in the calling thread with id 0, as ParallelFor does.
+    class TaskGroup
+    {
+    public:
+        TaskGroup(ThreadPool &pool) : pool(pool) {}
+        // waits for the tasks. exceptions of the tasks are discarded if not waited.
+        ~TaskGroup();
+        TaskGroup(const TaskGroup &) = delete;
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        // run f(id) in the pool. may be called from tasks of this group.
+        template <typename F>
+        void Run(F &&f)
+        {
+            this->nPending.fetch_add(1, std::memory_order_relaxed);
+            this->pool.Post(
+                [this, f = std::forward<F>(f)](int id) mutable
+                {
+                    {
+                        // destroyed before Done(): the group may be gone after that
+                        std::decay_t<F> local(std::move(f));
+                        try
+                        {
+                            local(id);
+                        }
+                        catch (...)
+                        {
+                            std::lock_guard<std::mutex> lock(this->m);
+                            if (!this->error)
+                                this->error = std::current_exception();
+                        }
+                    }
+                    this->Done();
+                });
+        }
+
+        // blocks until all the tasks run so far finish. rethrows the first exception thrown by them.
+        void Wait();
+
+    private:
+        void Done();
+        void Join();
+
+        ThreadPool &pool;
+        std::atomic<size_t> nPending{0};
+        std::mutex m;
+        std::condition_variable cv;
+        std::exception_ptr error;
     };
 
+    template <typename Body>
+    void ThreadPool::ForChunks(size_t begin, size_t end, Schedule schedule, size_t chunk, size_t runners, Body &&body)
+    {
+        if (begin >= end)
+            return;
+        if (this->ThreadCount() == 0)
+        {
+            body(0, 0, begin, end);
+            return;
+        }
+        // shared by the runners, so that a runner task fits in a TaskNode without allocation
+        struct Shared
+        {
+            Body &body;
+            size_t begin, end, n, chunk, runners;
+            bool isBlocks;
+            Schedule schedule;
+            std::atomic<size_t> next; // next index to be taken by Dynamic and Guided
+        };
+        const size_t n = end - begin;
+        if (chunk == 0 && schedule == Schedule::Dynamic)
+            chunk = std::max<size_t>(1, n / (8 * runners));
+        Shared sh{body, begin, end, n, std::max<size_t>(chunk, 1), runners, chunk == 0, schedule, {begin}};
+
+        TaskGroup group(*this);
+        for (size_t r = 0; r < runners; r++)
+        {
+            group.Run(
+                [&sh, r](int id)
+                {
+                    switch (sh.schedule)
+                    {
+                    case Schedule::Static:
+                        if (sh.isBlocks)
+                            sh.body(id, r, sh.begin + sh.n * r / sh.runners, sh.begin + sh.n * (r + 1) / sh.runners);
+                        else
+                            for (size_t lo = sh.begin + r * sh.chunk; lo < sh.end; lo += sh.runners * sh.chunk)
+                                sh.body(id, r, lo, std::min(sh.end, lo + sh.chunk));
+                        break;
+                    case Schedule::Dynamic:
+                        for (size_t lo = sh.next.fetch_add(sh.chunk); lo < sh.end; lo = sh.next.fetch_add(sh.chunk))
+                            sh.body(id, r, lo, std::min(sh.end, lo + sh.chunk));
+                        break;
+                    case Schedule::Guided:
+                        for (size_t lo = sh.next.load(); lo < sh.end;)
+                        {
+                            const size_t size = std::max(sh.chunk, (sh.end - lo) / (2 * sh.runners));
+                            const size_t hi = std::min(sh.end, lo + size);
+                            if (sh.next.compare_exchange_weak(lo, hi))
+                            {
+                                sh.body(id, r, lo, hi);
+                                lo = sh.next.load();
+                            }
+                        }
+                        break;
+                    }
+                });
+        }
+        group.Wait();
+    }
+
+    // Thread pool running tasks of larger priority first.
+    // Tasks are scheduled by a MultiQueue: the order is approximate, in exchange for scaling with many producers.
+    // Aging: a task gains agingRate of priority per second while waiting, so that low priority tasks do not starve.
+    // A task waits behind newer tasks at most (difference of priorities) / agingRate seconds. agingRate = 0 disables aging.
     class PriorityThreadPool
     {
     public:
         PriorityThreadPool();
-        PriorityThreadPool(int nThreads);
+        PriorityThreadPool(int nThreads, double agingRate = 0);
 
         // the destructor waits for all the functions in the queue to be finished
         ~PriorityThreadPool();
@@ -173,17 +498,28 @@ namespace HashColon
         void Stop(bool isWait = false);
         void Wait();
 
+        // priority gained per second of waiting. affects the tasks pushed afterwards.
+        double GetAgingRate() const { return this->agingRate; }
+        void SetAgingRate(double rate) { this->agingRate = rate; }
+
+        // run f(id) without a future. no allocation for small callables.
+        // f should not throw: an exception escaping f terminates the program, as in std::thread.
+        template <typename F>
+        void Post(size_t priority, F &&f)
+        {
+            _hidden::TaskNode *n = _hidden::AllocTaskNode();
+            n->Set(std::forward<F>(f));
+            this->Enqueue(n, priority);
+        }
+
         template <typename F, typename... Rest>
         auto Push(size_t priority, F &&f, Rest &&...rest) -> std::future<decltype(f(0, rest...))>
         {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
-                std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
-            auto _f = new std::function<void(int id)>([pck](int id)
-                                                      { (*pck)(id); });
-            this->q.Push(_f, priority);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            // arguments are copied(or moved) into the task, as std::bind does
+            return this->Push(
+                priority,
+                [f = std::forward<F>(f), args = std::make_tuple(std::forward<Rest>(rest)...)](int id) mutable
+                { return std::apply([&f, id](auto &...a) { return f(id, a...); }, args); });
         }
 
         // run the user's function that excepts argument int - id of the running thread. returned value is templatized
@@ -191,13 +527,10 @@ namespace HashColon
         template <typename F>
         auto Push(size_t priority, F &&f) -> std::future<decltype(f(0))>
         {
-            auto pck = std::make_shared<std::packaged_task<decltype(f(0))(int)>>(std::forward<F>(f));
-            auto _f = new std::function<void(int id)>([pck](int id)
-                                                      { (*pck)(id); });
-            this->q.Push(_f, priority);
-            std::unique_lock<std::mutex> lock(this->mutex);
-            this->cv.notify_one();
-            return pck->get_future();
+            std::packaged_task<decltype(f(0))(int)> pck(std::forward<F>(f));
+            auto re = pck.get_future();
+            this->Post(priority, std::move(pck));
+            return re;
         }
 
     private:
@@ -208,14 +541,20 @@ namespace HashColon
         PriorityThreadPool &operator=(PriorityThreadPool &&);      // = delete;
 
         void SetThread(int i);
-        void Init();
+        void Init(int nThreads, double agingRate);
+        void Enqueue(_hidden::TaskNode *n, size_t priority);
+        // wakes a waiting thread, if there is any and no wake is pending
+        void Notify();
 
         std::vector<std::unique_ptr<std::thread>> threads;
         std::vector<std::shared_ptr<std::atomic<bool>>> flags;
-        _hidden::TSPriorityQueue q;
+        std::unique_ptr<_hidden::MultiQueue> q;
+        std::atomic<double> agingRate;
+        std::chrono::steady_clock::time_point epoch; // time origin of aging
         std::atomic<bool> isDone;
         std::atomic<bool> isStop;
         std::atomic<int> nWaiting; // how many threads are waiting
+        std::atomic<bool> wakePending; // a waiting thread is notified but has not checked the queue yet
 
         std::mutex mutex;
         std::condition_variable cv;
@@ -134,6 +134,7 @@ SOFTWARE.
 #define WASSERSTEIN_NETWORK_SIMPLEX_HH
 
 // C++ standard library
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <limits>
@@ -198,7 +199,8 @@ public:
   // constructor
   NetworkSimplex(unsigned n_iter_max, Value epsilon_large_factor, Value epsilon_small_factor) :
     MAX(std::numeric_limits<Value>::max()),
-    INF(std::numeric_limits<Value>::has_infinity ? std::numeric_limits<Value>::infinity() : MAX)
+    INF(std::numeric_limits<Value>::has_infinity ? std::numeric_limits<Value>::infinity() : MAX),
+    warm_ready_(false)
   {
     set_params(n_iter_max, epsilon_large_factor, epsilon_small_factor);
   }
@@ -227,17 +229,23 @@ public:
   EMDStatus compute(std::size_t n0, std::size_t n1) {
 
     construct_graph(n0, n1);
-    EMDStatus status(run());
+    return store_total_cost(run());
+  }
 
-    // store total cost if network simplex had success
-    if (status == EMDStatus::Success) {
-      total_cost_ = 0;
-      for (Arc a = 0; a < arcNum(); a++)
-        total_cost_ += _flows[a] * _costs[a];
-    }
-    else total_cost_ = INVALID_COST_VALUE;
+  // run computation given new dists on the same graph and weights as the last successful computation,
+  // starting from its optimal spanning tree instead of the artificial one.
+  // The tree stays primal feasible as the supplies are unchanged, so only the potentials are recomputed
+  // from the new dists before pivoting. Related problems(e.g. neighbouring cells of a DTW table over
+  // particle clouds on a common grid) then take a few pivots instead of a full solve.
+  // All storage of the previous computation is reused. Falls back to compute() otherwise.
+  EMDStatus compute_warm(std::size_t n0, std::size_t n1) {
 
-    return status;
+    if (!warm_ready_ || Node(n0) != n0_ || Node(n1) != n1_ ||
+        _supplies.size() < _warm_supplies.size() ||
+        !std::equal(_warm_supplies.begin(), _warm_supplies.end(), _supplies.begin()))
+      return compute(n0, n1);
+
+    return store_total_cost(run_warm());
   }
 
   // access total cost
@@ -249,6 +257,8 @@ public:
 
   // free all memory (rarely used, probably only relevant when doing massive computations)
   void free() {
+    warm_ready_ = false;
+    free_vector(_warm_supplies);
     free_vector(_costs);
     free_vector(_supplies);
     free_vector(_flows);
@@ -291,6 +301,10 @@ private:
   // large consts initialized in constructor
   Value MAX, INF;
 
+  // the last computation succeeded, and its tree can start compute_warm() with these supplies
+  bool warm_ready_;
+  ValueVector _warm_supplies;
+
   // cost flow storage vectors
   ValueVector _costs; // ground distances between nodes
   ValueVector _supplies; // supply values of the nodes
@@ -380,11 +394,34 @@ private:
   // Initialization methods, called from `run`
   //---------------------------------------------------------------------------
 
+  // store total cost if network simplex had success
+  EMDStatus store_total_cost(EMDStatus status) {
+
+    warm_ready_ = (status == EMDStatus::Success);
+    if (status == EMDStatus::Success) {
+      total_cost_ = 0;
+      for (Arc a = 0; a < arcNum(); a++)
+        total_cost_ += _flows[a] * _costs[a];
+    }
+    else total_cost_ = INVALID_COST_VALUE;
+
+    return status;
+  }
+
+  // cost of the artificial arcs from the root to demand nodes, large enough to never be in an optimal flow
+  Value artificial_cost() const {
+    if (std::numeric_limits<Value>::is_exact)
+      return std::numeric_limits<Value>::max() / 2 + 1;
+    else
+      return (*std::max_element(_costs.begin(), _costs.begin() + arcNum()) + 1) * nodeNum();
+  }
+
   EMDStatus run() {
 
     // reset vectors that are sized according to number of nodes
     Node all_node_num(nodeNum() + 1); // includes extra 1 for root node
     _supplies.resize(all_node_num);
+    _warm_supplies.assign(_supplies.begin(), _supplies.begin() + nodeNum());
     _pis.resize(all_node_num);
     _parents.resize(all_node_num);
     _threads.resize(all_node_num);
@@ -427,11 +464,7 @@ private:
     _sum_supplies = 0;
 
     // initialize artificial cost
-    Value art_costs;
-    if (std::numeric_limits<Value>::is_exact)
-      art_costs = std::numeric_limits<Value>::max() / 2 + 1;
-    else
-      art_costs = (*std::max_element(_costs.begin(), _costs.end()) + 1) * nodeNum();
+    Value art_costs(artificial_cost());
 
     // initialize arc maps
     std::fill(_states.begin(), _states.begin() + arcNum(), STATE_LOWER);
@@ -481,6 +514,36 @@ private:
     // perform heuristic initial pivots
     if (!initialPivots()) return EMDStatus::Unbounded;
 
+    return simplex();
+  }
+
+  // run from the tree and flows of the last successful computation, see compute_warm()
+  EMDStatus run_warm() {
+
+    // dists may have been resized to the real arcs only, restore the costs of the artificial arcs
+    Arc all_arc_num(arcNum() + nodeNum());
+    Node root(nodeNum());
+    _costs.resize(all_arc_num);
+    Value art_costs(artificial_cost());
+    for (Arc e = arcNum(); e != all_arc_num; e++)
+      _costs[e] = _sources[e] == root ? art_costs : 0;
+
+    // recompute potentials along the tree in thread(preorder) order, so that tree arcs have zero reduced cost
+    _pis[root] = 0;
+    for (Node u = _threads[root]; u != root; u = _threads[u])
+      _pis[u] = _forwards[u] ? _pis[_parents[u]] - _costs[_preds[u]] : _pis[_parents[u]] + _costs[_preds[u]];
+
+    // the same heuristic pivots as a cold start, now on a tree that is already close to optimal
+    if (!initialPivots()) return EMDStatus::Unbounded;
+
+    return simplex();
+  }
+
+  // pivots until optimal, then checks feasibility
+  EMDStatus simplex() {
+
+    Arc all_arc_num(arcNum() + nodeNum());
+
     // Execute the Network Simplex algorithm
     iter_ = 0;
     while (findEnteringArc()) {
@@ -46,39 +46,44 @@ namespace HashColon::Clustering
 
 		size_t l = iTrainingData.size();
 		MatrixXR re(l, l);
+		const size_t pairCnt = l * (l - 1) / 2;
 
-		struct ijtype
+		// whole-matrix fast path of the measure, if available
+		if (MeasureFunc->MeasureMatrix(iTrainingData, re))
 		{
-			size_t i;
-			size_t j;
-		};
-		vector<ijtype> a;
+			assert((size_t)re.rows() == l && (size_t)re.cols() == l);
+			return re;
+		}
+
+		// row i is measured against (i+1 ~ l-1) in one batch.
+		// rows have different lengths, therefore dynamic scheduling.
+#pragma omp parallel for schedule(dynamic)
 		for (size_t i = 0; i < l; i++)
+		{
+			if (i + 1 >= l)
+				continue;
+
+			vector<const T *> targets(l - i - 1);
+			for (size_t j = i + 1; j < l; j++)
+				targets[j - i - 1] = &iTrainingData[j];
+
+			vector<Real> row;
+			MeasureFunc->MeasureBatch(iTrainingData[i], targets, row);
 			for (size_t j = i + 1; j < l; j++)
 			{
-				ijtype tmp;
-				tmp.i = i;
-				tmp.j = j;
-				a.push_back(tmp);
+				re(i, j) = re(j, i) = row[j - i - 1];
+				assert(!isnan(re(i, j)));
+				assert(re(i, j) >= 0);
 			}
 
-#pragma omp parallel for
-		for (size_t c = 0; c < a.size(); c++)
-		{
-			size_t &i = a[c].i;
-			size_t &j = a[c].j;
-			re(i, j) = re(j, i) = MeasureFunc->Measure(iTrainingData[i], iTrainingData[j]);
-			assert(!isnan(re(i, j)));
-			assert(re(i, j) >= 0);
-
 			// show progress
 			if (verbose)
 			{
 				lock_guard<mutex> _lg(_m);
+				progressCnt += (int)targets.size();
 				stringstream tempss;
-				tempss << "Computing distances: " << progressCnt << "/" << a.size() << " " << Percentage(++progressCnt, (int)a.size());
+				tempss << "Computing distances: " << progressCnt << "/" << pairCnt << " " << Percentage(progressCnt, (int)pairCnt);
 				logger.Message << Flashl(tempss.str());
-				// logger.Message << tempss.str() << endl;
 			}
 		}
 		if (verbose)
@@ -498,9 +503,6 @@ namespace HashColon::Clustering
 	{
 		using namespace std;
 		using namespace HashColon;
-		using Tag = HashColon::LogUtils::Tag;
-
-		CommonLogger logger;
 
 		// Assertion
 		// assert at least 1 data is given for clustering
@@ -514,54 +516,55 @@ namespace HashColon::Clustering
 		if (oLabels == nullptr)
 			throw Exception(this->GetMethodName() + " needs cluster label output for input.");
 
-		{
-			lock_guard<mutex> _lg(CommonLogger::_mutex);
-			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
-												<< "Raw distance matrix:\n"
-												<< iRawDistMatrix << endl;
-		}
+		// compute neighbors & run clustering
+		TrainModel_withNeighbors(GetNeighbors(iRawDistMatrix, isDistance), oLabels);
+	}
 
-		// if distance measure is similarity type, convert to distance
-		Eigen::MatrixXR B = isDistance ? iRawDistMatrix : ConvertSimilarity2Distance(iRawDistMatrix);
-		if (!isDistance)
-		{
-			lock_guard<mutex> _lg(CommonLogger::_mutex);
-			logger.Log({{Tag::lvl, 3}}) << this->GetMethodName() << ": Raw distance matrix conversion from similarity to distance is finished. " << endl;
-			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
-												<< "Converted distance matrix:\n"
-												<< B << endl;
-		}
+	template <typename T>
+	void DistanceBasedDBSCAN<T>::TrainModel_withWeights(
+		const Eigen::MatrixXR &iRawDistMatrix, bool isDistance,
+		const std::vector<size_t> &iWeights,
+		typename ClusteringBase<T>::LabelsPtr oLabels)
+	{
+		assert(iRawDistMatrix.cols() == iRawDistMatrix.rows());
+		assert(iWeights.size() == (size_t)iRawDistMatrix.cols());
 
-		// compute neighbors
-		vector<vector<size_t>> neighbors = GetNeighbors(B);
-		{
-			lock_guard<mutex> _lg(CommonLogger::_mutex);
-			logger.Log({{Tag::lvl, 3}}) << this->GetMethodName() << ": Neighbor computation is finished." << endl;
+		// compute neighbors & run clustering
+		TrainModel_withNeighbors(GetNeighbors(iRawDistMatrix, isDistance), oLabels, iWeights);
+	}
 
-			stringstream ss;
-			for (const auto &debugout1 : neighbors)
-			{
-				for (const auto &debugout2 : debugout1)
-				{
-					ss << debugout2 << "\t";
-				}
-				ss << "\n";
-			}
-			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
-												<< "Neighbor lists:\n"
-												<< ss.str() << endl;
-		}
+	template <typename T>
+	void DistanceBasedDBSCAN<T>::TrainModel_withNeighbors(
+		const std::vector<std::vector<size_t>> &iNeighbors,
+		typename ClusteringBase<T>::LabelsPtr oLabels,
+		const std::vector<size_t> &iWeights)
+	{
+		using namespace std;
+		using namespace HashColon;
+		using Tag = HashColon::LogUtils::Tag;
+
+		CommonLogger logger;
+
+		// Assertion
+		assert(_c.minPts > 0);
+		assert(iWeights.empty() || iWeights.size() == iNeighbors.size());
+		assert(!ClusteringBase<T>::isTrained);
+		assert(oLabels != nullptr);
+		if (ClusteringBase<T>::isTrained)
+			throw Exception("Already trained.");
+		if (oLabels == nullptr)
+			throw Exception(this->GetMethodName() + " needs cluster label output for input.");
 
 		// Initialize cluster state
 		oLabels->clear();
-		oLabels->resize(iRawDistMatrix.cols());
+		oLabels->resize(iNeighbors.size());
 
 		// set initial clustering idx as 2
 		// unclassified: 0, noise: 1, clustered: 2~
 		size_t clusterIdx = 2;
 
 		// DBSCAN algorithm: for each data points
-		for (size_t i = 0; i < (size_t)iRawDistMatrix.cols(); i++)
+		for (size_t i = 0; i < iNeighbors.size(); i++)
 		{
 			// if the point is classfied already, continue;
 			if (oLabels->at(i) != unclassified)
@@ -569,9 +572,9 @@ namespace HashColon::Clustering
 
 			// if the point is core point: has more then minPts in radius epsilon,
 			// run bfs
-			if (neighbors[i].size() >= _c.minPts)
+			if (IsCorePoint(i, iNeighbors, iWeights))
 			{
-				DbscanBfs(i, clusterIdx, neighbors, (*oLabels));
+				DbscanBfs(i, clusterIdx, iNeighbors, iWeights, (*oLabels));
 				{
 					lock_guard<mutex> _lg(CommonLogger::_mutex);
 					size_t clustersize = count_if(oLabels->begin(), oLabels->end(),
@@ -664,13 +667,79 @@ namespace HashColon::Clustering
 		return re;
 	}
 
+	template <typename T>
+	std::vector<std::vector<size_t>> DistanceBasedDBSCAN<T>::GetNeighbors(
+		const Eigen::MatrixXR &iRawDistMatrix, bool isDistance) const
+	{
+		using namespace std;
+		using namespace HashColon;
+		using Tag = HashColon::LogUtils::Tag;
+
+		CommonLogger logger;
+
+		{
+			lock_guard<mutex> _lg(CommonLogger::_mutex);
+			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
+												<< "Raw distance matrix:\n"
+												<< iRawDistMatrix << endl;
+		}
+
+		// if distance measure is similarity type, convert to distance
+		Eigen::MatrixXR B = isDistance ? iRawDistMatrix : ConvertSimilarity2Distance(iRawDistMatrix);
+		if (!isDistance)
+		{
+			lock_guard<mutex> _lg(CommonLogger::_mutex);
+			logger.Log({{Tag::lvl, 3}}) << this->GetMethodName() << ": Raw distance matrix conversion from similarity to distance is finished. " << endl;
+			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
+												<< "Converted distance matrix:\n"
+												<< B << endl;
+		}
+
+		// compute neighbors
+		vector<vector<size_t>> neighbors = GetNeighbors(B);
+		{
+			lock_guard<mutex> _lg(CommonLogger::_mutex);
+			logger.Log({{Tag::lvl, 3}}) << this->GetMethodName() << ": Neighbor computation is finished." << endl;
+
+			stringstream ss;
+			for (const auto &debugout1 : neighbors)
+			{
+				for (const auto &debugout2 : debugout1)
+				{
+					ss << debugout2 << "\t";
+				}
+				ss << "\n";
+			}
+			logger.Debug({{__CODEINFO_TAGS__}}) << "\n"
+												<< "Neighbor lists:\n"
+												<< ss.str() << endl;
+		}
+
+		return neighbors;
+	}
+
+	template <typename T>
+	bool DistanceBasedDBSCAN<T>::IsCorePoint(
+		size_t p, const std::vector<std::vector<size_t>> &neighbors, const std::vector<size_t> &weights) const
+	{
+		if (weights.empty())
+			return neighbors[p].size() >= _c.minPts;
+
+		// duplicates represented by p are neighbors of p itself
+		size_t cnt = weights[p] - 1;
+		for (const size_t &n : neighbors[p])
+			cnt += weights[n];
+		return cnt >= _c.minPts;
+	}
+
 	template <typename T>
 	void DistanceBasedDBSCAN<T>::DbscanBfs(
 		size_t initP, size_t clusterIdx,
-		std::vector<std::vector<size_t>> &neighbors, std::vector<size_t> &labels) const
+		const std::vector<std::vector<size_t>> &neighbors, const std::vector<size_t> &weights,
+		std::vector<size_t> &labels) const
 	{
 		using namespace std;
-		assert(neighbors[initP].size() >= _c.minPts);
+		assert(IsCorePoint(initP, neighbors, weights));
 		assert(labels[initP] == unclassified);
 		queue<size_t> q;
 		q.push(initP);
@@ -683,7 +752,7 @@ namespace HashColon::Clustering
 			// labels[p] = clusterIdx;
 
 			// if current point has sufficient neighbors,
-			if (neighbors[p].size() >= _c.minPts)
+			if (IsCorePoint(p, neighbors, weights))
 			{
 				// push neighbors to queue
 				for (auto &n : neighbors[p])
@@ -699,4 +768,19 @@ namespace HashColon::Clustering
 	}
 }
 
+// Evaluation functions for clustering
+namespace HashColon::Clustering
+{
+	template <typename T>
+	DistanceOracle GetDistanceOracle(
+		const typename DistanceMeasureBase<T>::Ptr measure, const std::vector<T> &data)
+	{
+		assert(measure);
+		return [measure, &data](size_t i, size_t j) -> HashColon::Real
+		{
+			return measure->Measure(data[i], data[j]);
+		};
+	}
+}
+
 #endif
@@ -3,11 +3,15 @@
 // std libraries
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <limits>
 #include <numeric>
 #include <queue>
+#include <random>
 #include <vector>
 // dependant external libraries
+#include <boost/math/distributions/normal.hpp>
+#include <boost/math/distributions/students_t.hpp>
 #include <Eigen/Eigen>
 #include <flann/flann.hpp>
 // modified external libraries
@@ -533,3 +537,249 @@ namespace HashColon::Clustering
 		return re;
 	}
 }
+
+// Sampling-based approximate evaluation functions for clustering
+namespace
+{
+	// randomly picks at most samplesPerCluster items from each cluster
+	vector<vector<size_t>> StratifiedSample(
+		const vector<size_t> &clusterResult, size_t clusterNo, size_t samplesPerCluster,
+		unsigned int seed, vector<size_t> &oClusterSize)
+	{
+		vector<vector<size_t>> members(clusterNo);
+		for (size_t i = 0; i < clusterResult.size(); i++)
+			members[clusterResult[i]].push_back(i);
+
+		mt19937 rng(seed);
+		oClusterSize.resize(clusterNo);
+		for (size_t c = 0; c < clusterNo; c++)
+		{
+			oClusterSize[c] = members[c].size();
+			if (members[c].size() <= samplesPerCluster)
+				continue;
+			// partial Fisher-Yates shuffle
+			for (size_t k = 0; k < samplesPerCluster; k++)
+			{
+				uniform_int_distribution<size_t> pick(k, members[c].size() - 1);
+				swap(members[c][k], members[c][pick(rng)]);
+			}
+			members[c].resize(samplesPerCluster);
+		}
+		return members;
+	}
+
+	// confidence interval of population mean from samples drawn without replacement.
+	// oStdErr is the standard error of the mean including finite population correction.
+	ValueInterval<Real> MeanInterval(
+		const vector<Real> &samples, size_t populationSize, Real confidenceLevel, Real &oStdErr)
+	{
+		const size_t n = samples.size();
+		ValueInterval<Real> re;
+		re.repVal = n == 0 ? 0 : accumulate(samples.begin(), samples.end(), (Real)0) / (Real)n;
+
+		if (n >= populationSize)
+			oStdErr = 0;
+		else if (n < 2)
+			oStdErr = numeric_limits<Real>::infinity();
+		else
+		{
+			Real ss = 0;
+			for (const Real &v : samples)
+				ss += (v - re.repVal) * (v - re.repVal);
+			const Real fpc = 1.0 - (Real)n / (Real)populationSize;
+			oStdErr = sqrt(ss / (Real)(n - 1) / (Real)n * fpc);
+		}
+
+		Real halfWidth = 0;
+		if (oStdErr > 0)
+		{
+			const Real t = isfinite(oStdErr)
+							   ? boost::math::quantile(boost::math::students_t((Real)(n - 1)), 0.5 + confidenceLevel / 2)
+							   : 1.0;
+			halfWidth = t * oStdErr;
+		}
+		re.minVal = re.repVal - halfWidth;
+		re.maxVal = re.repVal + halfWidth;
+		return re;
+	}
+
+	// same definition with Silhouette(itemIdx, clusterResult, DistanceMatrix)
+	Real SilhouetteOfItem(
+		size_t itemIdx, const vector<size_t> &clusterResult, size_t clusterNo,
+		const HashColon::Clustering::DistanceOracle &distFunc)
+	{
+		const size_t N = clusterResult.size();
+		vector<Real> A(clusterNo, 0.0);
+		vector<Real> cnt(clusterNo, 0.0);
+		for (size_t i = 0; i < N; i++)
+		{
+			if (i == itemIdx)
+				continue;
+			A[clusterResult[i]] += distFunc(itemIdx, i);
+			cnt[clusterResult[i]] += 1.0;
+		}
+
+		if (cnt[clusterResult[itemIdx]] <= 1.0)
+			return 0.0;
+
+		Real a_item = 0.0;
+		Real b_item = numeric_limits<Real>::max();
+		for (size_t i = 0; i < A.size(); i++)
+		{
+			if (cnt[i] == 0)
+				continue;
+			Real tmpVal = A[i] / (cnt[i]);
+			if (i == clusterResult[itemIdx])
+				a_item = tmpVal;
+			else if (tmpVal < b_item)
+				b_item = tmpVal;
+		}
+
+		Real div = a_item > b_item ? a_item : b_item;
+		return (b_item - a_item) / div;
+	}
+}
+
+namespace HashColon::Clustering
+{
+	ApproximateEvaluationResults ApproximateSilhouette(
+		const vector<size_t> &clusterResult, const DistanceOracle &distFunc,
+		size_t samplesPerCluster, Real confidenceLevel, unsigned int seed)
+	{
+		assert(clusterResult.size() > 0);
+		assert(samplesPerCluster > 0);
+		assert(confidenceLevel > 0 && confidenceLevel < 1);
+		const size_t N = clusterResult.size();
+		const size_t clusterNo = (*max_element(clusterResult.begin(), clusterResult.end())) + 1;
+
+		vector<size_t> clusterSize;
+		vector<vector<size_t>> sampled = StratifiedSample(clusterResult, clusterNo, samplesPerCluster, seed, clusterSize);
+
+		// flatten samples for parallel computation
+		vector<pair<size_t, size_t>> items; // (cluster, index in sampled[cluster])
+		for (size_t c = 0; c < clusterNo; c++)
+			for (size_t k = 0; k < sampled[c].size(); k++)
+				items.push_back({c, k});
+
+		vector<vector<Real>> values(clusterNo);
+		for (size_t c = 0; c < clusterNo; c++)
+			values[c].resize(sampled[c].size());
+
+#pragma omp parallel for schedule(dynamic)
+		for (size_t k = 0; k < items.size(); k++)
+		{
+			const auto &[c, idx] = items[k];
+			values[c][idx] = SilhouetteOfItem(sampled[c][idx], clusterResult, clusterNo, distFunc);
+		}
+
+		// per-cluster mean & stratified total mean
+		ApproximateEvaluationResults re;
+		re.ClusterResults.resize(clusterNo);
+		re.MeasureCount = items.size() * (N - 1);
+		Real totalMean = 0, totalVar = 0;
+		for (size_t c = 0; c < clusterNo; c++)
+		{
+			Real stdErr;
+			re.ClusterResults[c] = MeanInterval(values[c], clusterSize[c], confidenceLevel, stdErr);
+			const Real w = (Real)clusterSize[c] / (Real)N;
+			totalMean += w * re.ClusterResults[c].repVal;
+			totalVar += w * w * stdErr * stdErr;
+		}
+
+		const Real z = boost::math::quantile(boost::math::normal(), 0.5 + confidenceLevel / 2);
+		re.TotalResults.repVal = totalMean;
+		re.TotalResults.minVal = totalMean - z * sqrt(totalVar);
+		re.TotalResults.maxVal = totalMean + z * sqrt(totalVar);
+		return re;
+	}
+
+	ApproximateEvaluationResults ApproximateDaviesBouldin(
+		const vector<size_t> &clusterResult, const DistanceOracle &distFunc,
+		size_t samplesPerCluster, Real confidenceLevel, unsigned int seed)
+	{
+		assert(clusterResult.size() > 0);
+		assert(samplesPerCluster > 0);
+		assert(confidenceLevel > 0 && confidenceLevel < 1);
+		const size_t clusterNo = (*max_element(clusterResult.begin(), clusterResult.end())) + 1;
+
+		vector<size_t> clusterSize;
+		vector<vector<size_t>> sampled = StratifiedSample(clusterResult, clusterNo, samplesPerCluster, seed, clusterSize);
+
+		ApproximateEvaluationResults re;
+		re.ClusterResults.resize(clusterNo);
+		re.MeasureCount = 0;
+		vector<size_t> medoids(clusterNo, numeric_limits<size_t>::max());
+
+#pragma omp parallel for schedule(dynamic)
+		for (size_t c = 0; c < clusterNo; c++)
+		{
+			const vector<size_t> &S = sampled[c];
+			const size_t n = S.size();
+			if (n == 0)
+				continue;
+
+			// pairwise distances among samples
+			MatrixXR D = MatrixXR::Zero(n, n);
+			for (size_t i = 0; i < n; i++)
+				for (size_t j = i + 1; j < n; j++)
+					D(i, j) = D(j, i) = distFunc(S[i], S[j]);
+
+			// medoid of samples
+			Eigen::Index m;
+			D.rowwise().sum().minCoeff(&m);
+			medoids[c] = S[m];
+
+			// mean squared distance to medoid
+			vector<Real> sq(n);
+			for (size_t i = 0; i < n; i++)
+				sq[i] = D(i, m) * D(i, m);
+			Real stdErr;
+			ValueInterval<Real> msd = MeanInterval(sq, clusterSize[c], confidenceLevel, stdErr);
+			re.ClusterResults[c].minVal = sqrt(max((Real)0, msd.minVal));
+			re.ClusterResults[c].repVal = sqrt(max((Real)0, msd.repVal));
+			re.ClusterResults[c].maxVal = sqrt(max((Real)0, msd.maxVal));
+
+#pragma omp atomic
+			re.MeasureCount += n * (n - 1) / 2;
+		}
+
+		// Davies-Bouldin index: mean of max_j (S_i + S_j) / M_ij over clusters,
+		// where M_ij is the distance between medoids. Bounds are propagated from the bounds of S_i.
+		vector<size_t> valid;
+		for (size_t c = 0; c < clusterNo; c++)
+			if (medoids[c] != numeric_limits<size_t>::max())
+				valid.push_back(c);
+
+		const size_t k = valid.size();
+		MatrixXR M = MatrixXR::Zero(k, k);
+		for (size_t i = 0; i < k; i++)
+			for (size_t j = i + 1; j < k; j++)
+				M(i, j) = M(j, i) = distFunc(medoids[valid[i]], medoids[valid[j]]);
+		re.MeasureCount += k * (k - 1) / 2;
+
+		re.TotalResults.minVal = re.TotalResults.repVal = re.TotalResults.maxVal = 0;
+		if (k < 2)
+			return re;
+
+		for (size_t i = 0; i < k; i++)
+		{
+			ValueInterval<Real> worst;
+			worst.minVal = worst.repVal = worst.maxVal = 0;
+			for (size_t j = 0; j < k; j++)
+			{
+				if (i == j)
+					continue;
+				const auto &Si = re.ClusterResults[valid[i]];
+				const auto &Sj = re.ClusterResults[valid[j]];
+				for (size_t v = 0; v < 3; v++)
+				{
+					Real r = M(i, j) > 0 ? (Si.val[v] + Sj.val[v]) / M(i, j) : numeric_limits<Real>::infinity();
+					worst.val[v] = max(worst.val[v], r);
+				}
+			}
+			for (size_t v = 0; v < 3; v++)
+				re.TotalResults.val[v] += worst.val[v] / (Real)k;
+		}
+		return re;
+	}
+}
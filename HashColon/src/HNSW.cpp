@@ -0,0 +1,566 @@
+// HashColon config
+#include <HashColon/HashColon_config.h>
+// std libraries
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <queue>
+#include <string>
+#include <vector>
+// modified external libraries
+#include <HashColon/CLI11.hpp>
+#include <HashColon/CLI11_JsonSupport.hpp>
+// HashColon libraries
+#include <HashColon/Exception.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/SingletonCLI.hpp>
+// header file for this source file
+#include <HashColon/HNSW.hpp>
+
+using namespace std;
+using namespace Eigen;
+using namespace HashColon;
+
+namespace
+{
+	using DistId = pair<float, uint32_t>;
+
+	inline float SquaredDistance(const float *a, const float *b, size_t dim)
+	{
+		// independent accumulators so that the loop vectorizes without reassociation flags
+		float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		size_t k = 0;
+		for (; k + 4 <= dim; k += 4)
+		{
+			const float d0 = a[k] - b[k], d1 = a[k + 1] - b[k + 1];
+			const float d2 = a[k + 2] - b[k + 2], d3 = a[k + 3] - b[k + 3];
+			s0 += d0 * d0;
+			s1 += d1 * d1;
+			s2 += d2 * d2;
+			s3 += d3 * d3;
+		}
+		for (; k < dim; k++)
+		{
+			const float d = a[k] - b[k];
+			s0 += d * d;
+		}
+		return (s0 + s1) + (s2 + s3);
+	}
+
+	// visited marks of a thread. marks of the previous search are invalidated by increasing the epoch, not by clearing.
+	struct VisitedList
+	{
+		vector<uint32_t> Tag;
+		uint32_t Epoch = 0;
+
+		void Reset(size_t n)
+		{
+			if (Tag.size() < n)
+				Tag.resize(n, 0);
+			if (++Epoch == 0)
+			{
+				fill(Tag.begin(), Tag.end(), 0);
+				Epoch = 1;
+			}
+		}
+
+		// true if i was not visited before
+		bool Visit(uint32_t i)
+		{
+			if (Tag[i] == Epoch)
+				return false;
+			Tag[i] = Epoch;
+			return true;
+		}
+	};
+
+	const char HnswMagic[8] = {'H', 'C', 'H', 'N', 'S', 'W', '0', '1'};
+
+	template <typename T>
+	void WriteBinary(ostream &os, const T &v) { os.write(reinterpret_cast<const char *>(&v), sizeof(T)); }
+
+	template <typename T>
+	void WriteBinary(ostream &os, const vector<T> &v)
+	{
+		WriteBinary(os, (uint64_t)v.size());
+		os.write(reinterpret_cast<const char *>(v.data()), sizeof(T) * v.size());
+	}
+
+	template <typename T>
+	void ReadBinary(istream &is, T &v) { is.read(reinterpret_cast<char *>(&v), sizeof(T)); }
+
+	template <typename T>
+	void ReadBinary(istream &is, vector<T> &v)
+	{
+		uint64_t n = 0;
+		ReadBinary(is, n);
+		if (!is)
+			return;
+		v.resize(n);
+		is.read(reinterpret_cast<char *>(v.data()), sizeof(T) * n);
+	}
+}
+
+namespace HashColon
+{
+	HNSW::HNSW(size_t dimension, _Params params)
+		: _c(params), _dim(dimension), _rng(params.Seed)
+	{
+		if (_dim == 0)
+			throw Exception("dimension should be positive.");
+		if (_c.M < 2)
+			throw Exception("M should be at least 2.");
+		if (_c.EfConstruction < _c.M)
+			throw Exception("EfConstruction should not be smaller than M.");
+	}
+
+	void HNSW::Initialize(const string configFilePath, const string configNamespace)
+	{
+		CLI::App *cli = SingletonCLI::GetInstance().GetCLI(configNamespace);
+
+		if (!configFilePath.empty())
+		{
+			SingletonCLI::GetInstance().AddConfigFile(configFilePath);
+		}
+
+		cli->add_option("--M", _cDefault.M,
+						"Max number of neighbors of a node in upper layers. Bottom layer keeps 2M. (e.g. 16)")
+			->envname(GetEnvName(configNamespace, "M"));
+		cli->add_option("--EfConstruction", _cDefault.EfConstruction,
+						"Size of dynamic candidate list while inserting. Larger builds better graph slower. (e.g. 200)")
+			->envname(GetEnvName(configNamespace, "EfConstruction"));
+		cli->add_option("--EfSearch", _cDefault.EfSearch,
+						"Size of dynamic candidate list while searching. Trades recall for speed. At least k is used.")
+			->envname(GetEnvName(configNamespace, "EfSearch"));
+		cli->add_option("--Seed", _cDefault.Seed, "Random seed for the layers of nodes.")
+			->envname(GetEnvName(configNamespace, "Seed"));
+	}
+
+	uint32_t *HNSW::Links(uint32_t i, int layer)
+	{
+		return layer == 0
+				   ? _links0.data() + (size_t)i * (2 * _c.M + 1)
+				   : _linksUpper[i].data() + (size_t)(layer - 1) * (_c.M + 1);
+	}
+
+	const uint32_t *HNSW::Links(uint32_t i, int layer) const
+	{
+		return const_cast<HNSW *>(this)->Links(i, layer);
+	}
+
+	void HNSW::Clear()
+	{
+		_size = 0;
+		_data.clear();
+		_levels.clear();
+		_links0.clear();
+		_linksUpper.clear();
+		_entry = 0;
+		_maxLevel = -1;
+		_rng.seed(_c.Seed);
+	}
+
+	void HNSW::Reserve(size_t capacity)
+	{
+		_data.resize(capacity * _dim);
+		_levels.resize(capacity);
+		_links0.resize(capacity * (2 * _c.M + 1), 0);
+		_linksUpper.resize(capacity);
+		if (_lockCapacity < capacity)
+		{
+			_locks.reset(new mutex[capacity]);
+			_lockCapacity = capacity;
+		}
+	}
+
+	void HNSW::Build(const MatrixXR &vectors)
+	{
+		Clear();
+		Add(vectors);
+	}
+
+	void HNSW::Add(const MatrixXR &vectors)
+	{
+		if (vectors.rows() == 0)
+			return;
+		if ((size_t)vectors.cols() != _dim)
+			throw Exception("dimension of vectors does not match with the index.");
+		if (_size + (size_t)vectors.rows() > (size_t)numeric_limits<uint32_t>::max())
+			throw Exception("too many items.");
+
+		// storage and layers of all new nodes are set before the parallel insertion,
+		// so that nothing is reallocated while other threads read it.
+		const size_t begin = _size;
+		Reserve(begin + (size_t)vectors.rows());
+		const Real levelMult = 1.0 / log((Real)_c.M);
+		uniform_real_distribution<Real> unif(numeric_limits<Real>::min(), 1.0);
+		for (size_t r = 0; r < (size_t)vectors.rows(); r++)
+		{
+			const size_t i = begin + r;
+			for (size_t k = 0; k < _dim; k++)
+				_data[i * _dim + k] = (float)vectors(r, k);
+			_levels[i] = (int)floor(-log(unif(_rng)) * levelMult);
+			_linksUpper[i].assign((size_t)_levels[i] * (_c.M + 1), 0);
+		}
+		_size = begin + (size_t)vectors.rows();
+
+		// the first node becomes the entry point, then the rest are inserted in parallel
+		size_t parallelBegin = begin;
+		if (_maxLevel < 0)
+		{
+			InsertNode((uint32_t)begin);
+			parallelBegin++;
+		}
+#pragma omp parallel for schedule(dynamic, 64)
+		for (size_t i = parallelBegin; i < _size; i++)
+			InsertNode((uint32_t)i);
+	}
+
+	uint32_t HNSW::Descend(const float *q, uint32_t entry, int topLayer, int stopLayer, bool lockNodes) const
+	{
+		uint32_t cur = entry;
+		float curDist = SquaredDistance(q, Vec(cur), _dim);
+		vector<uint32_t> nbrs;
+		for (int l = topLayer; l > stopLayer; l--)
+		{
+			bool changed = true;
+			while (changed)
+			{
+				changed = false;
+				{
+					unique_lock<mutex> lock(_locks[cur], defer_lock);
+					if (lockNodes)
+						lock.lock();
+					const uint32_t *links = Links(cur, l);
+					nbrs.assign(links + 1, links + 1 + links[0]);
+				}
+				for (uint32_t n : nbrs)
+				{
+					const float d = SquaredDistance(q, Vec(n), _dim);
+					if (d < curDist)
+					{
+						curDist = d;
+						cur = n;
+						changed = true;
+					}
+				}
+			}
+		}
+		return cur;
+	}
+
+	vector<DistId> HNSW::SearchLayer(
+		const float *q, uint32_t entry, size_t ef, int layer, bool lockNodes) const
+	{
+		thread_local VisitedList visited;
+		visited.Reset(_size);
+
+		// candidates: closest on top, results: farthest on top
+		priority_queue<DistId, vector<DistId>, greater<DistId>> candidates;
+		priority_queue<DistId> results;
+		const float d0 = SquaredDistance(q, Vec(entry), _dim);
+		visited.Visit(entry);
+		candidates.emplace(d0, entry);
+		results.emplace(d0, entry);
+
+		vector<uint32_t> nbrs;
+		while (!candidates.empty())
+		{
+			const DistId c = candidates.top();
+			if (c.first > results.top().first && results.size() >= ef)
+				break;
+			candidates.pop();
+
+			{
+				unique_lock<mutex> lock(_locks[c.second], defer_lock);
+				if (lockNodes)
+					lock.lock();
+				const uint32_t *links = Links(c.second, layer);
+				nbrs.assign(links + 1, links + 1 + links[0]);
+			}
+			for (uint32_t n : nbrs)
+			{
+				if (!visited.Visit(n))
+					continue;
+				const float d = SquaredDistance(q, Vec(n), _dim);
+				if (results.size() < ef || d < results.top().first)
+				{
+					candidates.emplace(d, n);
+					results.emplace(d, n);
+					if (results.size() > ef)
+						results.pop();
+				}
+			}
+		}
+
+		vector<DistId> re;
+		re.reserve(results.size());
+		for (; !results.empty(); results.pop())
+			re.push_back(results.top());
+		return re;
+	}
+
+	vector<uint32_t> HNSW::SelectNeighbors(const vector<DistId> &candidates, size_t maxCnt) const
+	{
+		// a candidate is kept only if it is closer to the base than to every kept one.
+		// this keeps links toward different directions instead of a clump of the nearest.
+		vector<uint32_t> re;
+		for (const DistId &c : candidates)
+		{
+			if (re.size() >= maxCnt)
+				break;
+			bool good = true;
+			for (uint32_t s : re)
+			{
+				if (SquaredDistance(Vec(c.second), Vec(s), _dim) < c.first)
+				{
+					good = false;
+					break;
+				}
+			}
+			if (good)
+				re.push_back(c.second);
+		}
+		return re;
+	}
+
+	void HNSW::InsertNode(uint32_t id)
+	{
+		const int level = _levels[id];
+		const float *q = Vec(id);
+
+		// a node raising the max level holds the entry lock until it becomes the entry point
+		unique_lock<mutex> entryLock(_entryLock);
+		if (_maxLevel < 0)
+		{
+			_entry = id;
+			_maxLevel = level;
+			return;
+		}
+		const uint32_t entry = _entry;
+		const int maxLevel = _maxLevel;
+		if (level <= maxLevel)
+			entryLock.unlock();
+
+		uint32_t cur = Descend(q, entry, maxLevel, level, true);
+		for (int l = min(level, maxLevel); l >= 0; l--)
+		{
+			vector<DistId> found = SearchLayer(q, cur, _c.EfConstruction, l, true);
+			reverse(found.begin(), found.end());
+			cur = found.front().second;
+
+			const vector<uint32_t> nbrs = SelectNeighbors(found, _c.M);
+			{
+				lock_guard<mutex> lock(_locks[id]);
+				uint32_t *links = Links(id, l);
+				links[0] = (uint32_t)nbrs.size();
+				copy(nbrs.begin(), nbrs.end(), links + 1);
+			}
+
+			// back links. a full neighbor list is shrunk by the same heuristic.
+			const size_t maxLinks = MaxLinks(l);
+			for (uint32_t n : nbrs)
+			{
+				lock_guard<mutex> lock(_locks[n]);
+				uint32_t *links = Links(n, l);
+				if (links[0] < maxLinks)
+				{
+					links[++links[0]] = id;
+					continue;
+				}
+				vector<DistId> cand;
+				cand.reserve(maxLinks + 1);
+				cand.emplace_back(SquaredDistance(Vec(n), q, _dim), id);
+				for (uint32_t k = 1; k <= links[0]; k++)
+					cand.emplace_back(SquaredDistance(Vec(n), Vec(links[k]), _dim), links[k]);
+				sort(cand.begin(), cand.end());
+				const vector<uint32_t> kept = SelectNeighbors(cand, maxLinks);
+				links[0] = (uint32_t)kept.size();
+				copy(kept.begin(), kept.end(), links + 1);
+			}
+		}
+
+		if (level > maxLevel)
+		{
+			_entry = id;
+			_maxLevel = level;
+		}
+	}
+
+	HNSW::ResultList HNSW::Search(const VectorXR &query, size_t k, size_t ef) const
+	{
+		if ((size_t)query.size() != _dim)
+			throw Exception("dimension of query does not match with the index.");
+		if (_size == 0 || k == 0)
+			return ResultList();
+
+		vector<float> q(_dim);
+		for (size_t i = 0; i < _dim; i++)
+			q[i] = (float)query(i);
+
+		const uint32_t cur = Descend(q.data(), _entry, _maxLevel, 0, false);
+		const vector<DistId> found = SearchLayer(q.data(), cur, max({ef == 0 ? _c.EfSearch : ef, k, (size_t)1}), 0, false);
+
+		ResultList re;
+		k = min(k, found.size());
+		re.reserve(k);
+		// found is farthest first
+		for (size_t i = 0; i < k; i++)
+		{
+			const DistId &f = found[found.size() - 1 - i];
+			re.emplace_back((size_t)f.second, sqrt((Real)f.first));
+		}
+		return re;
+	}
+
+	vector<HNSW::ResultList> HNSW::Search(const MatrixXR &queries, size_t k, size_t ef) const
+	{
+		vector<ResultList> re(queries.rows());
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < (size_t)queries.rows(); i++)
+			re[i] = Search(VectorXR(queries.row(i).transpose()), k, ef);
+		return re;
+	}
+
+	void HNSW::Save(ostream &os) const
+	{
+		os.write(HnswMagic, sizeof(HnswMagic));
+		WriteBinary(os, (uint64_t)_dim);
+		WriteBinary(os, (uint64_t)_size);
+		WriteBinary(os, (uint64_t)_c.M);
+		WriteBinary(os, (uint64_t)_c.EfConstruction);
+		WriteBinary(os, (uint64_t)_c.EfSearch);
+		WriteBinary(os, (uint32_t)_c.Seed);
+		WriteBinary(os, _entry);
+		WriteBinary(os, (int32_t)_maxLevel);
+
+		// storage may be reserved beyond size
+		os.write(reinterpret_cast<const char *>(_data.data()), sizeof(float) * _size * _dim);
+		for (size_t i = 0; i < _size; i++)
+			WriteBinary(os, (int32_t)_levels[i]);
+		os.write(reinterpret_cast<const char *>(_links0.data()), sizeof(uint32_t) * _size * (2 * _c.M + 1));
+		for (size_t i = 0; i < _size; i++)
+			WriteBinary(os, _linksUpper[i]);
+		if (!os)
+			throw Exception("failed to write the index.");
+	}
+
+	void HNSW::Save(const string filepath) const
+	{
+		ofstream ofs(filepath, ios::binary);
+		if (!ofs.is_open())
+			throw Exception("Invalid output file path: " + filepath);
+		Save(ofs);
+	}
+
+	void HNSW::Load(istream &is)
+	{
+		char magic[sizeof(HnswMagic)];
+		is.read(magic, sizeof(magic));
+		if (!is || memcmp(magic, HnswMagic, sizeof(HnswMagic)) != 0)
+			throw Exception("not an HNSW index stream.");
+
+		uint64_t dim, size, M, efConstruction, efSearch;
+		uint32_t seed, entry;
+		int32_t maxLevel;
+		ReadBinary(is, dim);
+		ReadBinary(is, size);
+		ReadBinary(is, M);
+		ReadBinary(is, efConstruction);
+		ReadBinary(is, efSearch);
+		ReadBinary(is, seed);
+		ReadBinary(is, entry);
+		ReadBinary(is, maxLevel);
+		if (!is || dim == 0 || M < 2 || efConstruction < M || size > (uint64_t)numeric_limits<uint32_t>::max() ||
+			(size > 0 && (entry >= size || maxLevel < 0)) ||
+			dim > (uint64_t)numeric_limits<size_t>::max() / sizeof(float) / max(size, (uint64_t)1) ||
+			M > (uint64_t)numeric_limits<size_t>::max() / sizeof(uint32_t) / 2 / max(size, (uint64_t)1))
+			throw Exception("corrupted HNSW index stream.");
+
+		// parsed and validated into locals, so that a broken stream leaves this index untouched
+		const size_t n = (size_t)size;
+		const size_t m = (size_t)M;
+		auto validLinks = [n](const uint32_t *links, size_t maxCnt)
+		{
+			if (links[0] > maxCnt)
+				return false;
+			for (size_t k = 1; k <= links[0]; k++)
+				if (links[k] >= n)
+					return false;
+			return true;
+		};
+
+		vector<float> data(n * (size_t)dim);
+		is.read(reinterpret_cast<char *>(data.data()), sizeof(float) * data.size());
+
+		vector<int> levels(n);
+		for (size_t i = 0; i < n && is; i++)
+		{
+			int32_t l;
+			ReadBinary(is, l);
+			if (!is || l < 0 || l > maxLevel)
+				throw Exception("corrupted HNSW index stream.");
+			levels[i] = (int)l;
+		}
+		if (n > 0 && levels[entry] != maxLevel)
+			throw Exception("corrupted HNSW index stream.");
+
+		vector<uint32_t> links0(n * (2 * m + 1));
+		is.read(reinterpret_cast<char *>(links0.data()), sizeof(uint32_t) * links0.size());
+		for (size_t i = 0; i < n && is; i++)
+			if (!validLinks(links0.data() + i * (2 * m + 1), 2 * m))
+				throw Exception("corrupted HNSW index stream.");
+
+		vector<vector<uint32_t>> linksUpper(n);
+		for (size_t i = 0; i < n && is; i++)
+		{
+			uint64_t cnt = 0;
+			ReadBinary(is, cnt);
+			if (!is || cnt != (uint64_t)levels[i] * (m + 1))
+				throw Exception("corrupted HNSW index stream.");
+			linksUpper[i].resize((size_t)cnt);
+			is.read(reinterpret_cast<char *>(linksUpper[i].data()), sizeof(uint32_t) * cnt);
+			for (int l = 0; l < levels[i] && is; l++)
+				if (!validLinks(linksUpper[i].data() + (size_t)l * (m + 1), m))
+					throw Exception("corrupted HNSW index stream.");
+		}
+		if (!is)
+			throw Exception("failed to read the index.");
+
+		unique_ptr<mutex[]> locks;
+		if (_lockCapacity < n)
+			locks.reset(new mutex[n]);
+
+		// nothing throws from here
+		_dim = (size_t)dim;
+		_c.M = m;
+		_c.EfConstruction = (size_t)efConstruction;
+		_c.EfSearch = (size_t)efSearch;
+		_c.Seed = seed;
+		_rng.seed(seed);
+		_size = n;
+		_data = move(data);
+		_levels = move(levels);
+		_links0 = move(links0);
+		_linksUpper = move(linksUpper);
+		_entry = entry;
+		_maxLevel = n > 0 ? (int)maxLevel : -1;
+		if (locks)
+		{
+			_locks = move(locks);
+			_lockCapacity = n;
+		}
+	}
+
+	void HNSW::Load(const string filepath)
+	{
+		ifstream ifs(filepath, ios::binary);
+		if (!ifs.is_open())
+			throw Exception("Invalid input file path: " + filepath);
+		Load(ifs);
+	}
+}
@@ -1,13 +1,16 @@
 // HashColon config
 #include <HashColon/HashColon_config.h>
 // std libraries
+#include <algorithm>
 #include <atomic>
+#include <cassert>
+#include <chrono>
 #include <exception>
 #include <functional>
 #include <future>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <limits>
 #include <thread>
 #include <vector>
 // header file for this source file
@@ -15,50 +18,270 @@
 
 using namespace std;
 
+namespace
+{
+    using HashColon::_hidden::TaskNode;
+
+    // nodes are moved between thread caches and the shared pool in batches of CacheBatch
+    constexpr size_t CacheBatch = 256;
+
+    // spare nodes shared by all threads
+    struct NodePool
+    {
+        std::mutex m;
+        TaskNode *head = nullptr;
+
+        ~NodePool()
+        {
+            while (head)
+            {
+                TaskNode *n = head;
+                head = n->next;
+                delete n;
+            }
+        }
+    };
+
+    NodePool &GetNodePool()
+    {
+        static NodePool pool;
+        return pool;
+    }
+
+    // spare nodes of a thread. returned to the shared pool when the thread exits.
+    struct NodeCache
+    {
+        TaskNode *head = nullptr;
+        size_t count = 0;
+
+        // detaches up to cnt nodes as a list
+        TaskNode *Detach(size_t cnt, TaskNode *&tail)
+        {
+            TaskNode *first = head;
+            tail = head;
+            for (size_t k = 1; k < cnt && tail->next; k++)
+                tail = tail->next;
+            head = tail->next;
+            tail->next = nullptr;
+            count = (cnt >= count) ? 0 : count - cnt;
+            return first;
+        }
+
+        ~NodeCache()
+        {
+            if (!head)
+                return;
+            TaskNode *tail;
+            TaskNode *first = Detach(count, tail);
+            NodePool &pool = GetNodePool();
+            lock_guard<std::mutex> lock(pool.m);
+            tail->next = pool.head;
+            pool.head = first;
+        }
+    };
+
+    thread_local NodeCache nodeCache;
+
+    // pool and worker of the calling thread, if it is a worker thread
+    thread_local const void *tlsPool = nullptr;
+    thread_local void *tlsWorker = nullptr;
+
+    // xorshift for choosing heaps of MultiQueue
+    uint32_t Random()
+    {
+        static std::atomic<uint32_t> seed{1};
+        thread_local uint32_t x = 2654435761u * seed.fetch_add(1, std::memory_order_relaxed);
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+}
+
 namespace HashColon::_hidden
 {
-	bool TSQueue::Push(FuncT const& v)
-	{
-        unique_lock<mutex> lock(this->m);
-        this->q.push(v);
-        return true;
-	}
+    TaskNode *AllocTaskNode()
+    {
+        NodeCache &cache = nodeCache;
+        if (!cache.head)
+        {
+            NodePool &pool = GetNodePool();
+            lock_guard<std::mutex> lock(pool.m);
+            for (size_t k = 0; k < CacheBatch && pool.head; k++)
+            {
+                TaskNode *n = pool.head;
+                pool.head = n->next;
+                n->next = cache.head;
+                cache.head = n;
+                cache.count++;
+            }
+        }
+        if (!cache.head)
+            return new TaskNode();
+        TaskNode *n = cache.head;
+        cache.head = n->next;
+        cache.count--;
+        return n;
+    }
 
-    // deletes the retrieved element, do not use for non integral types
-    bool TSQueue::Pop(FuncT& v) {
-        unique_lock<mutex> lock(this->m);
-        if (this->q.empty())
-            return false;
-        v = this->q.front();
-        this->q.pop();
-        return true;
+    void FreeTaskNode(TaskNode *n)
+    {
+        n->Reset();
+        NodeCache &cache = nodeCache;
+        n->next = cache.head;
+        cache.head = n;
+        cache.count++;
+
+        // consumers free what producers allocate. surplus goes back to the shared pool.
+        if (cache.count > 2 * CacheBatch)
+        {
+            TaskNode *tail;
+            TaskNode *first = cache.Detach(CacheBatch, tail);
+            NodePool &pool = GetNodePool();
+            lock_guard<std::mutex> lock(pool.m);
+            tail->next = pool.head;
+            pool.head = first;
+        }
     }
 
-    bool TSQueue::Empty() {
-        unique_lock<mutex> lock(this->m);
-        return this->q.empty();
+    WorkStealingDeque::WorkStealingDeque()
+        : top(0), bottom(0), array(new Array(1024)) {}
+
+    WorkStealingDeque::~WorkStealingDeque() { delete array.load(); }
+
+    void WorkStealingDeque::Push(TaskNode *x)
+    {
+        const int64_t b = bottom.load(memory_order_relaxed);
+        const int64_t t = top.load(memory_order_acquire);
+        Array *a = array.load(memory_order_relaxed);
+        if (b - t > a->cap - 1)
+        {
+            Array *grown = new Array(a->cap * 2);
+            for (int64_t i = t; i < b; i++)
+                grown->Put(i, a->Get(i));
+            retired.emplace_back(a);
+            array.store(grown, memory_order_release);
+            a = grown;
+        }
+        a->Put(b, x);
+        atomic_thread_fence(memory_order_release);
+        bottom.store(b + 1, memory_order_relaxed);
     }
 
-    bool TSPriorityQueue::Push(FuncT const& v, size_t priority)
+    TaskNode *WorkStealingDeque::Take()
     {
-        unique_lock<mutex> lock(this->m);
-        this->q.push(ItemT{ v, priority });
-        return true;
+        const int64_t b = bottom.load(memory_order_relaxed) - 1;
+        Array *a = array.load(memory_order_relaxed);
+        bottom.store(b, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        int64_t t = top.load(memory_order_relaxed);
+
+        TaskNode *x = nullptr;
+        if (t <= b)
+        {
+            x = a->Get(b);
+            if (t == b)
+            {
+                // the last item: race against thieves
+                if (!top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                    x = nullptr;
+                bottom.store(b + 1, memory_order_relaxed);
+            }
+        }
+        else
+            bottom.store(b + 1, memory_order_relaxed);
+        return x;
     }
 
-    // deletes the retrieved element, do not use for non integral types
-    bool TSPriorityQueue::Pop(FuncT& v) {
-        unique_lock<mutex> lock(this->m);
-        if (this->q.empty())
-            return false;
-        v = this->q.top().f;
-        this->q.pop();
-        return true;
+    TaskNode *WorkStealingDeque::Steal()
+    {
+        while (true)
+        {
+            int64_t t = top.load(memory_order_acquire);
+            atomic_thread_fence(memory_order_seq_cst);
+            const int64_t b = bottom.load(memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+
+            Array *a = array.load(memory_order_acquire);
+            TaskNode *x = a->Get(t);
+            if (top.compare_exchange_strong(t, t + 1, memory_order_seq_cst, memory_order_relaxed))
+                return x;
+            // another thread took the top item. retry while not empty.
+        }
     }
 
-    bool TSPriorityQueue::Empty() {
-        unique_lock<mutex> lock(this->m);
-        return this->q.empty();
+    bool WorkStealingDeque::Empty() const
+    {
+        return bottom.load(memory_order_relaxed) <= top.load(memory_order_relaxed);
+    }
+
+    MultiQueue::MultiQueue(size_t nQueues)
+        : nQueues(max<size_t>(nQueues, 1)), queues(new SubQueue[max<size_t>(nQueues, 1)]), size(0)
+    {
+        for (size_t i = 0; i < this->nQueues; i++)
+            this->queues[i].top.store(-numeric_limits<double>::infinity(), memory_order_relaxed);
+    }
+
+    void MultiQueue::Push(TaskNode *x, double key)
+    {
+        // a random heap not locked by others. blocks on a lock only if all tries failed.
+        SubQueue *q = nullptr;
+        unique_lock<mutex> lock;
+        for (size_t k = 0; !lock.owns_lock(); k++) {
+            q = &this->queues[Random() % this->nQueues];
+            if (k < this->nQueues)
+                lock = unique_lock<mutex>(q->m, try_to_lock);
+            else
+                lock = unique_lock<mutex>(q->m);
+        }
+        q->heap.push_back(Item{key, x});
+        push_heap(q->heap.begin(), q->heap.end(), ItemCmp());
+        q->top.store(q->heap.front().key, memory_order_relaxed);
+        // counted under the lock, so that size never falls below the number of items
+        this->size.fetch_add(1);
+    }
+
+    TaskNode *MultiQueue::PopLocked(SubQueue &q)
+    {
+        if (q.heap.empty())
+            return nullptr;
+        pop_heap(q.heap.begin(), q.heap.end(), ItemCmp());
+        TaskNode *x = q.heap.back().task;
+        q.heap.pop_back();
+        q.top.store(q.heap.empty() ? -numeric_limits<double>::infinity() : q.heap.front().key, memory_order_relaxed);
+        this->size.fetch_sub(1);
+        return x;
+    }
+
+    TaskNode *MultiQueue::Pop()
+    {
+        const double emptyKey = -numeric_limits<double>::infinity();
+        for (size_t k = 0; this->size.load() > 0; k++) {
+            if (k < 4 * this->nQueues) {
+                // the better of two random heaps
+                SubQueue &a = this->queues[Random() % this->nQueues];
+                SubQueue &b = this->queues[Random() % this->nQueues];
+                SubQueue &q = (b.top.load(memory_order_relaxed) > a.top.load(memory_order_relaxed)) ? b : a;
+                if (q.top.load(memory_order_relaxed) == emptyKey)
+                    continue;
+                unique_lock<mutex> lock(q.m, try_to_lock);
+                if (!lock.owns_lock())
+                    continue;
+                if (TaskNode *x = this->PopLocked(q))
+                    return x;
+            }
+            else {
+                // a few items in a few heaps: look at all
+                for (size_t i = 0; i < this->nQueues; i++) {
+                    unique_lock<mutex> lock(this->queues[i].m);
+                    if (TaskNode *x = this->PopLocked(this->queues[i]))
+                        return x;
+                }
+                k = 0;
+            }
+        }
+        return nullptr;
     }
 }
 
@@ -73,59 +296,74 @@ namespace HashColon
     }
 
     // get the number of running threads in the pool
-    int ThreadPool::ThreadCount() const { return static_cast<int>(this->threads.size()); }
+    int ThreadPool::ThreadCount() const { return static_cast<int>(this->workers.load()->size()); }
 
     // number of idle threads
     int ThreadPool::IdleThreadCount() { return this->nWaiting; }
-    thread& ThreadPool::GetThread(int i) { return *this->threads[i]; }
+    thread& ThreadPool::GetThread(int i) { return *(*this->workers.load())[i]->thread; }
 
     // change the number of threads in the pool
     // should be called from one thread, otherwise be careful to not interleave, also with this->stop()
     // nThreads must be >= 0
     void ThreadPool::ChangeThreadCount(int nThreads) {
-        if (!this->isStop && !this->isDone) {
-            int oldNThreads = static_cast<int>(this->threads.size());
-            if (oldNThreads <= nThreads) {  // if the number of threads is increased
-                this->threads.resize(nThreads);
-                this->flags.resize(nThreads);
+        if (this->isStop || this->isDone)
+            return;
+
+        const WorkerList &oldList = *this->workers.load();
+        const int oldNThreads = static_cast<int>(oldList.size());
+        if (oldNThreads == nThreads)
+            return;
+
+        // thieves may be reading the current list: publish a new list instead of modifying it
+        const int kept = min(oldNThreads, nThreads);
+        std::unique_ptr<WorkerList> newList(new WorkerList(oldList.begin(), oldList.begin() + kept));
+        for (int i = oldNThreads; i < nThreads; ++i) {
+            this->allWorkers.emplace_back(new Worker());
+            Worker *w = this->allWorkers.back().get();
+            w->id = i;
+            w->rng = 2654435761u * static_cast<uint32_t>(i + 1);
+            newList->push_back(w);
+        }
+        this->workers.store(newList.get());
+        this->workerLists.push_back(std::move(newList));
 
-                for (int i = oldNThreads; i < nThreads; ++i) {
-                    this->flags[i] = std::make_shared<std::atomic<bool>>(false);
-                    this->SetThread(i);
-                }
+        if (oldNThreads < nThreads) {  // if the number of threads is increased
+            for (int i = oldNThreads; i < nThreads; ++i)
+                this->SetThread(i);
+        }
+        else {  // the number of threads is decreased
+            this->nRetiring += oldNThreads - nThreads;
+            for (int i = oldNThreads - 1; i >= nThreads; --i) {
+                oldList[i]->retiring = true;
+                oldList[i]->flag = true;  // this thread will finish and hand its tasks over. joined in Stop()
             }
-            else {  // the number of threads is decreased
-                for (int i = oldNThreads - 1; i >= nThreads; --i) {
-                    *this->flags[i] = true;  // this thread will finish
-                    this->threads[i]->detach();
-                }
-                {
-                    // stop the detached threads that were waiting
-                    std::unique_lock<std::mutex> lock(this->mutex);
-                    this->cv.notify_all();
-                }
-                this->threads.resize(nThreads);  // safe to delete because the threads are detached
-                this->flags.resize(nThreads);  // safe to delete because the threads have copies of shared_ptr of the flags, not originals
+            {
+                // stop the threads that were waiting
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->cv.notify_all();
+                this->doneCv.notify_all();  // Wait() returns if no thread is left
             }
         }
     }
 
     // empty the queue
     void ThreadPool::Clear() {
-        std::function<void(int id)>* _f;
-        while (this->q.Pop(_f))
-            delete _f; // empty the queue
+        _hidden::TaskNode *n;
+        while ((n = this->FindTask(nullptr))) {
+            _hidden::FreeTaskNode(n); // empty the queue
+            this->TaskDone();
+        }
     }
 
     // pops a functional wrapper to the original function
     std::function<void(int)> ThreadPool::Pop() {
-        std::function<void(int id)>* _f = nullptr;
-        this->q.Pop(_f);
-        std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
-        std::function<void(int)> f;
-        if (_f)
-            f = *_f;
-        return f;
+        _hidden::TaskNode *n = this->FindTask(nullptr);
+        if (!n)
+            return std::function<void(int)>();
+        this->TaskDone();  // the caller runs it
+        // the node is freed when the last copy of the wrapper is destroyed
+        std::shared_ptr<_hidden::TaskNode> holder(n, _hidden::FreeTaskNode);
+        return [holder](int id) { holder->Run(id); };
     }
 
     // wait for all computing threads to finish and stop all threads
@@ -136,9 +374,8 @@ namespace HashColon
             if (this->isStop)
                 return;
             this->isStop = true;
-            for (int i = 0, n = this->ThreadCount(); i < n; ++i) {
-                *this->flags[i] = true;  // command the threads to stop
-            }
+            for (Worker *w : *this->workers.load())
+                w->flag = true;  // command the threads to stop
             this->Clear();  // empty the queue
         }
         else {
@@ -150,58 +387,325 @@ namespace HashColon
             std::unique_lock<std::mutex> lock(this->mutex);
             this->cv.notify_all();  // stop all waiting threads
         }
-        for (int i = 0; i < static_cast<int>(this->threads.size()); ++i) {  // wait for the computing threads to finish
-            if (this->threads[i]->joinable())
-                this->threads[i]->join();
+        for (auto &w : this->allWorkers) {  // wait for the computing threads to finish, including retired ones
+            if (w->thread && w->thread->joinable())
+                w->thread->join();
         }
         // if there were no threads in the pool but some functors in the queue, the functors are not deleted by the threads
         // therefore delete them here
         this->Clear();
-        this->threads.clear();
-        this->flags.clear();
+        this->workerLists.emplace_back(new WorkerList());
+        this->workers.store(this->workerLists.back().get());
+        this->allWorkers.clear();
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->doneCv.notify_all();  // Wait() returns as there is no thread
+        }
     }
 
     void ThreadPool::Wait()
     {
-        this->Stop(true);
+        assert(!this->IsWorkerThread());
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->doneCv.wait(lock, [this]() { return this->nPending == 0 || this->workers.load()->empty(); });
     }
 
-    void ThreadPool::SetThread(int i) 
+    void ThreadPool::TaskDone()
     {
-        std::shared_ptr<std::atomic<bool>> flag(this->flags[i]); // a copy of the shared ptr to the flag
-        auto f = [this, i, flag/* a copy of the shared ptr to the flag */]() {
-            std::atomic<bool>& _flag = *flag;
-            std::function<void(int id)>* _f;
-            bool isPop = this->q.Pop(_f);
-            while (true) {
-                while (isPop) {  // if there is anything in the queue
-                    std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
-                    (*_f)(i);
-                    if (_flag)
-                        return;  // the thread is wanted to stop, return even if the queue is not empty yet
-                    else
-                        isPop = this->q.Pop(_f);
-                }
+        if (this->nPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->doneCv.notify_all();
+        }
+    }
+
+    bool ThreadPool::IsWorkerThread() const
+    {
+        return tlsPool == this;
+    }
+
+    bool ThreadPool::RunPendingTask()
+    {
+        Worker *w = this->IsWorkerThread() ? static_cast<Worker *>(tlsWorker) : nullptr;
+        if (!w && this->ThreadCount() > 0)
+            return false;
+        _hidden::TaskNode *n = this->FindTask(w);
+        if (!n)
+            return false;
+        n->Run(w ? w->id : 0);
+        _hidden::FreeTaskNode(n);
+        this->TaskDone();
+        return true;
+    }
+
+    size_t ThreadPool::RunnerCount(size_t begin, size_t end, Schedule schedule, size_t chunk) const
+    {
+        if (begin >= end)
+            return 0;
+        const size_t n = end - begin;
+        const size_t threads = static_cast<size_t>(max(1, this->ThreadCount()));
+        if (chunk == 0)
+            chunk = (schedule == Schedule::Dynamic) ? max<size_t>(1, n / (8 * threads)) : 1;
+        return min(threads, (n + chunk - 1) / chunk);
+    }
+
+    void ThreadPool::SetThread(int i)
+    {
+        Worker *w = (*this->workers.load())[i];
+        w->thread.reset(new std::thread([this, w]() { this->WorkerLoop(w); })); // compiler may not support std::make_unique()
+    }
+
+    void ThreadPool::Init()
+    {
+        this->nWaiting = 0;
+        this->wakePending = false;
+        this->nRetiring = 0;
+        this->nPending = 0;
+        this->isStop = false;
+        this->isDone = false;
+        this->nextInbox = 0;
+        this->workerLists.emplace_back(new WorkerList());
+        this->workers.store(this->workerLists.back().get());
+    }
+
+    void ThreadPool::Notify()
+    {
+        // pairs with the fence after the increment of nWaiting before a worker checks the queues for the last time:
+        // either the worker finds the new task, or this sees the worker waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->nWaiting.load(std::memory_order_relaxed) == 0)
+            return;
+        // one wake at a time: the notified thread checks all queues and keeps running while it finds tasks
+        if (this->wakePending.load(std::memory_order_relaxed) || this->wakePending.exchange(true))
+            return;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->nWaiting == 0)
+            this->wakePending = false;  // nobody to clear it
+        else
+            this->cv.notify_one();
+    }
+
+    bool ThreadPool::HasQueuedTasks() const
+    {
+        if (this->poolInbox.count.load(std::memory_order_relaxed) > 0)
+            return true;
+        for (Worker *w : *this->workers.load())
+            if (w->inbox.count.load(std::memory_order_relaxed) > 0 || !w->deque.Empty())
+                return true;
+        return false;
+    }
+
+    void ThreadPool::PushInbox(Inbox &inbox, _hidden::TaskNode *n)
+    {
+        {
+            std::unique_lock<std::mutex> lock(inbox.m);
+            if (!inbox.closed) {
+                inbox.items.push_back(n);
+                inbox.count.store(inbox.items.size(), std::memory_order_relaxed);
+                return;
+            }
+        }
+        std::unique_lock<std::mutex> lock(this->poolInbox.m);
+        this->poolInbox.items.push_back(n);
+        this->poolInbox.count.store(this->poolInbox.items.size(), std::memory_order_relaxed);
+    }
+
+    void ThreadPool::Enqueue(_hidden::TaskNode *n)
+    {
+        this->nPending.fetch_add(1, std::memory_order_relaxed);
+        if (tlsPool == this) {
+            // pushed from a task of this pool: the worker's own deque, no lock
+            static_cast<Worker *>(tlsWorker)->deque.Push(n);
+        }
+        else {
+            const WorkerList &list = *this->workers.load();
+            if (list.empty())
+                this->PushInbox(this->poolInbox, n);
+            else
+                this->PushInbox(list[this->nextInbox.fetch_add(1, std::memory_order_relaxed) % list.size()]->inbox, n);
+        }
+        this->Notify();
+    }
+
+    _hidden::TaskNode *ThreadPool::TakeInbox(Worker *w, Inbox &inbox)
+    {
+        if (inbox.count.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        std::unique_lock<std::mutex> lock(inbox.m);
+        if (inbox.items.empty())
+            return nullptr;
+        if (!w) {
+            _hidden::TaskNode *n = inbox.items.back();
+            inbox.items.pop_back();
+            inbox.count.store(inbox.items.size(), std::memory_order_relaxed);
+            return n;
+        }
+        // swap with the spare buffer of the worker, both keep their capacity
+        std::swap(w->drained, inbox.items);
+        inbox.count.store(0, std::memory_order_relaxed);
+        lock.unlock();
+
+        // the first one runs now, the rest become stealable
+        for (size_t k = 1; k < w->drained.size(); k++)
+            w->deque.Push(w->drained[k]);
+        _hidden::TaskNode *n = w->drained[0];
+        w->drained.clear();
+        return n;
+    }
+
+    _hidden::TaskNode *ThreadPool::FindTask(Worker *w)
+    {
+        _hidden::TaskNode *n = nullptr;
+        if (w) {
+            if ((n = w->deque.Take()) || (n = this->TakeInbox(w, w->inbox)))
+                return n;
+        }
+        if ((n = this->TakeInbox(w, this->poolInbox)))
+            return n;
+
+        const WorkerList &list = *this->workers.load();
+        const size_t cnt = list.size();
+        if (cnt == 0)
+            return nullptr;
+        size_t start = 0;
+        if (w) {
+            // xorshift: random victim order spreads thieves
+            w->rng ^= w->rng << 13;
+            w->rng ^= w->rng >> 17;
+            w->rng ^= w->rng << 5;
+            start = w->rng % cnt;
+        }
+        for (size_t k = 0; k < cnt; k++) {
+            Worker *v = list[(start + k) % cnt];
+            if (v != w && (n = v->deque.Steal()))
+                return n;
+        }
+        for (size_t k = 0; k < cnt; k++) {
+            Worker *v = list[(start + k) % cnt];
+            if (v != w && (n = this->TakeInbox(w, v->inbox)))
+                return n;
+        }
+        return nullptr;
+    }
+
+    void ThreadPool::WorkerLoop(Worker *w)
+    {
+        tlsPool = this;
+        tlsWorker = w;
+        while (!w->flag) {
+            _hidden::TaskNode *n = this->FindTask(w);
+            bool isWoken = false;
+            if (!n) {
                 // the queue is empty here, wait for the next command
                 std::unique_lock<std::mutex> lock(this->mutex);
                 ++this->nWaiting;
-                this->cv.wait(lock, [this, &_f, &isPop, &_flag]() { isPop = this->q.Pop(_f); return isPop || this->isDone || _flag; });
+                this->cv.wait(lock, [this, w, &n]() {
+                    this->wakePending = false;
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    n = this->FindTask(w);
+                    // tasks of retiring workers may still be coming to the pool inbox
+                    return n || w->flag || (this->isDone && this->nRetiring == 0);
+                });
                 --this->nWaiting;
-                if (!isPop)
-                    return;  // if the queue is empty and this->isDone == true or *flag then return
+                if (!n)
+                    break;  // if the queue is empty and this->isDone == true or flag then return
+                isWoken = true;
             }
-        };
-        this->threads[i].reset(new std::thread(f)); // compiler may not support std::make_unique()
+            // tasks moved from an inbox into the deque can be stolen by sleeping workers.
+            // a woken worker also passes the wake on: pushes skipped notifying while its wake was pending.
+            if (!w->deque.Empty() || (isWoken && this->HasQueuedTasks()))
+                this->Notify();
+            n->Run(w->id);
+            _hidden::FreeTaskNode(n);
+            this->TaskDone();
+        }
+
+        // a retired or stopped worker hands its tasks over to the pool inbox
+        bool handed = false;
+        {
+            std::unique_lock<std::mutex> lock(w->inbox.m);
+            w->inbox.closed = true;
+            std::unique_lock<std::mutex> poolLock(this->poolInbox.m);
+            for (_hidden::TaskNode *n : w->inbox.items)
+                this->poolInbox.items.push_back(n);
+            _hidden::TaskNode *n;
+            while ((n = w->deque.Take()))
+                this->poolInbox.items.push_back(n);
+            handed = !this->poolInbox.items.empty();
+            w->inbox.items.clear();
+            w->inbox.count.store(0, std::memory_order_relaxed);
+            this->poolInbox.count.store(this->poolInbox.items.size(), std::memory_order_relaxed);
+        }
+        if (w->retiring.exchange(false)) {
+            --this->nRetiring;
+            handed = true;  // waiting threads may finish now
+        }
+        if (handed) {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->cv.notify_all();
+        }
+        tlsPool = nullptr;
+        tlsWorker = nullptr;
+    }
+}
+
+namespace HashColon
+{
+    TaskGroup::~TaskGroup()
+    {
+        this->Join();
+    }
+
+    void TaskGroup::Wait()
+    {
+        this->Join();
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> lock(this->m);
+            std::swap(e, this->error);
+        }
+        if (e)
+            std::rethrow_exception(e);
+    }
+
+    void TaskGroup::Done()
+    {
+        // the last one decrements under the lock, so that Join cannot return(and the group be destroyed) before notify_all
+        size_t cnt = this->nPending.load();
+        while (true) {
+            if (cnt == 1) {
+                std::lock_guard<std::mutex> lock(this->m);
+                if (this->nPending.fetch_sub(1) == 1)
+                    this->cv.notify_all();
+                return;
+            }
+            if (this->nPending.compare_exchange_weak(cnt, cnt - 1))
+                return;
+        }
     }
 
-    void ThreadPool::Init() { this->nWaiting = 0; this->isStop = false; this->isDone = false; }
-  
+    void TaskGroup::Join()
+    {
+        // blocking a worker may leave the tasks of this group in the queues with nobody to run them,
+        // and a pool without threads never runs them. run the tasks of the pool instead in these cases.
+        // the wait is timed as the thread count may change while waiting.
+        while (this->nPending.load() > 0) {
+            if (this->pool.RunPendingTask())
+                continue;
+            const auto interval = this->pool.IsWorkerThread() ? std::chrono::microseconds(100) : std::chrono::microseconds(10000);
+            std::unique_lock<std::mutex> lock(this->m);
+            this->cv.wait_for(lock, interval, [this]() { return this->nPending == 0; });
+        }
+        // the last task may still be notifying: Done() holds the lock until then
+        std::unique_lock<std::mutex> lock(this->m);
+        this->cv.wait(lock, [this]() { return this->nPending == 0; });
+    }
 }
 
 namespace HashColon
 {
-    PriorityThreadPool::PriorityThreadPool() { this->Init(); }
-    PriorityThreadPool::PriorityThreadPool(int nThreads) { this->Init(); this->ChangeThreadCount(nThreads); }
+    PriorityThreadPool::PriorityThreadPool() { this->Init(0, 0); }
+    PriorityThreadPool::PriorityThreadPool(int nThreads, double agingRate) { this->Init(nThreads, agingRate); this->ChangeThreadCount(nThreads); }
 
     // the destructor waits for all the functions in the queue to be finished
     PriorityThreadPool::~PriorityThreadPool() {
@@ -248,20 +752,19 @@ namespace HashColon
 
     // empty the queue
     void PriorityThreadPool::Clear() {
-        std::function<void(int id)>* _f;
-        while (this->q.Pop(_f))
-            delete _f; // empty the queue
+        _hidden::TaskNode *n;
+        while ((n = this->q->Pop()))
+            _hidden::FreeTaskNode(n); // empty the queue
     }
 
     // pops a functional wrapper to the original function
     std::function<void(int)> PriorityThreadPool::Pop() {
-        std::function<void(int id)>* _f = nullptr;
-        this->q.Pop(_f);
-        std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
-        std::function<void(int)> f;
-        if (_f)
-            f = *_f;
-        return f;
+        _hidden::TaskNode *n = this->q->Pop();
+        if (!n)
+            return std::function<void(int)>();
+        // the node is freed when the last copy of the wrapper is destroyed
+        std::shared_ptr<_hidden::TaskNode> holder(n, _hidden::FreeTaskNode);
+        return [holder](int id) { holder->Run(id); };
     }
 
     // wait for all computing threads to finish and stop all threads
@@ -307,29 +810,74 @@ namespace HashColon
         std::shared_ptr<std::atomic<bool>> flag(this->flags[i]); // a copy of the shared ptr to the flag
         auto f = [this, i, flag/* a copy of the shared ptr to the flag */]() {
             std::atomic<bool>& _flag = *flag;
-            std::function<void(int id)>* _f;
-            bool isPop = this->q.Pop(_f);
+            _hidden::TaskNode *n = this->q->Pop();
             while (true) {
-                while (isPop) {  // if there is anything in the queue
-                    std::unique_ptr<std::function<void(int id)>> func(_f); // at return, delete the function even if an exception occurred
-                    (*_f)(i);
+                while (n) {  // if there is anything in the queue
+                    n->Run(i);
+                    _hidden::FreeTaskNode(n);
                     if (_flag)
                         return;  // the thread is wanted to stop, return even if the queue is not empty yet
                     else
-                        isPop = this->q.Pop(_f);
+                        n = this->q->Pop();
                 }
                 // the queue is empty here, wait for the next command
                 std::unique_lock<std::mutex> lock(this->mutex);
                 ++this->nWaiting;
-                this->cv.wait(lock, [this, &_f, &isPop, &_flag]() { isPop = this->q.Pop(_f); return isPop || this->isDone || _flag; });
+                this->cv.wait(lock, [this, &n, &_flag]() {
+                    this->wakePending = false;
+                    n = this->q->Pop();
+                    return n || this->isDone || _flag;
+                });
                 --this->nWaiting;
-                if (!isPop)
+                if (!n)
                     return;  // if the queue is empty and this->isDone == true or *flag then return
+                // pass the wake on: pushes skipped notifying while the wake of this thread was pending
+                lock.unlock();
+                if (!this->q->Empty())
+                    this->Notify();
             }
         };
         this->threads[i].reset(new std::thread(f)); // compiler may not support std::make_unique()
     }
 
-    void PriorityThreadPool::Init() { this->nWaiting = 0; this->isStop = false; this->isDone = false; }
+    void PriorityThreadPool::Init(int nThreads, double agingRate)
+    {
+        this->nWaiting = 0;
+        this->wakePending = false;
+        this->isStop = false;
+        this->isDone = false;
+        this->agingRate = agingRate;
+        this->epoch = std::chrono::steady_clock::now();
+        // two heaps per thread: small rank error, rare lock conflicts
+        const int n = (nThreads > 0) ? nThreads : static_cast<int>(std::thread::hardware_concurrency());
+        this->q.reset(new _hidden::MultiQueue(2 * static_cast<size_t>(max(n, 1))));
+    }
+
+    void PriorityThreadPool::Enqueue(_hidden::TaskNode *n, size_t priority)
+    {
+        // priority + rate x (waited time) compared at any moment orders the same as priority - rate x (push time),
+        // so the key is fixed at push and the heaps are never re-keyed
+        double key = static_cast<double>(priority);
+        const double rate = this->agingRate.load(std::memory_order_relaxed);
+        if (rate > 0)
+            key -= rate * std::chrono::duration<double>(std::chrono::steady_clock::now() - this->epoch).count();
+        this->q->Push(n, key);
+        this->Notify();
+    }
+
+    void PriorityThreadPool::Notify()
+    {
+        // pairs with the increment of nWaiting before a worker checks the queue for the last time
+        if (this->nWaiting == 0)
+            return;
+        // one wake at a time: the notified thread keeps running while it finds tasks
+        if (this->wakePending.load() || this->wakePending.exchange(true))
+            return;
+        std::unique_lock<std::mutex> lock(this->mutex);
+        if (this->nWaiting == 0)
+            this->wakePending = false;  // nobody to clear it
+        else
+            this->cv.notify_one();
+    }
 
 }
\ No newline at end of file
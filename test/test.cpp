@@ -1,13 +1,32 @@
 #include <iostream>
 #include <chrono>
+#include <functional>
+#include <cstring>
+#include <map>
+#include <random>
+#include <sstream>
 #include <HashColon/Helper.hpp>
+#include <HashColon/HNSW.hpp>
 #include <HashColon/Log.hpp>
 #include <HashColon/SingletonCLI.hpp>
+#include <HashColon/ThreadPool.hpp>
 
 using namespace std;
 using namespace std::chrono;
 using namespace HashColon;
 
+// number of failed checks of all tests run
+static size_t failCnt = 0;
+
+static void Check(bool condition, const string &what)
+{
+    if (!condition)
+    {
+        failCnt++;
+        cout << "    FAILED: " << what << endl;
+    }
+}
+
 #include <sys/resource.h>
 void test_CPUMEM()
 {
@@ -98,8 +117,303 @@ void unittest_utc()
     cout << "젲앙 왜 이따구로 찍히는데?" << endl;
 }
 
+void unittest_HNSW_Load()
+{
+    const size_t n = 300, dim = 8;
+    mt19937 rng(3);
+    normal_distribution<Real> nd;
+    Eigen::MatrixXR vectors(n, dim);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = 0; k < dim; k++)
+            vectors(i, k) = nd(rng);
+
+    HNSW source(dim, {8, 64, 32, 1});
+    source.Build(vectors);
+    stringstream ss;
+    source.Save(ss);
+    const string saved = ss.str();
+    const vector<HNSW::ResultList> expected = source.Search(vectors, 5);
+
+    // round trip
+    HNSW loaded(3, {4, 16, 16, 2});
+    stringstream in(saved);
+    loaded.Load(in);
+    Check(loaded.GetDimension() == dim && loaded.size() == n, "loaded index has the saved dimension and size");
+    Check(loaded.Search(vectors, 5) == expected, "loaded index searches as the saved one");
+
+    // broken streams throw and leave the index as it was
+    auto loadFails = [&](const string &stream, const string &what)
+    {
+        stringstream bad(stream);
+        bool thrown = false;
+        try
+        {
+            loaded.Load(bad);
+        }
+        catch (const HNSW::Exception &)
+        {
+            thrown = true;
+        }
+        Check(thrown, what + " is rejected");
+        Check(loaded.GetDimension() == dim && loaded.size() == n && loaded.Search(vectors, 5) == expected,
+              what + " leaves the index untouched");
+    };
+    for (size_t cut : {(size_t)4, (size_t)40, saved.size() / 3, saved.size() / 2, saved.size() - 1})
+        loadFails(saved.substr(0, cut), "truncated stream(" + to_string(cut) + " bytes)");
+
+    // header: magic, 5 x uint64, seed, entry, maxLevel. then vectors, levels, bottom layer links
+    const size_t levelsAt = 8 + 5 * 8 + 3 * 4 + sizeof(float) * n * dim;
+    const size_t links0At = levelsAt + 4 * n;
+    auto patched = [&saved](size_t at, uint32_t v)
+    {
+        string re = saved;
+        memcpy(&re[at], &v, sizeof(v));
+        return re;
+    };
+    loadFails(patched(levelsAt + 4, (uint32_t)-1), "negative level");
+    loadFails(patched(levelsAt + 4, 1000), "level above max level");
+    loadFails(patched(links0At, 1000), "link count above 2M");
+    loadFails(patched(links0At + 4, (uint32_t)n), "neighbor id out of range");
+}
+
+// n tasks submitted at once by submit(task) run at the same time, each waiting for the others up to a second.
+// fails if a sleeping worker missed its wakeup.
+static bool RunsConcurrently(int n, const function<void(function<void(int)>)> &submit)
+{
+    atomic<int> arrived{0}, met{0}, finished{0};
+    for (int i = 0; i < n; i++)
+        submit([&arrived, &met, &finished, n](int)
+               {
+                   arrived++;
+                   const auto until = steady_clock::now() + seconds(1);
+                   while (arrived.load() < n && steady_clock::now() < until)
+                       this_thread::yield();
+                   if (arrived.load() >= n)
+                       met++;
+                   finished++;
+               });
+    // tasks refer to the counters. workers run them sooner or later.
+    while (finished.load() < n)
+        this_thread::sleep_for(milliseconds(1));
+    return met.load() == n;
+}
+
+void unittest_ThreadPool()
+{
+    // Post/Push/Wait on the same pool, round after round
+    {
+        ThreadPool tp(4);
+        for (int r = 0; r < 50; r++)
+        {
+            atomic<int> cnt{0};
+            vector<future<int>> fs;
+            for (int i = 0; i < 1000; i++)
+                tp.Post([&cnt](int) { cnt++; });
+            for (int i = 0; i < 100; i++)
+                fs.push_back(tp.Push([&cnt](int, int v) { cnt++; return v; }, i));
+            tp.Wait();
+            Check(cnt.load() == 1100, "Wait waits for all Post/Push tasks of a round");
+            int sum = 0;
+            for (auto &f : fs)
+                sum += f.get();
+            Check(sum == 4950, "futures of Push return the results");
+        }
+
+        // tasks pushing tasks
+        atomic<int> cnt{0};
+        for (int i = 0; i < 100; i++)
+            tp.Post([&tp, &cnt](int)
+                    {
+                        for (int j = 0; j < 100; j++)
+                            tp.Post([&cnt](int) { cnt++; });
+                    });
+        tp.Wait();
+        Check(cnt.load() == 10000, "Wait waits for tasks pushed by tasks");
+    }
+
+    // bursts of pushes reach all sleeping workers
+    {
+        ThreadPool tp(4);
+        for (int r = 0; r < 20; r++)
+        {
+            this_thread::sleep_for(milliseconds(5));
+            Check(RunsConcurrently(4, [&tp](function<void(int)> f) { tp.Post(move(f)); }),
+                  "a burst of Post from outside wakes all sleeping workers");
+            tp.Wait();
+            this_thread::sleep_for(milliseconds(5));
+            tp.Post([&tp](int)
+                    { Check(RunsConcurrently(3, [&tp](function<void(int)> f) { tp.Post(move(f)); }),
+                            "a burst of Post from a worker wakes the other workers"); });
+            tp.Wait();
+        }
+    }
+
+    // ChangeThreadCount with pending tasks
+    {
+        atomic<int> cnt{0};
+        ThreadPool tp(2);
+        for (int r = 0; r < 20; r++)
+        {
+            for (int i = 0; i < 10000; i++)
+                tp.Post([&cnt](int) { cnt++; });
+            tp.ChangeThreadCount(r % 2 ? 1 : 6);
+        }
+        tp.ChangeThreadCount(0);
+        for (int i = 0; i < 100; i++)
+            tp.Post([&cnt](int) { cnt++; });
+        Check(tp.ThreadCount() == 0, "ChangeThreadCount(0) stops all threads");
+        tp.ChangeThreadCount(3);
+        tp.Wait();
+        Check(cnt.load() == 200100, "no task is lost while the number of threads changes");
+    }
+
+    // exceptions reach the futures
+    {
+        ThreadPool tp(3);
+        auto ok = tp.Push([](int, int a, string b) { return a + (int)b.size(); }, 5, string("abc"));
+        auto bad = tp.Push([](int) -> int { throw runtime_error("task failed"); });
+        Check(ok.get() == 8, "Push passes arguments");
+        bool thrown = false;
+        try
+        {
+            bad.get();
+        }
+        catch (const runtime_error &)
+        {
+            thrown = true;
+        }
+        Check(thrown, "exception of a task is rethrown by its future");
+        tp.Wait();
+    }
+}
+
+void unittest_ParallelFor()
+{
+    using Schedule = ThreadPool::Schedule;
+    for (int nThreads : {0, 1, 4})
+    {
+        ThreadPool tp(nThreads);
+        const int idBound = max(nThreads, 1);
+
+        // every index exactly once, for each schedule and chunk size
+        for (Schedule schedule : {Schedule::Static, Schedule::Dynamic, Schedule::Guided})
+            for (size_t chunk : {0, 1, 7, 1000})
+                for (size_t n : {0, 1, 13, 10007})
+                {
+                    const size_t begin = 5;
+                    vector<atomic<int>> visits(n);
+                    atomic<bool> validId{true};
+                    tp.ParallelFor(begin, begin + n, [&](int id, size_t i)
+                                   {
+                                       visits[i - begin]++;
+                                       if (id < 0 || id >= idBound)
+                                           validId = false;
+                                   },
+                                   schedule, chunk);
+                    bool once = true;
+                    for (auto &v : visits)
+                        once &= v.load() == 1;
+                    Check(once, "ParallelFor visits every index once");
+                    Check(validId.load(), "ParallelFor passes ids of the pool");
+
+                    const size_t sum = tp.ParallelReduce(
+                        begin, begin + n, (size_t)0, [](int, size_t i) { return i; },
+                        [](size_t a, size_t b) { return a + b; }, schedule, chunk);
+                    Check(sum == n * (2 * begin + n - 1) / 2, "ParallelReduce sums all the mapped values");
+                }
+
+        // parts of Static blocks are reduced in order
+        const vector<size_t> ordered = tp.ParallelReduce(
+            0, 1000, vector<size_t>(), [](int, size_t i) { return vector<size_t>{i}; },
+            [](vector<size_t> a, vector<size_t> b)
+            {
+                a.insert(a.end(), b.begin(), b.end());
+                return a;
+            });
+        bool inOrder = ordered.size() == 1000;
+        for (size_t i = 0; inOrder && i < ordered.size(); i++)
+            inOrder = ordered[i] == i;
+        Check(inOrder, "ParallelReduce with Static blocks keeps the order");
+
+        // nested ParallelFor
+        atomic<int> cnt{0};
+        tp.ParallelFor(0, 8, [&tp, &cnt](int, size_t)
+                       { tp.ParallelFor(0, 1000, [&cnt](int, size_t) { cnt++; }, Schedule::Dynamic); });
+        Check(cnt.load() == 8000, "nested ParallelFor runs all the inner loops");
+
+        // the first exception is rethrown
+        bool thrown = false;
+        try
+        {
+            tp.ParallelFor(0, 100, [](int, size_t i)
+                           {
+                               if (i == 37)
+                                   throw runtime_error("index failed");
+                           });
+        }
+        catch (const runtime_error &)
+        {
+            thrown = true;
+        }
+        Check(thrown, "ParallelFor rethrows an exception of f");
+
+        // TaskGroup reused for several rounds, with tasks adding tasks to the group
+        TaskGroup group(tp);
+        for (int r = 0; r < 20; r++)
+        {
+            cnt = 0;
+            for (int i = 0; i < 50; i++)
+                group.Run([&group, &cnt](int)
+                          {
+                              cnt++;
+                              group.Run([&cnt](int) { cnt++; });
+                          });
+            group.Wait();
+            Check(cnt.load() == 100, "TaskGroup Wait waits for all tasks of the round");
+        }
+        group.Run([](int) { throw runtime_error("task failed"); });
+        thrown = false;
+        try
+        {
+            group.Wait();
+        }
+        catch (const runtime_error &)
+        {
+            thrown = true;
+        }
+        Check(thrown, "TaskGroup Wait rethrows an exception of a task");
+        cnt = 0;
+        group.Run([&cnt](int) { cnt++; });
+        group.Wait();
+        Check(cnt.load() == 1, "TaskGroup is usable after rethrowing");
+    }
+}
+
 int main(int argc, char *argv[])
 {
+    // named tests given by arguments
+    map<string, function<void()>> tests = {
+        {"HNSW_Load", unittest_HNSW_Load},
+        {"ThreadPool", unittest_ThreadPool},
+        {"ParallelFor", unittest_ParallelFor},
+    };
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            auto it = tests.find(argv[i]);
+            if (it == tests.end())
+            {
+                cout << "unknown test: " << argv[i] << endl;
+                return 1;
+            }
+            size_t prevFailCnt = failCnt;
+            it->second();
+            cout << (failCnt == prevFailCnt ? "[ OK ] " : "[FAIL] ") << argv[i] << endl;
+        }
+        return failCnt == 0 ? 0 : 1;
+    }
+
     // SingletonCLI::Initialize();
     // CommonLogger::Initialize("./test/test.conf", "Log");
 
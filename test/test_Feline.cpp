@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <HashColon/GeoValues.hpp>
+#include <HashColon/Real.hpp>
+#include <HashColon/Feline/DtwSearch.hpp>
+#include <HashColon/Feline/PreparedTrajectory.hpp>
+#include <HashColon/Feline/TrajectoryClustering.hpp>
+#include <HashColon/Feline/TrajectoryDeduplication.hpp>
+
+using namespace std;
+using namespace HashColon;
+using namespace HashColon::Feline;
+using namespace HashColon::Feline::TrajectoryClustering;
+
+// number of failed checks of all tests run
+static size_t failCnt = 0;
+
+static void Check(bool condition, const string &what)
+{
+    if (!condition)
+    {
+        failCnt++;
+        cout << "    FAILED: " << what << endl;
+    }
+}
+
+// random walk of n points from start, step size in degree
+static XYList RandomTrajectory(mt19937 &rng, size_t n, XY start, Real step)
+{
+    normal_distribution<Real> noise(0, step);
+    XYList re;
+    XY p = start;
+    for (size_t i = 0; i < n; i++)
+    {
+        p.longitude += step + noise(rng);
+        p.latitude += noise(rng);
+        re.push_back(p);
+    }
+    return re;
+}
+
+static XY At(Real lon, Real lat)
+{
+    XY re;
+    re.longitude = lon;
+    re.latitude = lat;
+    return re;
+}
+
+void unittest_MeasureMatrix()
+{
+    mt19937 rng(1);
+    vector<XYList> data;
+    for (size_t t = 0; t < 40; t++)
+        data.push_back(RandomTrajectory(rng, 20, At(127.0, 35.0 + 0.01 * t), 0.005));
+
+    // default: no projected matrix, callers measure pairwise
+    Eigen::MatrixXR M;
+    Euclidean exact({{false, 0}, true, false});
+    Check(!exact.MeasureMatrix(data, M), "Euclidean matrix path must be opt-in");
+
+    // opt-in projected matrix approximates pairwise measurement(within 1%) in a small area
+    for (bool reversed : {false, true})
+    {
+        Euclidean projected({{reversed, 0}, true, true});
+        Check(projected.MeasureMatrix(data, M), "projected Euclidean matrix available for same-size data");
+        for (size_t i = 0; i < data.size(); i++)
+            for (size_t j = 0; j < data.size(); j++)
+            {
+                Real d = (i == j) ? 0 : projected.Measure(data[i], data[j]);
+                Check(abs(M(i, j) - d) <= 1e-2 * d + 1e-6, "Euclidean MeasureMatrix(i, j) ~ Measure(i, j)");
+            }
+    }
+
+    // PCA distances are measured in the same reduced space either way
+    ProjectedPCA pca({{false, 0}, 0, false});
+    pca.RunPCA(data);
+    Check(pca.MeasureMatrix(data, M), "ProjectedPCA matrix available");
+    for (size_t i = 0; i < data.size(); i++)
+        for (size_t j = 0; j < data.size(); j++)
+        {
+            Real d = (i == j) ? 0 : pca.Measure(data[i], data[j]);
+            Check(abs(M(i, j) - d) <= 1e-9 * (1 + d), "ProjectedPCA MeasureMatrix(i, j) == Measure(i, j)");
+        }
+
+    // EMD of a pair does not depend on the other trajectories measured together
+    data[3].resize(12);
+    data[7].resize(5);
+    for (size_t i = 0; i < 10; i++)
+        data.push_back(RandomTrajectory(rng, 25, At(127.0 + 0.3 * i, 33.0 + 0.5 * i), 0.02));
+    TrajectoryEMD emd({{false, 0}, TrajectoryEMD::ParticleWeight_SegmentLength, 8});
+    Check(emd.MeasureMatrix(data, M), "TrajectoryEMD matrix available");
+    vector<const XYList *> targets;
+    for (const XYList &t : data)
+        targets.push_back(&t);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        vector<Real> row;
+        emd.MeasureBatch(data[i], targets, row);
+        for (size_t j = 0; j < data.size(); j++)
+        {
+            Real d = (i == j) ? 0 : emd.Measure(data[i], data[j]);
+            Check(abs(M(i, j) - d) <= 1e-9 * (1 + d), "TrajectoryEMD MeasureMatrix(i, j) == Measure(i, j)");
+            Check(abs(row[j] - d) <= 1e-9 * (1 + d), "TrajectoryEMD MeasureBatch(i)[j] == Measure(i, j)");
+        }
+    }
+}
+
+void unittest_PreparedMatrix()
+{
+    mt19937 rng(5);
+    uniform_int_distribution<size_t> size(8, 25);
+    uniform_real_distribution<Real> offset(0, 0.3);
+    vector<XYList> data;
+    for (size_t t = 0; t < 30; t++)
+        data.push_back(RandomTrajectory(rng, size(rng), At(127.0 + offset(rng), 35.0 + offset(rng)), 0.005));
+
+    Eigen::MatrixXR M;
+    Check(!DynamicTimeWarping().MeasureMatrix(data, M), "prepared matrix path must be opt-in");
+
+    // prepared kernels approximate pairwise measurement(within 1%) in a small area
+    for (bool reversed : {false, true})
+    {
+        const TrajectoryDistanceMeasureBase::_Params base{reversed, 0, true};
+        const vector<pair<string, TrajectoryDistanceMeasureBase::Ptr>> measures = {
+            {"Hausdorff", make_shared<Hausdorff>(base)},
+            {"Euclidean", make_shared<Euclidean>(Euclidean::_Params{base, false, false})},
+            {"Merge", make_shared<Merge>(base)},
+            {"DynamicTimeWarping", make_shared<DynamicTimeWarping>(
+                                       DynamicTimeWarping::_Params{base, DynamicTimeWarping::DtwBand_SakoeChiba, 0.2, 2})},
+        };
+        for (const auto &m : measures)
+        {
+            // banded DTW is not symmetric. mirrored from i < j as ComputeDistanceMatrix does.
+            Check(m.second->MeasureMatrix(data, M), m.first + " prepared matrix available");
+            for (size_t i = 0; i < data.size(); i++)
+                for (size_t j = 0; j < data.size(); j++)
+                {
+                    Real d = (i == j) ? 0 : m.second->Measure(data[min(i, j)], data[max(i, j)]);
+                    Check(abs(M(i, j) - d) <= 1e-2 * d + 1e-3, m.first + " prepared MeasureMatrix(i, j) ~ Measure(i, j)");
+                }
+        }
+    }
+}
+
+void unittest_Deduplication()
+{
+    mt19937 rng(6);
+    uniform_real_distribution<Real> u(-1, 1);
+    auto euclidean = make_shared<Euclidean>(Euclidean::_Params{{false, 0, false}, false, false});
+    TrajectoryDeduplication<XYList> dedup(euclidean, {8, 1000, 500});
+
+    // copies shifted by ~300m in each axis, many of them across 1km cell boundaries
+    const size_t baseCnt = 20, copyCnt = 5;
+    vector<XYList> data;
+    for (size_t t = 0; t < baseCnt; t++)
+        data.push_back(RandomTrajectory(rng, 15, At(127.0 + 0.5 * t, 35.0), 0.01));
+    for (size_t t = 0; t < baseCnt; t++)
+        for (size_t c = 0; c < copyCnt; c++)
+        {
+            XYList copy = data[t];
+            const Real dLon = 0.003 * u(rng), dLat = 0.003 * u(rng);
+            for (XY &p : copy)
+            {
+                p.longitude += dLon;
+                p.latitude += dLat;
+            }
+            data.push_back(copy);
+        }
+
+    const DeduplicationResult re = dedup.Run(data);
+    Check(re.Representatives.size() == baseCnt, "near-duplicates across cell boundaries are collapsed");
+    Check(re.MemberOf.size() == data.size(), "every trajectory has a representative");
+    size_t weightSum = 0;
+    for (size_t r = 0; r < re.Representatives.size(); r++)
+    {
+        weightSum += re.Weights[r];
+        Check(re.MemberOf[re.Representatives[r]] == r, "representative is a member of itself");
+    }
+    Check(weightSum == data.size(), "weights sum up to the number of trajectories");
+    for (size_t i = 0; i < data.size(); i++)
+        Check(euclidean->Measure(data[re.Representatives[re.MemberOf[i]]], data[i]) <= 500,
+              "members are within DuplicateEpsilon to their representative");
+}
+
+void unittest_DtwSearch()
+{
+    mt19937 rng(2);
+    uniform_real_distribution<Real> u(-1, 1);
+
+    // tracks at high latitude spanning wide longitudes, tracks crossing the antimeridian, and compact ones
+    vector<vector<XYList>> datasets(3);
+    for (size_t t = 0; t < 40; t++)
+    {
+        datasets[0].push_back(RandomTrajectory(rng, 16, At(60 + 40 * u(rng), 72 + 2 * u(rng)), 5));
+        datasets[1].push_back(RandomTrajectory(rng, 16, At(172 + 3 * u(rng), -60 + 5 * u(rng)), 1));
+        datasets[2].push_back(RandomTrajectory(rng, 16, At(129 + u(rng), 35 + u(rng)), 0.05));
+    }
+    for (XYList &traj : datasets[1])
+        for (XY &p : traj)
+            p.longitude = p.longitude >= 180 ? p.longitude - 360 : p.longitude;
+
+    for (const vector<XYList> &data : datasets)
+    {
+        for (bool reversed : {false, true})
+        {
+            auto dtw = make_shared<DynamicTimeWarping>(
+                DynamicTimeWarping::_Params{{reversed, 0}, DynamicTimeWarping::DtwBand_SakoeChiba, 0.2, 2});
+            DtwSearch search(dtw, data);
+
+            Eigen::MatrixXR D(data.size(), data.size());
+            for (size_t i = 0; i < data.size(); i++)
+                for (size_t j = 0; j < data.size(); j++)
+                    D(i, j) = dtw->Measure(data[i], data[j]);
+
+            // lower bounds
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                const vector<Eigen::Vector2R> qLocal = search.ToLocal(data[i]);
+                for (size_t j = 0; j < data.size(); j++)
+                {
+                    Check(search.LB_Kim(data[i], j) <= D(i, j) * (1 + 1e-9), "LB_Kim <= DTW");
+                    Check(search.LB_Keogh(qLocal, j) <= D(i, j) * (1 + 1e-9), "LB_Keogh <= DTW");
+                }
+            }
+
+            // kNN against brute force, compared by distances for ties
+            const size_t k = 5;
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                vector<Real> expected;
+                for (size_t j = 0; j < data.size(); j++)
+                    expected.push_back(D(i, j));
+                sort(expected.begin(), expected.end());
+                const vector<size_t> knn = search.GetKNearest(data[i], k);
+                Check(knn.size() == k, "GetKNearest returns k items");
+                for (size_t r = 0; r < knn.size(); r++)
+                    Check(abs(D(i, knn[r]) - expected[r]) <= 1e-9 * (1 + expected[r]), "GetKNearest == brute force kNN");
+            }
+
+            // range neighbors against brute force
+            vector<Real> all(D.data(), D.data() + D.size());
+            sort(all.begin(), all.end());
+            for (Real eps : {all[all.size() / 10], all[all.size() / 3]})
+            {
+                const vector<vector<size_t>> nb = search.GetRangeNeighbors(eps);
+                for (size_t i = 0; i < data.size(); i++)
+                {
+                    vector<size_t> expected;
+                    for (size_t j = 0; j < data.size(); j++)
+                        if (i != j && D(min(i, j), max(i, j)) < eps)
+                            expected.push_back(j);
+                    Check(nb[i] == expected, "GetRangeNeighbors == brute force range query");
+                }
+            }
+        }
+    }
+}
+
+// full-table references. cost of the first cell is not counted in DTW, normalized by n + m.
+static Real NaiveDTW(const XYList &a, const XYList &b, const vector<pair<size_t, size_t>> &band)
+{
+    const size_t n = a.size(), m = b.size();
+    const Real inf = numeric_limits<Real>::infinity();
+    vector<vector<Real>> D(n, vector<Real>(m, inf));
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = band[i].first; j <= band[i].second; j++)
+        {
+            if (i == 0 && j == 0)
+            {
+                D[i][j] = 0;
+                continue;
+            }
+            Real reach = inf;
+            if (i > 0)
+                reach = min(reach, D[i - 1][j]);
+            if (j > 0)
+                reach = min(reach, D[i][j - 1]);
+            if (i > 0 && j > 0)
+                reach = min(reach, D[i - 1][j - 1]);
+            D[i][j] = a[i].DistanceTo(b[j]) + reach;
+        }
+    return D[n - 1][m - 1] / (Real)(n + m);
+}
+
+static Real NaiveFrechet(const XYList &a, const XYList &b)
+{
+    const size_t n = a.size(), m = b.size();
+    vector<vector<Real>> C(n, vector<Real>(m));
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < m; j++)
+        {
+            Real reach = numeric_limits<Real>::infinity();
+            if (i == 0 && j == 0)
+                reach = 0;
+            if (i > 0)
+                reach = min(reach, C[i - 1][j]);
+            if (j > 0)
+                reach = min(reach, C[i][j - 1]);
+            if (i > 0 && j > 0)
+                reach = min(reach, C[i - 1][j - 1]);
+            C[i][j] = max(reach, a[i].DistanceTo(b[j]));
+        }
+    return C[n - 1][m - 1];
+}
+
+static XYList Reversed(const XYList &a)
+{
+    XYList re = a;
+    reverse(re.begin(), re.end());
+    return re;
+}
+
+// random pairs: unrelated, similar, and similar to the reversed one, of sizes 1 ~ 30
+static vector<pair<XYList, XYList>> RandomPairs(mt19937 &rng, size_t cnt)
+{
+    uniform_int_distribution<size_t> size(1, 30);
+    uniform_int_distribution<int> kind(0, 2);
+    normal_distribution<Real> noise(0, 0.002);
+    vector<pair<XYList, XYList>> re;
+    for (size_t k = 0; k < cnt; k++)
+    {
+        XYList a = RandomTrajectory(rng, size(rng), At(129, 35), 0.01);
+        XYList b;
+        const int t = kind(rng);
+        if (t == 0)
+            b = RandomTrajectory(rng, size(rng), At(129, 35), 0.01);
+        else
+        {
+            // resampled copy of a with noise, so that sizes differ
+            const size_t m = size(rng);
+            for (size_t j = 0; j < m; j++)
+            {
+                XY p = a[a.size() == 1 ? 0 : (size_t)llround((Real)j * (Real)(a.size() - 1) / (Real)max<size_t>(m - 1, 1))];
+                p.longitude += noise(rng);
+                p.latitude += noise(rng);
+                b.push_back(p);
+            }
+            if (t == 2)
+                b = Reversed(b);
+        }
+        re.emplace_back(a, b);
+    }
+    return re;
+}
+
+void unittest_DtwFrechetKernels()
+{
+    mt19937 rng(4);
+    const vector<pair<XYList, XYList>> pairs = RandomPairs(rng, 400);
+    const Real inf = numeric_limits<Real>::infinity();
+
+    // result with upperBound: exact if below the bound, otherwise abandoned(infinity) or any value not below it
+    auto checkBounded = [](Real re, Real expected, Real upperBound, const string &what)
+    {
+        if (expected < upperBound)
+            Check(abs(re - expected) <= 1e-9 * (1 + expected), what + " below upperBound is exact");
+        else
+            Check(re >= upperBound, what + " above upperBound is not below it");
+    };
+
+    const vector<DynamicTimeWarping::_Params> dtwParams = {
+        {{false, 0}, DynamicTimeWarping::DtwBand_None, 0, 2},
+        {{false, 0}, DynamicTimeWarping::DtwBand_SakoeChiba, 0.1, 2},
+        {{false, 0}, DynamicTimeWarping::DtwBand_SakoeChiba, 0.3, 2},
+        {{false, 0}, DynamicTimeWarping::DtwBand_Itakura, 0, 2},
+    };
+    for (DynamicTimeWarping::_Params params : dtwParams)
+    {
+        const DynamicTimeWarping forward(params);
+        params.Enable_ReversedSequence = true;
+        const DynamicTimeWarping both(params);
+        for (const auto &[a, b] : pairs)
+        {
+            const vector<pair<size_t, size_t>> band = forward.GetBand(a.size(), b.size());
+            const Real f = NaiveDTW(a, b, band);
+            const Real r = NaiveDTW(Reversed(a), b, band);
+            Check(abs(forward.Measure(a, b) - f) <= 1e-9 * (1 + f), "DTW == full-table DTW");
+            Check(abs(both.Measure(a, b) - min(f, r)) <= 1e-9 * (1 + min(f, r)),
+                  "DTW of both directions == min(D(a, b), D(a.rev, b))");
+            for (Real ratio : {0.5, 0.999, 1.001, 2.0})
+            {
+                checkBounded(forward.Measure(a, b, f * ratio), f, f * ratio, "DTW");
+                checkBounded(both.Measure(a, b, min(f, r) * ratio), min(f, r), min(f, r) * ratio, "DTW of both directions");
+                checkBounded(both.Measure(a, b, max(f, r) * ratio), min(f, r), max(f, r) * ratio, "DTW of both directions");
+            }
+            Check(both.Measure(a, b, inf) == both.Measure(a, b), "DTW with infinite upperBound");
+        }
+    }
+
+    const DiscreteFrechet forward({false, 0});
+    const DiscreteFrechet both({true, 0});
+    for (const auto &[a, b] : pairs)
+    {
+        const Real f = NaiveFrechet(a, b);
+        const Real r = NaiveFrechet(Reversed(a), b);
+        Check(forward.Measure(a, b) == f, "discrete Frechet == full-table discrete Frechet");
+        Check(both.Measure(a, b) == min(f, r), "discrete Frechet of both directions == min(D(a, b), D(a.rev, b))");
+        for (Real ratio : {0.5, 0.999, 1.001, 2.0})
+        {
+            checkBounded(forward.Measure(a, b, f * ratio), f, f * ratio, "discrete Frechet");
+            checkBounded(both.Measure(a, b, min(f, r) * ratio), min(f, r), min(f, r) * ratio, "discrete Frechet of both directions");
+            checkBounded(both.Measure(a, b, max(f, r) * ratio), min(f, r), max(f, r) * ratio, "discrete Frechet of both directions");
+        }
+    }
+}
+
+void unittest_FrechetIsWithin()
+{
+    mt19937 rng(5);
+    const vector<pair<XYList, XYList>> pairs = RandomPairs(rng, 1000);
+    uniform_real_distribution<Real> ratio(0.5, 1.5);
+
+    // IsWithin decides D < eps, as DBSCAN neighbors are. at eps == D exactly, it is false.
+    for (bool reversed : {false, true})
+    {
+        const DiscreteFrechet measure({reversed, 0});
+        for (const auto &[a, b] : pairs)
+        {
+            Real d = NaiveFrechet(a, b);
+            if (reversed)
+                d = min(d, NaiveFrechet(Reversed(a), b));
+            Check(measure.Measure(a, b) == d, "Measure == full-table discrete Frechet");
+            for (Real eps : {d, d * (1 - 1e-9), d * (1 + 1e-9), d * ratio(rng), d * ratio(rng)})
+                Check(measure.IsWithin(a, b, eps) == (d < eps), "IsWithin(a, b, eps) == (D(a, b) < eps)");
+        }
+    }
+}
+
+void unittest_Hausdorff()
+{
+    mt19937 rng(6);
+    const vector<pair<XYList, XYList>> pairs = RandomPairs(rng, 300);
+    auto directed = [](const XYList &from, const XYList &to)
+    {
+        Real re = 0;
+        for (const XY &x : from)
+        {
+            Real nearest = numeric_limits<Real>::infinity();
+            for (const XY &y : to)
+                nearest = min(nearest, x.DistanceTo(y));
+            re = max(re, nearest);
+        }
+        return re;
+    };
+
+    // sequential and inner-parallel kernels
+    for (size_t threshold : {0, 1})
+    {
+        const Hausdorff measure({false, threshold});
+        for (const auto &[a, b] : pairs)
+        {
+            const Real d = max(directed(a, b), directed(b, a));
+            Check(measure.Measure(a, b) == d, "Hausdorff == brute force");
+            Check(measure.Measure(a, b, d * 1.001) == d, "Hausdorff below upperBound is exact");
+            Check(measure.Measure(a, b, d * 0.999) >= d * 0.999, "Hausdorff above upperBound is not below it");
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    GeoDistance::SetDistanceMethod(HaversineDistance);
+
+    map<string, function<void()>> tests = {
+        {"MeasureMatrix", unittest_MeasureMatrix},
+        {"PreparedMatrix", unittest_PreparedMatrix},
+        {"Deduplication", unittest_Deduplication},
+        {"DtwSearch", unittest_DtwSearch},
+        {"DtwFrechetKernels", unittest_DtwFrechetKernels},
+        {"FrechetIsWithin", unittest_FrechetIsWithin},
+        {"Hausdorff", unittest_Hausdorff},
+    };
+
+    // runs the tests given by arguments, or all of them
+    vector<string> names(argv + 1, argv + argc);
+    if (names.empty())
+        for (auto &t : tests)
+            names.push_back(t.first);
+
+    for (const string &name : names)
+    {
+        auto it = tests.find(name);
+        if (it == tests.end())
+        {
+            cout << "unknown test: " << name << endl;
+            return 1;
+        }
+        size_t prevFailCnt = failCnt;
+        it->second();
+        cout << (failCnt == prevFailCnt ? "[ OK ] " : "[FAIL] ") << name << endl;
+    }
+    return failCnt == 0 ? 0 : 1;
+}